@@ -29,12 +29,6 @@
 #include "dutil.h"
 #include "dwarves.h"
 
-/*
- * FIXME: We should just get the table from the BTF ELF section
- * and use it directly
- */
-extern struct strings *strings;
-
 static void *tag__alloc(const size_t size)
 {
 	struct tag *tag = zalloc(size);
@@ -213,15 +207,17 @@ static int create_members(struct btf_elf *btfe, void *ptr, int vlen, struct type
 			  bool kflag)
 {
 	struct btf_member *mp = ptr;
+	/* Contiguous, see die__process_class() in the DWARF loader */
+	struct class_member *members = vlen ? zalloc(vlen * sizeof(*members)) : NULL;
 	int i;
 
+	if (vlen != 0 && members == NULL)
+		return -ENOMEM;
+
 	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+		struct class_member *member = &members[i];
 		uint32_t offset;
 
-		if (member == NULL)
-			return -ENOMEM;
-
 		member->tag.tag    = DW_TAG_member;
 		member->tag.type   = btf_elf__get32(btfe, &mp[i].type);
 		member->name	   = btf_elf__get32(btfe, &mp[i].name_off);
@@ -610,7 +606,7 @@ int btf_elf__load_file(struct cus *cus, struct conf_load *conf, const char *file
 		return -1;
 
 	cu->language = LANG_C;
-	cu->uses_global_strings = false;
+	cu->strings = cus->strings;
 	cu->little_endian = !btfe->is_big_endian;
 	cu->dfops = &btf_elf__ops;
 	cu->priv = btfe;
@@ -0,0 +1,11 @@
+/*
+  Copyright (C) 2007 Arnaldo Carvalho de Melo <acme@redhat.com>
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+*/
+
+#define HAVE_DWFL_MODULE_BUILD_ID
+#define HAVE_LIBLZMA
+/* #undef HAVE_ZSTD */
@@ -7,3 +7,5 @@
 */
 
 #cmakedefine HAVE_DWFL_MODULE_BUILD_ID
+#cmakedefine HAVE_LIBLZMA
+#cmakedefine HAVE_ZSTD
@@ -231,12 +231,6 @@ static struct variable *hashaddr__find_variable(const struct hlist_head hashtabl
 	return NULL;
 }
 
-/*
- * FIXME: Its in the DWARF loader, we have to find a better handoff
- * mechanizm...
- */
-extern struct strings *strings;
-
 int cu__encode_ctf(struct cu *cu, int verbose)
 {
 	int err = -1;
@@ -248,7 +242,7 @@ int cu__encode_ctf(struct cu *cu, int verbose)
 	if (cu__cache_symtab(cu) < 0)
 		goto out_delete;
 
-	ctf__set_strings(ctf, &strings->gb);
+	ctf__set_strings(ctf, &cu->strings->gb);
 
 	uint32_t id;
 	struct tag *pos;
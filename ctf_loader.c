@@ -24,12 +24,6 @@
 #include "dutil.h"
 #include "dwarves.h"
 
-/*
- * FIXME: We should just get the table from the CTF ELF section
- * and use it directly
- */
-extern struct strings *strings;
-
 static void *tag__alloc(const size_t size)
 {
 	struct tag *tag = zalloc(size);
@@ -282,13 +276,15 @@ static int create_full_members(struct ctf *ctf, void *ptr,
 			       int vlen, struct type *class)
 {
 	struct ctf_full_member *mp = ptr;
+	/* Contiguous, see die__process_class() in the DWARF loader */
+	struct class_member *members = vlen ? zalloc(vlen * sizeof(*members)) : NULL;
 	int i;
 
-	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+	if (vlen != 0 && members == NULL)
+		return -ENOMEM;
 
-		if (member == NULL)
-			return -ENOMEM;
+	for (i = 0; i < vlen; i++) {
+		struct class_member *member = &members[i];
 
 		member->tag.tag = DW_TAG_member;
 		member->tag.type = ctf__get16(ctf, &mp[i].ctf_member_type);
@@ -306,13 +302,15 @@ static int create_short_members(struct ctf *ctf, void *ptr,
 				int vlen, struct type *class)
 {
 	struct ctf_short_member *mp = ptr;
+	/* Contiguous, see die__process_class() in the DWARF loader */
+	struct class_member *members = vlen ? zalloc(vlen * sizeof(*members)) : NULL;
 	int i;
 
-	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+	if (vlen != 0 && members == NULL)
+		return -ENOMEM;
 
-		if (member == NULL)
-			return -ENOMEM;
+	for (i = 0; i < vlen; i++) {
+		struct class_member *member = &members[i];
 
 		member->tag.tag = DW_TAG_member;
 		member->tag.type = ctf__get16(ctf, &mp[i].ctf_member_type);
@@ -734,7 +732,7 @@ int ctf__load_file(struct cus *cus, struct conf_load *conf,
 		return -1;
 
 	cu->language = LANG_C;
-	cu->uses_global_strings = false;
+	cu->strings = cus->strings;
 	cu->little_endian = state->ehdr.e_ident[EI_DATA] == ELFDATA2LSB;
 	cu->dfops = &ctf__ops;
 	cu->priv = state;
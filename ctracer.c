@@ -21,6 +21,7 @@
 
 #include "dwarves_reorganize.h"
 #include "dwarves_emit.h"
+#include "dwarves_type_graph.h"
 #include "dwarves.h"
 #include "dutil.h"
 #include "elf_symtab.h"
@@ -90,6 +91,24 @@ static struct cu *cu_filter(struct cu *cu)
 	return cu;
 }
 
+/*
+ * Blacklisted CUs will never be instrumented, so don't even process their
+ * DIEs, just skip them at load time. That also means the traced struct is
+ * only looked for in the other CUs. CUs without a DW_AT_name are loaded as
+ * "", filter them the same way as cu_filter() does.
+ */
+static bool ctracer__early_cu_filter(const char *name,
+				     const char *producer __unused,
+				     uint16_t language __unused,
+				     struct conf_load *conf __unused)
+{
+	return !strlist__has_entry(cu_blacklist, name ?: "");
+}
+
+static struct conf_load ctracer__conf_load = {
+	.early_cu_filter = ctracer__early_cu_filter,
+};
+
 /*
  * List of probes and kretprobes already emitted, this is a hack to cope with
  * name space collisions, a better solution would be to in these cases to use the
@@ -495,133 +514,75 @@ static int class__emit_ostra_converter(struct tag *tag,
 }
 
 /*
- * We want just the DW_TAG_structure_type tags that have a member that is a pointer
- * to the target class.
+ * Who embeds or has pointers to each struct, built in one pass over all the
+ * CUs, instead of one pass per aliased struct.
  */
-static struct tag *pointer_filter(struct tag *tag, struct cu *cu,
-				  type_id_t target_type_id)
-{
-	struct type *type;
-	struct class_member *pos;
-	const char *class_name;
+static struct type_graph *type_graph;
 
-	if (!tag__is_struct(tag))
-		return NULL;
-
-	type = tag__type(tag);
-	if (type->nr_members == 0)
-		return NULL;
-
-	class_name = class__name(tag__class(tag), cu);
-	if (class_name == NULL || structures__find(&pointers, class_name))
-		return NULL;
-
-	type__for_each_member(type, pos) {
-		struct tag *ctype = cu__type(cu, pos->tag.type);
-
-		tag__assert_search_result(ctype);
-		if (tag__is_pointer_to(ctype, target_type_id))
-			return tag;
-	}
+static int cu_type_graph_iterator(struct cu *cu, void *graph)
+{
+	int err = type_graph__add_cu(graph, cu, NULL, NULL);
 
-	return NULL;
+	if (err != 0)
+		fprintf(stderr, "ctracer: insufficient memory for processing %s\n", cu->name);
+	return err;
 }
 
 /*
- * Iterate thru all the tags in the compilation unit, looking for classes
- * that have as one member that is a pointer to the target type.
+ * We want just the structs that have a member that is a pointer to the
+ * target class.
  */
-static int cu_find_pointers_iterator(struct cu *cu, void *class_name)
+static void class__find_pointers(const char *class_name)
 {
-	type_id_t target_type_id, id;
-	struct tag *target = cu__find_struct_by_name(cu, class_name, 0,
-						     &target_type_id), *pos;
+	uint32_t idx = type_graph__find(type_graph, class_name, TYPE_GRAPH__STRUCT);
+	const struct type_ref *ref;
 
-	if (target == NULL)
-		return 0;
+	if (idx == TYPE_GRAPH__NONE)
+		return;
 
-	cu__for_each_type(cu, id, pos)
-		if (pointer_filter(pos, cu, target_type_id))
-			structures__add(&pointers, pos, cu);
+	type_graph__for_each_ref(type_graph, &type_graph->nodes[idx], ref) {
+		const struct type_graph_node *from = &type_graph->nodes[ref->from];
 
-	return 0;
-}
-
-static void class__find_pointers(const char *class_name)
-{
-	cus__for_each_cu(methods_cus, cu_find_pointers_iterator, (void *)class_name, cu_filter);
+		if (ref->kind == TYPE_REF__POINTS_TO &&
+		    from->kind == TYPE_GRAPH__STRUCT && tag__is_struct(from->tag) &&
+		    structures__find(&pointers, from->name) == NULL)
+			structures__add(&pointers, from->tag, from->cu);
+	}
 }
 
 /*
- * We want just the DW_TAG_structure_type tags that have as its first member
- * a struct of type target.
+ * We want just the structs that have as its first member the specified
+ * "class" (struct), and the ones that have those as its first member, e.g.:
+ *
+ * struct tcp_sock {
+ * 	struct inet_connection_sock {
+ * 		struct inet_sock {
+ * 			struct sock {
+ * 			}
+ * 		}
+ * 	}
+ * }
  */
-static struct tag *alias_filter(struct tag *tag, const struct cu *cu,
-				type_id_t target_type_id)
+static void class__find_aliases(const char *class_name)
 {
-	struct type *type;
-	struct class_member *first_member;
+	uint32_t idx = type_graph__find(type_graph, class_name, TYPE_GRAPH__STRUCT);
+	const struct type_ref *ref;
 
-	if (!tag__is_struct(tag))
-		return NULL;
+	if (idx == TYPE_GRAPH__NONE)
+		return;
 
-	type = tag__type(tag);
-	if (type->nr_members == 0)
-		return NULL;
+	type_graph__for_each_ref(type_graph, &type_graph->nodes[idx], ref) {
+		const struct type_graph_node *from = &type_graph->nodes[ref->from];
 
-	first_member = list_first_entry(&type->namespace.tags,
-					struct class_member, tag.node);
-	if (first_member->tag.type != target_type_id)
-		return NULL;
-
-	if (structures__find(&aliases, class__name(tag__class(tag), cu)))
-		return NULL;
-
-	return tag;
-}
-
-static void class__find_aliases(const char *class_name);
-
-/*
- * Iterate thru all the tags in the compilation unit, looking for classes
- * that have as its first member the specified "class" (struct).
- */
-static int cu_find_aliases_iterator(struct cu *cu, void *class_name)
-{
-	type_id_t target_type_id, id;
-	struct tag *target = cu__find_struct_by_name(cu, class_name, 0,
-						     &target_type_id), *pos;
-	if (target == NULL)
-		return 0;
+		if (ref->kind != TYPE_REF__EMBEDS || ref->offset != 0 ||
+		    ref->nr_elements != 1 || from->kind != TYPE_GRAPH__STRUCT ||
+		    !tag__is_struct(from->tag) ||
+		    structures__find(&aliases, from->name) != NULL)
+			continue;
 
-	cu__for_each_type(cu, id, pos) {
-		if (alias_filter(pos, cu, target_type_id)) {
-			const char *alias_name = class__name(tag__class(pos), cu);
-
-			structures__add(&aliases, pos, cu);
-
-			/*
-			 * Now find aliases to this alias, e.g.:
-			 *
-			 * struct tcp_sock {
-			 * 	struct inet_connection_sock {
-			 * 		struct inet_sock {
-			 * 			struct sock {
-			 * 			}
-			 * 		}
-			 * 	}
-			 * }
-			 */
-			class__find_aliases(alias_name);
-		}
+		structures__add(&aliases, from->tag, from->cu);
+		class__find_aliases(from->name);
 	}
-
-	return 0;
-}
-
-static void class__find_aliases(const char *class_name)
-{
-	cus__for_each_cu(methods_cus, cu_find_aliases_iterator, (void *)class_name, cu_filter);
 }
 
 static void emit_list_of_types(struct list_head *list, const struct cu *cu)
@@ -1005,13 +966,20 @@ failure:
 		goto out;
 	}
 
+	cu_blacklist = strlist__new(true);
+	if (cu_blacklist == NULL) {
+		fputs("ctracer: insufficient memory\n", stderr);
+		goto out;
+	}
+	strlist__load(cu_blacklist, cu_blacklist_filename);
+
 	/*
          * if --dir/-D was specified, recursively traverse the path looking for
          * object files (compilation units) that match the glob specified (*.ko)
          * for kernel modules, but could be "*.o" in the future when we support
          * uprobes for user space tracing.
 	 */
-	if (dirname != NULL && cus__load_dir(methods_cus, NULL, dirname, glob,
+	if (dirname != NULL && cus__load_dir(methods_cus, &ctracer__conf_load, dirname, glob,
 					     recursive) != 0) {
 		fprintf(stderr, "ctracer: couldn't load DWARF info "
 				"from %s dir with glob %s\n",
@@ -1028,7 +996,7 @@ failure:
 					"info from %s\n", filename);
 			goto out;
 		}
-		err = cus__load_file(methods_cus, NULL, filename);
+		err = cus__load_file(methods_cus, &ctracer__conf_load, filename);
 		if (err != 0) {
 			cus__print_error_msg("ctracer", methods_cus, filename, err);
 			goto out;
@@ -1092,6 +1060,14 @@ failure:
 	      "%}\n\n", fp_methods);
 
 	fputs("\n#include \"ctracer_classes.h\"\n\n", fp_collector);
+
+	type_graph = type_graph__new();
+	if (type_graph == NULL) {
+		fputs("ctracer: insufficient memory\n", stderr);
+		goto out;
+	}
+	cus__for_each_cu(methods_cus, cu_type_graph_iterator, type_graph, cu_filter);
+
 	class__find_aliases(class_name);
 	class__find_pointers(class_name);
 
@@ -1100,10 +1076,6 @@ failure:
 
 	class__emit_ostra_converter(class, cu);
 
-	cu_blacklist = strlist__new(true);
-	if (cu_blacklist != NULL)
-		strlist__load(cu_blacklist, cu_blacklist_filename);
-
 	cus__for_each_cu(methods_cus, cu_find_methods_iterator,
 			 class_name, cu_filter);
 	cus__for_each_cu(methods_cus, cu_emit_probes_iterator,
@@ -1136,10 +1108,11 @@ failure:
 	fclose(fp_collector);
 	fclose(fp_functions);
 	fclose(fp_classes);
-	strlist__delete(cu_blacklist);
 
 	rc = EXIT_SUCCESS;
 out:
+	type_graph__delete(type_graph);
+	strlist__delete(cu_blacklist);
 	cus__delete(methods_cus);
 	dwarves__exit();
 	return rc;
@@ -0,0 +1,361 @@
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Copyright (C) 2020 Arnaldo Carvalho de Melo <acme@redhat.com>
+
+  Uncompress gzip, xz and zstd containers into memory, so that libelf and
+  libdwfl can process compressed kernel modules, vmlinux.gz, etc without
+  first decompressing them to a temporary file.
+*/
+
+#include "decompress.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "dutil.h"
+
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b, };
+static const unsigned char xz_magic[]	= { 0xfd, '7', 'z', 'X', 'Z', 0x00, };
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd, };
+
+enum decompress_kind decompress__kind(int fd)
+{
+	unsigned char magic[8];
+	ssize_t n = pread(fd, magic, sizeof(magic), 0);
+
+	if (n >= (ssize_t)sizeof(gzip_magic) &&
+	    memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0)
+		return DECOMPRESS__GZIP;
+	if (n >= (ssize_t)sizeof(xz_magic) &&
+	    memcmp(magic, xz_magic, sizeof(xz_magic)) == 0)
+		return DECOMPRESS__XZ;
+	if (n >= (ssize_t)sizeof(zstd_magic) &&
+	    memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0)
+		return DECOMPRESS__ZSTD;
+
+	return DECOMPRESS__NONE;
+}
+
+const char *decompress__kind_name(enum decompress_kind kind)
+{
+	switch (kind) {
+	case DECOMPRESS__GZIP: return "gzip";
+	case DECOMPRESS__XZ:   return "xz";
+	case DECOMPRESS__ZSTD: return "zstd";
+	case DECOMPRESS__NONE: break;
+	}
+
+	return "none";
+}
+
+/*
+ * Output buffer that doubles in size when full, the compressed size times
+ * four is a good first guess for ELF files with DWARF.
+ */
+struct decompress_out {
+	unsigned char *buf;
+	size_t	      size;
+	size_t	      allocated_size;
+};
+
+static int decompress_out__grow(struct decompress_out *out)
+{
+	size_t new_size = out->allocated_size * 2;
+	unsigned char *buf;
+
+	if (new_size < out->allocated_size)
+		return -ENOMEM;
+
+	buf = realloc(out->buf, new_size);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	out->buf = buf;
+	out->allocated_size = new_size;
+	return 0;
+}
+
+static int gzip__decompress(const void *in, size_t in_size,
+			    struct decompress_out *out)
+{
+	z_stream zs = {
+		.next_in  = (Bytef *)in,
+	};
+	size_t remaining = in_size;
+	int err = -EINVAL, zerr;
+
+	/* 15 + 32: maximum window size, autodetect gzip or zlib header */
+	if (inflateInit2(&zs, 15 + 32) != Z_OK)
+		return -ENOMEM;
+
+	do {
+		if (zs.avail_in == 0) {
+			zs.avail_in = remaining > UINT_MAX ? UINT_MAX : remaining;
+			remaining -= zs.avail_in;
+		}
+
+		if (out->size == out->allocated_size &&
+		    decompress_out__grow(out) != 0) {
+			err = -ENOMEM;
+			goto out_end;
+		}
+
+		zs.next_out  = out->buf + out->size;
+		zs.avail_out = out->allocated_size - out->size > UINT_MAX ?
+				UINT_MAX : out->allocated_size - out->size;
+
+		const uInt avail_out = zs.avail_out;
+
+		zerr = inflate(&zs, Z_NO_FLUSH);
+		out->size += avail_out - zs.avail_out;
+
+		/* gzip allows concatenated members, as produced by 'cat a.gz b.gz' */
+		if (zerr == Z_STREAM_END) {
+			if (zs.avail_in == 0 && remaining == 0)
+				break;
+			if (inflateReset(&zs) != Z_OK)
+				goto out_end;
+			zerr = Z_OK;
+		} else if (zerr == Z_BUF_ERROR && zs.avail_in == 0 &&
+			   remaining == 0) /* Truncated */
+			break;
+	} while (zerr == Z_OK || zerr == Z_BUF_ERROR);
+
+	if (zerr == Z_STREAM_END)
+		err = 0;
+out_end:
+	inflateEnd(&zs);
+	return err;
+}
+
+#ifdef HAVE_LIBLZMA
+static int xz__decompress(const void *in, size_t in_size,
+			  struct decompress_out *out)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_ret ret;
+	int err = -EINVAL;
+
+	if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+		return -ENOMEM;
+
+	strm.next_in  = in;
+	strm.avail_in = in_size;
+
+	do {
+		if (out->size == out->allocated_size &&
+		    decompress_out__grow(out) != 0) {
+			err = -ENOMEM;
+			goto out_end;
+		}
+
+		strm.next_out  = out->buf + out->size;
+		strm.avail_out = out->allocated_size - out->size;
+
+		const size_t avail_out = strm.avail_out;
+
+		ret = lzma_code(&strm, strm.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+		out->size += avail_out - strm.avail_out;
+	} while (ret == LZMA_OK);
+
+	if (ret == LZMA_STREAM_END)
+		err = 0;
+	else if (ret == LZMA_MEM_ERROR)
+		err = -ENOMEM;
+out_end:
+	lzma_end(&strm);
+	return err;
+}
+#else
+static int xz__decompress(const void *in __unused,
+			  size_t in_size __unused,
+			  struct decompress_out *out __unused)
+{
+	return -ENOTSUP;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int zstd__decompress(const void *in, size_t in_size,
+			    struct decompress_out *out)
+{
+	ZSTD_DStream *dstream = ZSTD_createDStream();
+	ZSTD_inBuffer input = {
+		.src  = in,
+		.size = in_size,
+	};
+	size_t ret;
+	int err = -EINVAL;
+
+	if (dstream == NULL)
+		return -ENOMEM;
+
+	/* A zero return means the last frame was fully decoded and flushed */
+	do {
+		if (out->size == out->allocated_size &&
+		    decompress_out__grow(out) != 0) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+
+		ZSTD_outBuffer output = {
+			.dst  = out->buf,
+			.size = out->allocated_size,
+			.pos  = out->size,
+		};
+
+		ret = ZSTD_decompressStream(dstream, &output, &input);
+		if (ZSTD_isError(ret))
+			goto out_free;
+		/* Truncated: no more input and still room for output */
+		if (ret != 0 && input.pos == input.size &&
+		    output.pos < output.size)
+			goto out_free;
+		out->size = output.pos;
+	} while (ret != 0 || input.pos < input.size);
+
+	err = 0;
+out_free:
+	ZSTD_freeDStream(dstream);
+	return err;
+}
+#else
+static int zstd__decompress(const void *in __unused,
+			    size_t in_size __unused,
+			    struct decompress_out *out __unused)
+{
+	return -ENOTSUP;
+}
+#endif
+
+/*
+ * Returns 0 with *bufp set to NULL if fd isn't a known compressed
+ * container, 0 with *bufp pointing to a malloc'ed buffer with *sizep bytes
+ * of uncompressed contents, or a negative errno.
+ */
+int decompress__fd(int fd, void **bufp, size_t *sizep)
+{
+	enum decompress_kind kind = decompress__kind(fd);
+	struct decompress_out out = { .buf = NULL, };
+	struct stat st;
+	void *in;
+	int err;
+
+	*bufp = NULL;
+	*sizep = 0;
+
+	if (kind == DECOMPRESS__NONE)
+		return 0;
+
+	if (fstat(fd, &st) != 0)
+		return -errno;
+
+	in = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (in == MAP_FAILED)
+		return -errno;
+
+	out.allocated_size = st.st_size * 4;
+	if (out.allocated_size < 4096)
+		out.allocated_size = 4096;
+
+	out.buf = malloc(out.allocated_size);
+	if (out.buf == NULL) {
+		err = -ENOMEM;
+		goto out_unmap;
+	}
+
+	switch (kind) {
+	case DECOMPRESS__GZIP: err = gzip__decompress(in, st.st_size, &out); break;
+	case DECOMPRESS__XZ:   err = xz__decompress(in, st.st_size, &out);   break;
+	case DECOMPRESS__ZSTD: err = zstd__decompress(in, st.st_size, &out); break;
+	default:	       err = -EINVAL;				     break;
+	}
+
+	if (err != 0) {
+		free(out.buf);
+		goto out_unmap;
+	}
+
+	*bufp = out.buf;
+	*sizep = out.size;
+out_unmap:
+	munmap(in, st.st_size);
+	return err;
+}
+
+/*
+ * libdwfl only reports modules from file descriptors, so expose the
+ * uncompressed contents thru an anonymous, memory backed file.
+ */
+int decompress__memfd(const char *name, const void *buf, size_t size)
+{
+	const char *p = buf, *slash = strrchr(name, '/');
+	int fd;
+
+	/* memfd names are just for /proc/PID/fd, and are limited in size */
+	if (slash != NULL)
+		name = slash + 1;
+	if (strlen(name) > 200)
+		name = "dwarves";
+
+	fd = memfd_create(name, MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+
+	while (size != 0) {
+		ssize_t n = write(fd, p, size);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			n = -errno;
+			close(fd);
+			return n;
+		}
+		p += n;
+		size -= n;
+	}
+
+	return fd;
+}
+
+/*
+ * elf_begin() for possibly compressed files, *bufp is set to the buffer
+ * with the uncompressed contents, to be freed after elf_end(), or NULL.
+ */
+Elf *decompress__elf_begin(int fd, void **bufp)
+{
+	size_t size;
+	Elf *elf;
+
+	if (decompress__fd(fd, bufp, &size) < 0)
+		return NULL;
+
+	if (*bufp == NULL)
+		return elf_begin(fd, ELF_C_READ_MMAP, NULL);
+
+	elf = elf_memory(*bufp, size);
+	if (elf == NULL) {
+		free(*bufp);
+		*bufp = NULL;
+	}
+
+	return elf;
+}
@@ -0,0 +1,31 @@
+#ifndef _DECOMPRESS_H_
+#define _DECOMPRESS_H_ 1
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Copyright (C) 2020 Arnaldo Carvalho de Melo <acme@redhat.com>
+
+  Uncompress gzip, xz and zstd containers, such as the .ko.xz kernel
+  modules shipped by distros, into memory.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <libelf.h>
+
+enum decompress_kind {
+	DECOMPRESS__NONE,
+	DECOMPRESS__GZIP,
+	DECOMPRESS__XZ,
+	DECOMPRESS__ZSTD,
+};
+
+enum decompress_kind decompress__kind(int fd);
+const char *decompress__kind_name(enum decompress_kind kind);
+
+int decompress__fd(int fd, void **bufp, size_t *sizep);
+int decompress__memfd(const char *name, const void *buf, size_t size);
+
+Elf *decompress__elf_begin(int fd, void **bufp);
+
+#endif /* _DECOMPRESS_H_ */
@@ -9,9 +9,12 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 void *zalloc(const size_t size)
 {
@@ -21,6 +24,108 @@ void *zalloc(const size_t size)
 	return s;
 }
 
+void strbuf__init(struct strbuf *sb, char *bf, size_t size)
+{
+	sb->s = sb->initial = bf;
+	sb->size = size;
+	sb->len = 0;
+	if (size != 0)
+		bf[0] = '\0';
+}
+
+void strbuf__exit(struct strbuf *sb)
+{
+	if (sb->s != sb->initial)
+		free(sb->s);
+	sb->s = sb->initial;
+	sb->len = sb->size = 0;
+}
+
+static int strbuf__grow(struct strbuf *sb, size_t len)
+{
+	size_t size = sb->size ?: 64;
+	char *s;
+
+	if (sb->len + len < sb->size)
+		return 0;
+
+	while (size <= sb->len + len)
+		size *= 2;
+
+	if (sb->s == sb->initial) {
+		s = malloc(size);
+		if (s != NULL && sb->len != 0)
+			memcpy(s, sb->s, sb->len);
+	} else
+		s = realloc(sb->s, size);
+
+	if (s == NULL)
+		return -ENOMEM;
+
+	s[sb->len] = '\0';
+	sb->s	 = s;
+	sb->size = size;
+	return 0;
+}
+
+int strbuf__add(struct strbuf *sb, const char *s, size_t len)
+{
+	if (strbuf__grow(sb, len) != 0) {
+		if (sb->size == 0)
+			return -ENOMEM;
+		len = sb->size - sb->len - 1;
+		memcpy(sb->s + sb->len, s, len);
+		sb->len += len;
+		sb->s[sb->len] = '\0';
+		return -ENOMEM;
+	}
+
+	memcpy(sb->s + sb->len, s, len);
+	sb->len += len;
+	sb->s[sb->len] = '\0';
+	return 0;
+}
+
+int strbuf__addf(struct strbuf *sb, const char *fmt, ...)
+{
+	size_t room = sb->size - sb->len;
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(sb->size ? sb->s + sb->len : NULL, room, fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return len;
+
+	if ((size_t)len < room) {
+		sb->len += len;
+		return 0;
+	}
+
+	if (strbuf__grow(sb, len) != 0) {
+		/* vsnprintf already left the truncated string in place */
+		if (sb->size != 0)
+			sb->len = sb->size - 1;
+		return -ENOMEM;
+	}
+
+	va_start(args, fmt);
+	vsnprintf(sb->s + sb->len, sb->size - sb->len, fmt, args);
+	va_end(args);
+	sb->len += len;
+	return 0;
+}
+
+void fp__set_big_unlocked_buffer(FILE *fp)
+{
+	/* Keep it line buffered when someone is watching */
+	if (!isatty(fileno(fp)))
+		setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+}
+
 struct str_node *str_node__new(const char *s, bool dupstr)
 {
 	struct str_node *snode = malloc(sizeof(*snode));
@@ -11,6 +11,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <elf.h>
 #include <gelf.h>
@@ -302,6 +303,45 @@ static inline bool strstarts(const char *str, const char *prefix)
 
 void *zalloc(const size_t size);
 
+/*
+ * Append only string, starts in a buffer supplied by the caller, usually on
+ * its stack, and moves to the heap when that is not enough. Always NUL
+ * terminated, on -ENOMEM what was appended so far is kept, like with
+ * snprintf truncation.
+ */
+struct strbuf {
+	char   *s;
+	size_t len;
+	size_t size;
+	char   *initial;
+};
+
+void strbuf__init(struct strbuf *sb, char *bf, size_t size);
+void strbuf__exit(struct strbuf *sb);
+int strbuf__add(struct strbuf *sb, const char *s, size_t len);
+int strbuf__addf(struct strbuf *sb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static inline int strbuf__adds(struct strbuf *sb, const char *s)
+{
+	return strbuf__add(sb, s, strlen(s));
+}
+
+/* Keep only the first @len bytes, to undo a tentative append */
+static inline void strbuf__truncate(struct strbuf *sb, size_t len)
+{
+	if (len < sb->len) {
+		sb->len = len;
+		sb->s[len] = '\0';
+	}
+}
+
+/*
+ * Tools print a lot of small pieces to stdout from a single thread, give it
+ * a big buffer and do away with the per call stdio locking.
+ */
+void fp__set_big_unlocked_buffer(FILE *fp);
+
 Elf_Scn *elf_section_by_name(Elf *elf, GElf_Ehdr *ep,
 			     GElf_Shdr *shp, const char *name, size_t *index);
 
@@ -20,14 +20,13 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "decompress.h"
 #include "list.h"
 #include "dwarves.h"
 #include "dutil.h"
 #include "strings.h"
 #include "hash.h"
 
-struct strings *strings;
-
 #ifndef DW_AT_GNU_vector
 #define DW_AT_GNU_vector 0x2107
 #endif
@@ -110,6 +109,9 @@ struct dwarf_cu {
 	struct obstack obstack;
 	struct cu *cu;
 	struct dwarf_cu *type_unit;
+	/* Consecutive DIEs usually come from the same file */
+	const char *last_decl_file;
+	strings_t last_decl_file_idx;
 };
 
 static void dwarf_cu__init(struct dwarf_cu *dcu)
@@ -121,6 +123,8 @@ static void dwarf_cu__init(struct dwarf_cu *dcu)
 	}
 	obstack_init(&dcu->obstack);
 	dcu->type_unit = NULL;
+	dcu->last_decl_file = NULL;
+	dcu->last_decl_file_idx = 0;
 }
 
 static void hashtags__hash(struct hlist_head *hashtable,
@@ -183,8 +187,6 @@ static struct dwarf_tag *dwarf_cu__find_type_by_ref(const struct dwarf_cu *dcu,
 	return hashtags__find(dcu->hash_types, ref->off);
 }
 
-extern struct strings *strings;
-
 static void *memdup(const void *src, size_t len, struct cu *cu)
 {
 	void *s = obstack_alloc(&cu->obstack, len);
@@ -349,24 +351,33 @@ static int attr_location(Dwarf_Die *die, Dwarf_Op **expr, size_t *exprlen)
 	return 1;
 }
 
-static void *__tag__alloc(struct dwarf_cu *dcu, size_t size, bool spec)
+/*
+ * Associates a zeroed tag, allocated from the cu obstack, with its
+ * struct dwarf_tag, that lives only while the cu is being loaded.
+ */
+static int __tag__init_dwarf_tag(struct dwarf_cu *dcu, struct tag *tag, bool spec)
 {
 	struct dwarf_tag *dtag = obstack_zalloc(&dcu->obstack,
 						(sizeof(*dtag) +
 						 (spec ? sizeof(dwarf_off_ref) : 0)));
 	if (dtag == NULL)
-		return NULL;
-
-	struct tag *tag = obstack_zalloc(&dcu->cu->obstack, size);
-
-	if (tag == NULL)
-		return NULL;
+		return -ENOMEM;
 
 	dtag->tag = tag;
 	tag->priv = dtag;
 	tag->type = 0;
 	tag->top_level = 0;
 
+	return 0;
+}
+
+static void *__tag__alloc(struct dwarf_cu *dcu, size_t size, bool spec)
+{
+	struct tag *tag = obstack_zalloc(&dcu->cu->obstack, size);
+
+	if (tag == NULL || __tag__init_dwarf_tag(dcu, tag, spec) != 0)
+		return NULL;
+
 	return tag;
 }
 
@@ -395,20 +406,18 @@ static void tag__init(struct tag *tag, struct cu *cu, Dwarf_Die *die)
 		dtag->type = attr_type(die, DW_AT_type);
 
 	dtag->abstract_origin = attr_type(die, DW_AT_abstract_origin);
-	tag->recursivity_level = 0;
 
 	if (cu->extra_dbg_info) {
+		struct dwarf_cu *dcu = cu->priv;
 		int32_t decl_line;
 		const char *decl_file = dwarf_decl_file(die);
-		static const char *last_decl_file;
-		static uint32_t last_decl_file_idx;
 
-		if (decl_file != last_decl_file) {
-			last_decl_file_idx = strings__add(strings, decl_file);
-			last_decl_file = decl_file;
+		if (decl_file != dcu->last_decl_file) {
+			dcu->last_decl_file_idx = strings__add(cu->strings, decl_file);
+			dcu->last_decl_file = decl_file;
 		}
 
-		dtag->decl_file = last_decl_file_idx;
+		dtag->decl_file = dcu->last_decl_file_idx;
 		dwarf_decl_line(die, &decl_line);
 		dtag->decl_line = decl_line;
 	}
@@ -446,7 +455,7 @@ static struct base_type *base_type__new(Dwarf_Die *die, struct cu *cu)
 
 	if (bt != NULL) {
 		tag__init(&bt->tag, cu, die);
-		bt->name = strings__add(strings, attr_string(die, DW_AT_name));
+		bt->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
 		bt->bit_size = attr_numeric(die, DW_AT_byte_size) * 8;
 		uint64_t encoding = attr_numeric(die, DW_AT_encoding);
 		bt->is_bool = encoding == DW_ATE_boolean;
@@ -478,7 +487,7 @@ static void namespace__init(struct namespace *namespace, Dwarf_Die *die,
 	tag__init(&namespace->tag, cu, die);
 	INIT_LIST_HEAD(&namespace->tags);
 	namespace->sname = 0;
-	namespace->name  = strings__add(strings, attr_string(die, DW_AT_name));
+	namespace->name  = strings__add(cu->strings, attr_string(die, DW_AT_name));
 	namespace->nr_tags = 0;
 	namespace->shared_tags = 0;
 }
@@ -525,7 +534,7 @@ static struct enumerator *enumerator__new(Dwarf_Die *die, struct cu *cu)
 
 	if (enumerator != NULL) {
 		tag__init(&enumerator->tag, cu, die);
-		enumerator->name = strings__add(strings, attr_string(die, DW_AT_name));
+		enumerator->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
 		enumerator->value = attr_numeric(die, DW_AT_const_value);
 	}
 
@@ -580,7 +589,7 @@ static struct variable *variable__new(Dwarf_Die *die, struct cu *cu)
 
 	if (var != NULL) {
 		tag__init(&var->ip.tag, cu, die);
-		var->name = strings__add(strings, attr_string(die, DW_AT_name));
+		var->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
 		/* variable is visible outside of its enclosing cu */
 		var->external = dwarf_hasattr(die, DW_AT_external);
 		/* non-defining declaration of an object */
@@ -696,7 +705,7 @@ static int tag__recode_dwarf_bitfield(struct tag *tag, struct cu *cu, uint16_t b
 	default:
 		fprintf(stderr, "%s: tag=%s, name=%s, bit_size=%d\n",
 			__func__, dwarf_tag_name(tag->tag),
-			strings__ptr(strings, name), bit_size);
+			strings__ptr(cu->strings, name), bit_size);
 		return -EINVAL;
 	}
 
@@ -726,41 +735,45 @@ int class_member__dwarf_recode_bitfield(struct class_member *member,
 	return 0;
 }
 
+/*
+ * @member is a zeroed slot in the array with all the members of a struct or
+ * union, see die__process_class().
+ */
 static struct class_member *class_member__new(Dwarf_Die *die, struct cu *cu,
-					      bool in_union)
+					      bool in_union,
+					      struct class_member *member)
 {
-	struct class_member *member = tag__alloc(cu, sizeof(*member));
+	if (__tag__init_dwarf_tag(cu->priv, &member->tag, false) != 0)
+		return NULL;
 
-	if (member != NULL) {
-		tag__init(&member->tag, cu, die);
-		member->name = strings__add(strings, attr_string(die, DW_AT_name));
-		member->is_static   = !in_union && !dwarf_hasattr(die, DW_AT_data_member_location);
-		member->const_value = attr_numeric(die, DW_AT_const_value);
-		member->alignment = attr_numeric(die, DW_AT_alignment);
-		member->byte_offset = attr_offset(die, DW_AT_data_member_location);
-		/*
-		 * Bit offset calculated here is valid only for byte-aligned
-		 * fields. For bitfields on little-endian archs we need to
-		 * adjust them taking into account byte size of the field,
-		 * which might not be yet known. So we'll re-calculate bit
-		 * offset later, in class_member__cache_byte_size.
-		 */
-		member->bit_offset = member->byte_offset * 8;
-		/*
-		 * If DW_AT_byte_size is not present, byte size will be
-		 * determined later in class_member__cache_byte_size using
-		 * base integer/enum type
-		 */
-		member->byte_size = attr_numeric(die, DW_AT_byte_size);
-		member->bitfield_offset = attr_numeric(die, DW_AT_bit_offset);
-		member->bitfield_size = attr_numeric(die, DW_AT_bit_size);
-		member->bit_hole = 0;
-		member->bitfield_end = 0;
-		member->visited = 0;
-		member->accessibility = attr_numeric(die, DW_AT_accessibility);
-		member->virtuality    = attr_numeric(die, DW_AT_virtuality);
-		member->hole = 0;
-	}
+	tag__init(&member->tag, cu, die);
+	member->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
+	member->is_static   = !in_union && !dwarf_hasattr(die, DW_AT_data_member_location);
+	member->const_value = attr_numeric(die, DW_AT_const_value);
+	member->alignment = attr_numeric(die, DW_AT_alignment);
+	member->byte_offset = attr_offset(die, DW_AT_data_member_location);
+	/*
+	 * Bit offset calculated here is valid only for byte-aligned
+	 * fields. For bitfields on little-endian archs we need to
+	 * adjust them taking into account byte size of the field,
+	 * which might not be yet known. So we'll re-calculate bit
+	 * offset later, in class_member__cache_byte_size.
+	 */
+	member->bit_offset = member->byte_offset * 8;
+	/*
+	 * If DW_AT_byte_size is not present, byte size will be
+	 * determined later in class_member__cache_byte_size using
+	 * base integer/enum type
+	 */
+	member->byte_size = attr_numeric(die, DW_AT_byte_size);
+	member->bitfield_offset = attr_numeric(die, DW_AT_bit_offset);
+	member->bitfield_size = attr_numeric(die, DW_AT_bit_size);
+	member->bit_hole = 0;
+	member->bitfield_end = 0;
+	member->visited = 0;
+	member->accessibility = attr_numeric(die, DW_AT_accessibility);
+	member->virtuality    = attr_numeric(die, DW_AT_virtuality);
+	member->hole = 0;
 
 	return member;
 }
@@ -771,7 +784,7 @@ static struct parameter *parameter__new(Dwarf_Die *die, struct cu *cu)
 
 	if (parm != NULL) {
 		tag__init(&parm->tag, cu, die);
-		parm->name = strings__add(strings, attr_string(die, DW_AT_name));
+		parm->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
 	}
 
 	return parm;
@@ -787,7 +800,7 @@ static struct inline_expansion *inline_expansion__new(Dwarf_Die *die,
 
 		tag__init(&exp->ip.tag, cu, die);
 		dtag->decl_file =
-			strings__add(strings, attr_string(die, DW_AT_call_file));
+			strings__add(cu->strings, attr_string(die, DW_AT_call_file));
 		dtag->decl_line = attr_numeric(die, DW_AT_call_line);
 		dtag->type = attr_type(die, DW_AT_abstract_origin);
 		exp->ip.addr = 0;
@@ -829,7 +842,7 @@ static struct label *label__new(Dwarf_Die *die, struct cu *cu)
 
 	if (label != NULL) {
 		tag__init(&label->ip.tag, cu, die);
-		label->name = strings__add(strings, attr_string(die, DW_AT_name));
+		label->name = strings__add(cu->strings, attr_string(die, DW_AT_name));
 		if (!cu->has_addr_info || dwarf_lowpc(die, &label->ip.addr))
 			label->ip.addr = 0;
 	}
@@ -917,8 +930,8 @@ static struct function *function__new(Dwarf_Die *die, struct cu *cu)
 	if (func != NULL) {
 		ftype__init(&func->proto, die, cu);
 		lexblock__init(&func->lexblock, cu, die);
-		func->name	      = strings__add(strings, attr_string(die, DW_AT_name));
-		func->linkage_name    = strings__add(strings, attr_string(die, DW_AT_MIPS_linkage_name));
+		func->name	      = strings__add(cu->strings, attr_string(die, DW_AT_name));
+		func->linkage_name    = strings__add(cu->strings, attr_string(die, DW_AT_MIPS_linkage_name));
 		func->inlined	      = attr_numeric(die, DW_AT_inline);
 		func->declaration     = dwarf_hasattr(die, DW_AT_declaration);
 		func->external	      = dwarf_hasattr(die, DW_AT_external);
@@ -1269,10 +1282,40 @@ out_delete:
 	return NULL;
 }
 
+static uint32_t die__nr_members(Dwarf_Die *die)
+{
+	Dwarf_Die sibling = *die;
+	uint32_t nr_members = 0;
+
+	do {
+		switch (dwarf_tag(&sibling)) {
+		case DW_TAG_inheritance:
+		case DW_TAG_member:
+			++nr_members;
+		}
+	} while (dwarf_siblingof(&sibling, &sibling) == 0);
+
+	return nr_members;
+}
+
 static int die__process_class(Dwarf_Die *die, struct type *class,
 			      struct cu *cu)
 {
 	const bool is_union = tag__is_union(&class->namespace.tag);
+	/*
+	 * Allocate all the members in one go, so that walking them, as is done
+	 * all the time to find holes, print, reorganize, etc, touches
+	 * contiguous memory instead of members interleaved with other tags.
+	 */
+	const uint32_t nr_members = die__nr_members(die);
+	struct class_member *members = NULL;
+	uint32_t member_idx = 0;
+
+	if (nr_members != 0) {
+		members = obstack_zalloc(&cu->obstack, nr_members * sizeof(*members));
+		if (members == NULL)
+			return -ENOMEM;
+	}
 
 	do {
 		switch (dwarf_tag(die)) {
@@ -1294,7 +1337,8 @@ static int die__process_class(Dwarf_Die *die, struct type *class,
 			continue;
 		case DW_TAG_inheritance:
 		case DW_TAG_member: {
-			struct class_member *member = class_member__new(die, cu, is_union);
+			struct class_member *member = class_member__new(die, cu, is_union,
+									&members[member_idx++]);
 
 			if (member == NULL)
 				return -ENOMEM;
@@ -1929,6 +1973,13 @@ static int tag__recode_dwarf_type(struct tag *tag, struct cu *cu)
 	if (tag__is_type(tag))
 		type__recode_dwarf_specification(tag, cu);
 
+	/* The underlying type of an enum, e.g. "unsigned int", if present */
+	if (tag__is_enumeration(tag) && dtag->type.off != 0) {
+		dtype = dwarf_cu__find_type_by_ref(cu->priv, &dtag->type);
+		if (dtype != NULL)
+			tag->type = dtype->small_id;
+	}
+
 	if (tag__has_namespace(tag))
 		return namespace__recode_dwarf_types(tag, cu);
 
@@ -2055,7 +2106,7 @@ static const char *dwarf_tag__decl_file(const struct tag *tag,
 {
 	struct dwarf_tag *dtag = tag->priv;
 	return cu->extra_dbg_info ?
-			strings__ptr(strings, dtag->decl_file) : NULL;
+			strings__ptr(cu->strings, dtag->decl_file) : NULL;
 }
 
 static uint32_t dwarf_tag__decl_line(const struct tag *tag,
@@ -2072,10 +2123,9 @@ static unsigned long long dwarf_tag__orig_id(const struct tag *tag,
 	return cu->extra_dbg_info ? dtag->id : 0;
 }
 
-static const char *dwarf__strings_ptr(const struct cu *cu __unused,
-				      strings_t s)
+static const char *dwarf__strings_ptr(const struct cu *cu, strings_t s)
 {
-	return strings__ptr(strings, s);
+	return strings__ptr(cu->strings, s);
 }
 
 struct debug_fmt_ops dwarf__ops;
@@ -2210,7 +2260,6 @@ static int class_member__cache_byte_size(struct tag *tag, struct cu *cu,
 static int finalize_cu(struct cus *cus, struct cu *cu, struct dwarf_cu *dcu,
 		       struct conf_load *conf)
 {
-	base_type_name_to_size_table__init(strings);
 	cu__for_all_tags(cu, class_member__cache_byte_size, conf);
 	if (conf && conf->steal) {
 		return conf->steal(cu, conf);
@@ -2265,7 +2314,7 @@ static int cus__load_debug_types(struct cus *cus, struct conf_load *conf,
 				return DWARF_CB_ABORT;
 			}
 
-			cu->uses_global_strings = true;
+			cu->strings = cus->strings;
 			cu->elf = elf;
 			cu->dwfl = mod;
 			cu->extra_dbg_info = conf ? conf->extra_dbg_info : 0;
@@ -2348,11 +2397,22 @@ static int cus__load_module(struct cus *cus, struct conf_load *conf,
 		 * /usr/libexec/gcc/x86_64-redhat-linux/4.3.2/ecj1.debug
 		 */
 		const char *name = attr_string(cu_die, DW_AT_name);
+
+		/* Don't pay for processing DIEs the tool will just throw away */
+		if (conf && conf->early_cu_filter &&
+		    !conf->early_cu_filter(name,
+					   attr_string(cu_die, DW_AT_producer),
+					   attr_numeric(cu_die, DW_AT_language),
+					   conf)) {
+			off = noff;
+			continue;
+		}
+
 		struct cu *cu = cu__new(name ?: "", pointer_size,
 					build_id, build_id_len, filename);
 		if (cu == NULL)
 			return DWARF_CB_ABORT;
-		cu->uses_global_strings = true;
+		cu->strings = cus->strings;
 		cu->elf = elf;
 		cu->dwfl = mod;
 		cu->extra_dbg_info = conf ? conf->extra_dbg_info : 0;
@@ -2478,6 +2538,32 @@ static int cus__process_file(struct cus *cus, struct conf_load *conf, int fd,
 	return parms.nr_dwarf_sections_found ? 0 : -1;
 }
 
+/*
+ * Distros ship kernel modules as .ko.xz, .ko.gz, .ko.zst, so uncompress
+ * those into memory and hand libdwfl a memory backed fd, returns the fd
+ * to use, that is the original one for uncompressed files.
+ */
+static int dwarf__open_decompressed(int fd, const char *filename)
+{
+	void *buf;
+	size_t size;
+	int err = decompress__fd(fd, &buf, &size);
+
+	if (err < 0) {
+		fprintf(stderr, "%s: couldn't uncompress %s (%s): %s\n", __func__,
+			filename, decompress__kind_name(decompress__kind(fd)),
+			strerror(-err));
+		return -1;
+	}
+
+	if (buf == NULL)
+		return fd;
+
+	err = decompress__memfd(filename, buf, size);
+	free(buf);
+	return err < 0 ? -1 : err;
+}
+
 static int dwarf__load_file(struct cus *cus, struct conf_load *conf,
 			    const char *filename)
 {
@@ -2490,28 +2576,24 @@ static int dwarf__load_file(struct cus *cus, struct conf_load *conf,
 	if (fd == -1)
 		return -1;
 
+	err = dwarf__open_decompressed(fd, filename);
+	if (err < 0)
+		goto out_close;
+
+	if (err != fd) {
+		close(fd);
+		fd = err;
+	}
+
 	err = cus__process_file(cus, conf, fd, filename);
+out_close:
 	close(fd);
 
 	return err;
 }
 
-static int dwarf__init(void)
-{
-	strings = strings__new();
-	return strings != NULL ? 0 : -ENOMEM;
-}
-
-static void dwarf__exit(void)
-{
-	strings__delete(strings);
-	strings = NULL;
-}
-
 struct debug_fmt_ops dwarf__ops = {
 	.name		     = "dwarf",
-	.init		     = dwarf__init,
-	.exit		     = dwarf__exit,
 	.load_file	     = dwarf__load_file,
 	.strings__ptr	     = dwarf__strings_ptr,
 	.tag__decl_file	     = dwarf_tag__decl_file,
@@ -146,9 +146,8 @@ size_t __tag__id_not_found_fprintf(FILE *fp, type_id_t id,
 	return fprintf(fp, "<ERROR(%s:%d): %d not found!>\n", fn, line, id);
 }
 
-static struct base_type_name_to_size {
+static const struct base_type_name_to_size {
 	const char *name;
-	strings_t  sname;
 	size_t	   size;
 } base_type_name_to_size_table[] = {
 	{ .name = "unsigned",		    .size = 32, },
@@ -189,19 +188,6 @@ static struct base_type_name_to_size {
 	{ .name = NULL },
 };
 
-void base_type_name_to_size_table__init(struct strings *strings)
-{
-	int i = 0;
-
-	while (base_type_name_to_size_table[i].name != NULL) {
-		if (base_type_name_to_size_table[i].sname == 0)
-			base_type_name_to_size_table[i].sname =
-			  strings__find(strings,
-					base_type_name_to_size_table[i].name);
-		++i;
-	}
-}
-
 size_t base_type__name_to_size(struct base_type *bt, struct cu *cu)
 {
 	int i = 0;
@@ -215,17 +201,11 @@ size_t base_type__name_to_size(struct base_type *bt, struct cu *cu)
 	orig_name = name;
 try_again:
 	while (base_type_name_to_size_table[i].name != NULL) {
-		if (bt->name_has_encoding) {
-			if (base_type_name_to_size_table[i].sname == bt->name) {
-				size_t size;
-found:
-				size = base_type_name_to_size_table[i].size;
+		if (strcmp(base_type_name_to_size_table[i].name, name) == 0) {
+			const size_t size = base_type_name_to_size_table[i].size;
 
-				return size ?: ((size_t)cu->addr_size * 8);
-			}
-		} else if (strcmp(base_type_name_to_size_table[i].name,
-				  name) == 0)
-			goto found;
+			return size ?: ((size_t)cu->addr_size * 8);
+		}
 		++i;
 	}
 
@@ -539,6 +519,7 @@ struct cu *cu__new(const char *name, uint8_t addr_size,
 		cu->functions = RB_ROOT;
 
 		cu->dfops	= NULL;
+		cu->strings	= NULL;
 		INIT_LIST_HEAD(&cu->tags);
 		INIT_LIST_HEAD(&cu->tool_list);
 
@@ -906,7 +887,7 @@ struct tag *cu__find_function_by_name(const struct cu *cu, const char *name)
 	return NULL;
 }
 
-static size_t array_type__nr_entries(const struct array_type *at)
+size_t array_type__nr_entries(const struct array_type *at)
 {
 	int i;
 	size_t nr_entries = 1;
@@ -939,7 +920,14 @@ size_t tag__size(const struct tag *tag, const struct cu *cu)
 	}
 
 	if (tag->type == 0) { /* struct class: unions, structs */
-		struct type *type = tag__type(tag);
+		struct type *type;
+
+		/* Or void, e.g. in 'const void' or in a function type */
+		if (!tag__is_struct(tag) && !tag__is_union(tag) &&
+		    !tag__is_typedef(tag))
+			return 0;
+
+		type = tag__type(tag);
 
 		/* empty base optimization trick */
 		if (type->size == 1 && type->nr_members == 0)
@@ -984,9 +972,9 @@ void class_member__delete(struct class_member *member, struct cu *cu)
 }
 
 static struct class_member *class_member__clone(const struct class_member *from,
-						struct cu *cu)
+						struct obstack *obstack)
 {
-	struct class_member *member = obstack_alloc(&cu->obstack, sizeof(*member));
+	struct class_member *member = obstack_alloc(obstack, sizeof(*member));
 
 	if (member != NULL)
 		memcpy(member, from, sizeof(*member));
@@ -1064,7 +1052,7 @@ struct class_member *type__last_member(struct type *type)
 }
 
 static int type__clone_members(struct type *type, const struct type *from,
-			       struct cu *cu)
+			       struct obstack *obstack)
 {
 	struct class_member *pos;
 
@@ -1072,7 +1060,7 @@ static int type__clone_members(struct type *type, const struct type *from,
 	INIT_LIST_HEAD(&type->namespace.tags);
 
 	type__for_each_member(from, pos) {
-		struct class_member *clone = class_member__clone(pos, cu);
+		struct class_member *clone = class_member__clone(pos, obstack);
 
 		if (clone == NULL)
 			return -1;
@@ -1082,10 +1070,16 @@ static int type__clone_members(struct type *type, const struct type *from,
 	return 0;
 }
 
-struct class *class__clone(const struct class *from,
-			   const char *new_class_name, struct cu *cu)
+/*
+ * Clone a class into the given obstack, freeing the clone with
+ * obstack_free() also frees its members, that are allocated after it, so
+ * tools can use a scratch obstack per thread to evaluate layouts.
+ */
+struct class *class__clone_obstack(const struct class *from,
+				   const char *new_class_name,
+				   struct obstack *obstack)
 {
-	struct class *class = obstack_alloc(&cu->obstack, sizeof(*class));
+	struct class *class = obstack_alloc(obstack, sizeof(*class));
 
 	 if (class != NULL) {
 		memcpy(class, from, sizeof(*class));
@@ -1093,12 +1087,14 @@ struct class *class__clone(const struct class *from,
 			class->type.namespace.name = 0;
 			class->type.namespace.sname = strdup(new_class_name);
 			if (class->type.namespace.sname == NULL) {
-				free(class);
+				obstack_free(obstack, class);
 				return NULL;
 			}
 		}
-		if (type__clone_members(&class->type, &from->type, cu) != 0) {
-			class__delete(class, cu);
+		if (type__clone_members(&class->type, &from->type, obstack) != 0) {
+			if (new_class_name != NULL)
+				free(class->type.namespace.sname);
+			obstack_free(obstack, class);
 			class = NULL;
 		}
 	}
@@ -1106,6 +1102,12 @@ struct class *class__clone(const struct class *from,
 	return class;
 }
 
+struct class *class__clone(const struct class *from,
+			   const char *new_class_name, struct cu *cu)
+{
+	return class__clone_obstack(from, new_class_name, &cu->obstack);
+}
+
 void enumeration__add(struct type *type, struct enumerator *enumerator)
 {
 	++type->nr_members;
@@ -1259,6 +1261,14 @@ void class__find_holes(struct class *class)
 			bit_end = bit_start + pos->byte_size * 8;
 		}
 
+		/*
+		 * A member or another base in the tail padding of a base
+		 * class, see class__base_tail_reuse().
+		 */
+		if (last != NULL && last->tag.tag == DW_TAG_inheritance &&
+		    bit_start < last_seen_bit)
+			last_seen_bit = bit_start;
+
 		bit_holes = 0;
 		byte_holes = 0;
 		if (in_bitfield) {
@@ -1334,9 +1344,153 @@ void class__find_holes(struct class *class)
 	class->holes_searched = true;
 }
 
+/*
+ * The Itanium C++ ABI "POD for the purpose of layout", that is, the C++ TC1
+ * POD: no bases, no virtual functions, no private or protected data members,
+ * no user declared constructors, destructor or copy assignment and no data
+ * members that aren't PODs themselves.
+ *
+ * From DWARF we can't tell a user declared constructor from an implicitly
+ * declared non trivial one, but then the class isn't a POD either way.
+ */
+bool class__is_pod_for_layout(struct class *class, const struct cu *cu)
+{
+	const bool is_class = class__tag(class)->tag == DW_TAG_class_type;
+	const char *name = class__name(class, cu);
+	const size_t name_len = name ? strcspn(name, "<") : 0;
+	struct tag *pos;
+
+	if (class->nr_vtable_entries != 0)
+		return false;
+
+	type__for_each_tag(&class->type, pos) {
+		if (pos->tag == DW_TAG_inheritance)
+			return false;
+
+		if (pos->tag == DW_TAG_subprogram) {
+			struct function *func = tag__function(pos);
+			const char *fname = function__name(func, cu);
+
+			if (func->virtuality != DW_VIRTUALITY_none)
+				return false;
+			if (fname == NULL)
+				continue;
+			if (fname[0] == '~' || strcmp(fname, "operator=") == 0 ||
+			    (name_len != 0 && strlen(fname) == name_len &&
+			     strncmp(fname, name, name_len) == 0))
+				return false;
+			continue;
+		}
+
+		if (pos->tag != DW_TAG_member)
+			continue;
+
+		struct class_member *member = tag__class_member(pos);
+
+		if (member->is_static)
+			continue;
+
+		if (member->accessibility == DW_ACCESS_private ||
+		    member->accessibility == DW_ACCESS_protected ||
+		    (member->accessibility == 0 && is_class))
+			return false;
+
+		struct tag *type = tag__strip_typedefs_and_modifiers(pos, cu);
+
+		while (type != NULL && type->tag == DW_TAG_array_type)
+			type = tag__strip_typedefs_and_modifiers(type, cu);
+
+		if (type != NULL && tag__is_struct(type) &&
+		    !class__is_pod_for_layout(tag__class(type), cu))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * The data size, i.e. the size without the tail padding, the "dsize" in the
+ * Itanium C++ ABI, where the members of derived classes can go if this isn't
+ * a POD, see class__is_pod_for_layout().
+ */
+uint32_t class__dsize(struct class *class, const struct cu *cu)
+{
+	struct class_member *pos;
+	uint32_t dsize = 0;
+
+	type__for_each_member(&class->type, pos) {
+		uint32_t end;
+
+		if (pos->is_static)
+			continue;
+
+		if (pos->tag.tag == DW_TAG_inheritance) {
+			if (pos->virtuality == DW_VIRTUALITY_virtual)
+				continue;
+			end = pos->byte_offset + class_member__base_dsize(pos, cu);
+		} else if (pos->bitfield_size != 0)
+			end = (pos->bit_offset + pos->bitfield_size + 7) / 8;
+		else
+			end = pos->byte_offset + pos->byte_size;
+
+		if (end > dsize)
+			dsize = end;
+	}
+
+	return dsize;
+}
+
+/*
+ * For a base class entry, how much of it the members of the derived class
+ * can't use: all of it for PODs, just its data size for the others.
+ */
+uint32_t class_member__base_dsize(const struct class_member *base,
+				  const struct cu *cu)
+{
+	struct tag *type = cu__type(cu, base->tag.type);
+
+	if (type == NULL || !tag__is_struct(type) ||
+	    class__is_pod_for_layout(tag__class(type), cu))
+		return base->byte_size;
+
+	return class__dsize(tag__class(type), cu);
+}
+
+/*
+ * How many bytes at the end of a base class subobject are used by the
+ * members or bases that come after it, i.e. of its tail padding that was
+ * reused, see class__dsize().
+ */
+uint32_t class__base_tail_reuse(struct class *class,
+				struct class_member *base)
+{
+	const uint32_t end = base->byte_offset + base->byte_size;
+	struct tag *pos = &base->tag;
+
+	if (base->virtuality == DW_VIRTUALITY_virtual)
+		return 0;
+
+	list_for_each_entry_continue(pos, class__tags(class), node) {
+		struct class_member *member;
+
+		if (pos->tag != DW_TAG_member && pos->tag != DW_TAG_inheritance)
+			continue;
+
+		member = tag__class_member(pos);
+		if (member->is_static ||
+		    (pos->tag == DW_TAG_inheritance &&
+		     member->virtuality == DW_VIRTUALITY_virtual))
+			continue;
+
+		return member->byte_offset < end ? end - member->byte_offset : 0;
+	}
+
+	return 0;
+}
+
 static size_t type__natural_alignment(struct type *type, const struct cu *cu);
 
-static size_t tag__natural_alignment(struct tag *tag, const struct cu *cu)
+size_t tag__natural_alignment(struct tag *tag, const struct cu *cu)
 {
 	size_t natural_alignment = 1;
 
@@ -1508,6 +1662,30 @@ void union__infer_packed_attributes(struct type *type, const struct cu *cu)
 	type->packed_attributes_inferred = true;
 }
 
+/*
+ * The holes, natural alignments and inferred packed attributes are computed
+ * when first needed and cached in the types, i.e. printing a CU writes to
+ * it, so compute them all upfront, after which the CU can be printed from
+ * many threads at the same time.
+ */
+void cu__prepare_for_sharing(struct cu *cu)
+{
+	struct tag *pos;
+	uint32_t id;
+
+	cu__for_each_type(cu, id, pos) {
+		if (tag__is_struct(pos)) {
+			class__find_holes(tag__class(pos));
+			class__infer_packed_attributes(tag__class(pos), cu);
+		} else if (tag__is_union(pos)) {
+			union__infer_packed_attributes(tag__type(pos), cu);
+		} else
+			continue;
+
+		tag__natural_alignment(pos, cu);
+	}
+}
+
 /** class__has_hole_ge - check if class has a hole greater or equal to @size
  * @class - class instance
  * @size - hole size to check
@@ -1526,6 +1704,38 @@ int class__has_hole_ge(const struct class *class, const uint16_t size)
 	return 0;
 }
 
+/*
+ * The size it would have without its holes and tail padding, rounded up to
+ * its alignment, i.e. the best reorganizing it could do, unions and structs
+ * without holes or padding are returned as is.
+ */
+uint32_t class__packed_size(struct class *class, const struct cu *cu)
+{
+	struct tag *tag = class__tag(class);
+	uint32_t size = class__size(class), waste;
+	struct class_member *pos;
+	size_t alignment;
+
+	if (!tag__is_struct(tag))
+		return size;
+
+	class__find_holes(class);
+
+	waste = class->pre_hole + class->padding;
+	type__for_each_data_member(&class->type, pos)
+		waste += pos->hole;
+
+	if (waste == 0 || waste > size)
+		return size;
+
+	alignment = tag__natural_alignment(tag, cu);
+	if (class->type.alignment > alignment)
+		alignment = class->type.alignment;
+
+	size = roundup(size - waste, alignment);
+	return size < class__size(class) ? size : class__size(class);
+}
+
 struct class_member *type__find_member_by_name(const struct type *type,
 					       const struct cu *cu,
 					       const char *name)
@@ -1555,6 +1765,293 @@ uint32_t type__nr_members_of_type(const struct type *type, const type_id_t type_
 	return nr_members_of_type;
 }
 
+/*
+ * Structural type hashing: two types get the same hash if they have the
+ * same kind, name, size and members at the same offsets, with member types
+ * that in turn hash the same, no matter in which CU or in which debugging
+ * format they were found, as names are hashed by contents, not by string
+ * table offset.
+ *
+ * Pointers to named types only hash the kind and name of the pointed to
+ * type, as that is all that matters for the layout of the type holding the
+ * pointer and it breaks the 'struct list_head *next' kind of cycles, the
+ * stack of types being hashed takes care of any other cycle.
+ */
+#define TAG_HASH__MAX_DEPTH 64
+
+struct tag_hash_state {
+	const struct tag *stack[TAG_HASH__MAX_DEPTH];
+	int		 depth;
+};
+
+static uint64_t hash__mix(uint64_t hash, uint64_t value)
+{
+	hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+/* FNV-1a */
+static uint64_t hash__string(uint64_t hash, const char *s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	if (s == NULL)
+		return hash__mix(hash, 0);
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+
+	return hash__mix(hash, h);
+}
+
+static uint64_t __tag__hash(const struct tag *tag, const struct cu *cu,
+			    struct tag_hash_state *state);
+
+static uint64_t tag__hash_type(const struct tag *tag, const struct cu *cu,
+			       struct tag_hash_state *state)
+{
+	const struct tag *type = cu__type(cu, tag->type);
+
+	/* void */
+	if (type == NULL)
+		return 0;
+
+	return __tag__hash(type, cu, state);
+}
+
+static uint64_t tag__hash_pointee(const struct tag *tag, const struct cu *cu,
+				  struct tag_hash_state *state)
+{
+	const struct tag *type = cu__type(cu, tag->type);
+
+	if (type == NULL)
+		return 0;
+
+	if ((tag__is_struct(type) || tag__is_union(type) ||
+	     tag__is_enumeration(type) || tag__is_typedef(type)) &&
+	    tag__type(type)->namespace.name != 0)
+		return hash__string(type->tag, type__name(tag__type(type), cu));
+
+	return __tag__hash(type, cu, state);
+}
+
+static uint64_t type__hash_members(const struct type *type, const struct cu *cu,
+				   uint64_t hash, struct tag_hash_state *state)
+{
+	struct class_member *pos;
+
+	type__for_each_member(type, pos) {
+		hash = hash__mix(hash, pos->tag.tag);
+		hash = hash__string(hash, class_member__name(pos, cu));
+		hash = hash__mix(hash, pos->bit_offset);
+		hash = hash__mix(hash, pos->bitfield_size);
+		hash = hash__mix(hash, tag__hash_type(&pos->tag, cu, state));
+	}
+
+	return hash;
+}
+
+static uint64_t __tag__hash(const struct tag *tag, const struct cu *cu,
+			    struct tag_hash_state *state)
+{
+	uint64_t hash = hash__mix(0, tag->tag);
+	int i;
+
+	for (i = state->depth - 1; i >= 0; --i)
+		if (state->stack[i] == tag)
+			return hash__mix(hash, state->depth - i);
+
+	if (state->depth == TAG_HASH__MAX_DEPTH)
+		return hash;
+
+	state->stack[state->depth++] = tag;
+
+	switch (tag->tag) {
+	case DW_TAG_base_type: {
+		const struct base_type *bt = tag__base_type(tag);
+
+		hash = hash__string(hash, cu__string(cu, bt->name));
+		hash = hash__mix(hash, bt->bit_size);
+	}
+		break;
+	case DW_TAG_structure_type:
+	case DW_TAG_class_type:
+	case DW_TAG_interface_type:
+	case DW_TAG_union_type: {
+		const struct type *type = tag__type(tag);
+
+		hash = hash__string(hash, type__name(type, cu));
+		hash = hash__mix(hash, type->size);
+		hash = hash__mix(hash, type->declaration);
+		hash = type__hash_members(type, cu, hash, state);
+	}
+		break;
+	case DW_TAG_enumeration_type: {
+		struct type *type = tag__type(tag);
+		struct enumerator *pos;
+
+		hash = hash__string(hash, type__name(type, cu));
+		hash = hash__mix(hash, type->size);
+		type__for_each_enumerator(type, pos) {
+			hash = hash__string(hash, enumerator__name(pos, cu));
+			hash = hash__mix(hash, pos->value);
+		}
+	}
+		break;
+	case DW_TAG_typedef:
+		hash = hash__string(hash, type__name(tag__type(tag), cu));
+		hash = hash__mix(hash, tag__hash_type(tag, cu, state));
+		break;
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_rvalue_reference_type:
+	case DW_TAG_ptr_to_member_type:
+		hash = hash__mix(hash, tag__hash_pointee(tag, cu, state));
+		break;
+	case DW_TAG_array_type: {
+		const struct array_type *at = tag__array_type(tag);
+
+		hash = hash__mix(hash, at->is_vector);
+		for (i = 0; i < at->dimensions; ++i)
+			hash = hash__mix(hash, at->nr_entries[i]);
+		hash = hash__mix(hash, tag__hash_type(tag, cu, state));
+	}
+		break;
+	case DW_TAG_subroutine_type: {
+		const struct ftype *ftype = tag__ftype(tag);
+		struct parameter *pos;
+
+		hash = hash__mix(hash, tag__hash_type(tag, cu, state));
+		hash = hash__mix(hash, ftype->nr_parms);
+		hash = hash__mix(hash, ftype->unspec_parms);
+		ftype__for_each_parameter(ftype, pos)
+			hash = hash__mix(hash, tag__hash_type(&pos->tag, cu, state));
+	}
+		break;
+	default: /* const, volatile, restrict, etc */
+		hash = hash__mix(hash, tag__hash_type(tag, cu, state));
+		break;
+	}
+
+	--state->depth;
+	return hash;
+}
+
+uint64_t tag__hash(const struct tag *tag, const struct cu *cu)
+{
+	struct tag_hash_state state = { .depth = 0, };
+
+	return __tag__hash(tag, cu, &state);
+}
+
+/*
+ * Open addressing table of hashes, zero marks an empty slot, so a zero hash
+ * is stored as one, doubles in size when it gets half full.
+ */
+struct type_dedup {
+	uint64_t *hashes;
+	uint32_t *nr_seen;
+	size_t	 nr_entries;
+	size_t	 mask;
+};
+
+struct type_dedup *type_dedup__new(void)
+{
+	struct type_dedup *td = zalloc(sizeof(*td));
+
+	if (td == NULL)
+		return NULL;
+
+	td->mask = 1024 - 1;
+	td->hashes = zalloc((td->mask + 1) * sizeof(*td->hashes));
+	td->nr_seen = malloc((td->mask + 1) * sizeof(*td->nr_seen));
+	if (td->hashes == NULL || td->nr_seen == NULL) {
+		type_dedup__delete(td);
+		return NULL;
+	}
+
+	return td;
+}
+
+void type_dedup__delete(struct type_dedup *td)
+{
+	if (td == NULL)
+		return;
+
+	free(td->hashes);
+	free(td->nr_seen);
+	free(td);
+}
+
+static size_t type_dedup__slot(const struct type_dedup *td, uint64_t hash)
+{
+	size_t slot = hash & td->mask;
+
+	while (td->hashes[slot] != 0 && td->hashes[slot] != hash)
+		slot = (slot + 1) & td->mask;
+
+	return slot;
+}
+
+static int type_dedup__grow(struct type_dedup *td)
+{
+	struct type_dedup new = {
+		.mask = td->mask * 2 + 1,
+	};
+	size_t i;
+
+	new.hashes = zalloc((new.mask + 1) * sizeof(*new.hashes));
+	new.nr_seen = malloc((new.mask + 1) * sizeof(*new.nr_seen));
+	if (new.hashes == NULL || new.nr_seen == NULL) {
+		free(new.hashes);
+		free(new.nr_seen);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i <= td->mask; ++i) {
+		if (td->hashes[i] != 0) {
+			size_t slot = type_dedup__slot(&new, td->hashes[i]);
+
+			new.hashes[slot]  = td->hashes[i];
+			new.nr_seen[slot] = td->nr_seen[i];
+		}
+	}
+
+	free(td->hashes);
+	free(td->nr_seen);
+	td->hashes  = new.hashes;
+	td->nr_seen = new.nr_seen;
+	td->mask    = new.mask;
+	return 0;
+}
+
+/*
+ * Returns how many times @hash was added before, i.e. zero the first time
+ * a type with that shape is seen, or -ENOMEM.
+ */
+int type_dedup__add(struct type_dedup *td, uint64_t hash)
+{
+	size_t slot;
+
+	if (hash == 0)
+		hash = 1;
+
+	slot = type_dedup__slot(td, hash);
+	if (td->hashes[slot] == hash)
+		return td->nr_seen[slot]++;
+
+	if ((td->nr_entries + 1) * 2 > td->mask + 1) {
+		if (type_dedup__grow(td) != 0)
+			return -ENOMEM;
+		slot = type_dedup__slot(td, hash);
+	}
+
+	td->hashes[slot]  = hash;
+	td->nr_seen[slot] = 1;
+	++td->nr_entries;
+	return 0;
+}
+
 static void lexblock__account_inline_expansions(struct lexblock *block,
 						const struct cu *cu)
 {
@@ -2169,6 +2666,11 @@ struct cus *cus__new(void)
 	if (cus != NULL) {
 		cus->nr_entries = 0;
 		INIT_LIST_HEAD(&cus->cus);
+		cus->strings = strings__new();
+		if (cus->strings == NULL) {
+			free(cus);
+			cus = NULL;
+		}
 	}
 
 	return cus;
@@ -2186,6 +2688,7 @@ void cus__delete(struct cus *cus)
 		cu__delete(pos);
 	}
 
+	strings__delete(cus->strings);
 	free(cus);
 }
 
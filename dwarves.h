@@ -34,16 +34,24 @@ enum load_steal_kind {
 typedef uint32_t type_id_t;
 
 struct conf_fprintf;
+struct hw_profile;
 
 /** struct conf_load - load configuration
  * @extra_dbg_info - keep original debugging format extra info
  *		     (e.g. DWARF's decl_{line,file}, id, etc)
  * @fixup_silly_bitfields - Fixup silly things such as "int foo:32;"
  * @get_addr_info - wheter to load DW_AT_location and other addr info
+ * @early_cu_filter - called with the compile unit name, producer and language
+ *		      before its DIEs are processed, return false to skip it.
+ *		      name and producer may be NULL.
  */
 struct conf_load {
 	enum load_steal_kind	(*steal)(struct cu *cu,
 					 struct conf_load *conf);
+	bool			(*early_cu_filter)(const char *name,
+						   const char *producer,
+						   uint16_t language,
+						   struct conf_load *conf);
 	void			*cookie;
 	char			*format_path;
 	bool			extra_dbg_info;
@@ -61,10 +69,14 @@ struct conf_load {
  * @suppress_force_paddings: This makes sense only if the debugging format has struct alignment information,
  *                           So allow for it to be disabled and disable it automatically for things like BTF,
  *                           that don't have such info.
+ * @hw_profiles - if set, also emit prefetch and page boundaries for the first profile
+ *		  and cacheline, prefetch and page counts for all of them in the stats.
  */
 struct conf_fprintf {
 	const char *prefix;
 	const char *suffix;
+	const struct hw_profile *hw_profiles;
+	uint8_t	   nr_hw_profiles;
 	int32_t	   type_spacing;
 	int32_t	   name_spacing;
 	uint32_t   base_offset;
@@ -92,11 +104,28 @@ struct conf_fprintf {
 	uint8_t	   classes_as_structs:1;
 	uint8_t	   hex_fmt:1;
 	uint8_t	   strip_inline:1;
+	const struct conf_fprintf_expansion *expansions;
 };
 
+/*
+ * The types being expanded with conf_fprintf.expand_types, innermost first,
+ * to avoid loops without marking the types, that may be printed by other
+ * threads at the same time.
+ */
+struct conf_fprintf_expansion {
+	const struct tag		    *type;
+	const struct conf_fprintf_expansion *prev;
+};
+
+/*
+ * All the state of a load is in its cus, so that different threads can load
+ * different files into different cus at the same time, e.g. the table with
+ * the DWARF strings, where the strings_t in the tags of its CUs point to.
+ */
 struct cus {
 	uint32_t	      nr_entries;
 	struct list_head      cus;
+	struct strings	      *strings;
 };
 
 struct cus *cus__new(void);
@@ -210,13 +239,13 @@ struct cu {
 	void 		 *priv;
 	struct obstack	 obstack;
 	struct debug_fmt_ops *dfops;
+	struct strings	 *strings;	/* The cus one, used by DWARF and the encoders */
 	Elf		 *elf;
 	Dwfl_Module	 *dwfl;
 	uint32_t	 cached_symtab_nr_entries;
 	uint8_t		 addr_size;
 	uint8_t		 extra_dbg_info:1;
 	uint8_t		 has_addr_info:1;
-	uint8_t		 uses_global_strings:1;
 	uint8_t		 little_endian:1;
 	uint16_t	 language;
 	unsigned long	 nr_inline_expansions;
@@ -234,6 +263,7 @@ struct cu *cu__new(const char *name, uint8_t addr_size,
 		   const unsigned char *build_id, int build_id_len,
 		   const char *filename);
 void cu__delete(struct cu *cu);
+void cu__prepare_for_sharing(struct cu *cu);
 
 const char *cu__string(const struct cu *cu, strings_t s);
 
@@ -369,14 +399,15 @@ int cu__for_all_tags(struct cu *cu,
 /** struct tag - basic representation of a debug info element
  * @priv - extra data, for instance, DWARF offset, id, decl_{file,line}
  * @top_level -
+ *
+ * This is embedded in every tag loaded, so keep it at 32 bytes on 64-bit.
  */
 struct tag {
 	struct list_head node;
 	type_id_t	 type;
 	uint16_t	 tag;
-	bool		 visited;
-	bool		 top_level;
-	uint16_t	 recursivity_level;
+	bool		 visited:1;
+	bool		 top_level:1;
 	void		 *priv;
 };
 
@@ -527,6 +558,32 @@ size_t tag__fprintf_decl_info(const struct tag *tag,
 size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 		    const struct conf_fprintf *conf, FILE *fp);
 
+/**
+ * struct fprintf_queue - tags to format with many threads, output in order
+ *
+ * Each queued tag is formatted by one of up to nr_jobs threads into its own
+ * memory stream, fprintf_queue__flush() then writes them in the order they
+ * were queued, i.e. the output is the same as when formatting serially.
+ * The CUs are prepared with cu__prepare_for_sharing() and the @fn
+ * routines must only write to the FILE they get, @id is passed as is to
+ * them, usually it is the tag id, @conf is copied.
+ */
+struct fprintf_queue;
+
+typedef size_t (*fprintf_queue__fprintf_t)(struct tag *tag,
+					   const struct cu *cu,
+					   uint32_t id,
+					   const struct conf_fprintf *conf,
+					   FILE *fp);
+
+struct fprintf_queue *fprintf_queue__new(int nr_jobs);
+void fprintf_queue__delete(struct fprintf_queue *queue);
+int fprintf_queue__add(struct fprintf_queue *queue,
+		       fprintf_queue__fprintf_t fn, struct tag *tag,
+		       struct cu *cu, uint32_t id,
+		       const struct conf_fprintf *conf);
+int fprintf_queue__flush(struct fprintf_queue *queue, FILE *fp);
+
 const char *tag__name(const struct tag *tag, const struct cu *cu,
 		      char *bf, size_t len, const struct conf_fprintf *conf);
 void tag__not_found_die(const char *file, int line, const char *func);
@@ -537,6 +594,7 @@ void tag__not_found_die(const char *file, int line, const char *func);
 
 size_t tag__size(const struct tag *tag, const struct cu *cu);
 size_t tag__nr_cachelines(const struct tag *tag, const struct cu *cu);
+size_t tag__natural_alignment(struct tag *tag, const struct cu *cu);
 struct tag *tag__follow_typedef(const struct tag *tag, const struct cu *cu);
 struct tag *tag__strip_typedefs_and_modifiers(const struct tag *tag, const struct cu *cu);
 
@@ -874,19 +932,23 @@ static inline int function__inlined(const struct function *func)
  * @virtuality - DW_VIRTUALITY_{none,virtual,pure_virtual}
  * @hole - If there is a hole before the next one (or the end of the struct)
  */
+/*
+ * Laid out without holes, loaders allocate all the members of a struct or
+ * union in one contiguous array, see type__for_each_member().
+ */
 struct class_member {
 	struct tag	 tag;
 	strings_t	 name;
 	uint32_t	 bit_offset;
 	uint32_t	 bit_size;
 	uint32_t	 byte_offset;
+	uint32_t	 alignment;
 	size_t		 byte_size;
+	uint64_t	 const_value;
 	int8_t		 bitfield_offset;
 	uint8_t		 bitfield_size;
 	uint8_t		 bit_hole;
 	uint8_t		 bitfield_end:1;
-	uint64_t	 const_value;
-	uint32_t	 alignment;
 	uint8_t		 visited:1;
 	uint8_t		 is_static:1;
 	uint8_t		 accessibility:2;
@@ -1046,6 +1108,15 @@ struct class_member *type__find_member_by_name(const struct type *type,
 					       const struct cu *cu,
 					       const char *name);
 uint32_t type__nr_members_of_type(const struct type *type, const type_id_t oftype);
+
+uint64_t tag__hash(const struct tag *tag, const struct cu *cu);
+
+/** struct type_dedup - cross CU table of types already seen, keyed by tag__hash() */
+struct type_dedup;
+
+struct type_dedup *type_dedup__new(void);
+void type_dedup__delete(struct type_dedup *td);
+int type_dedup__add(struct type_dedup *td, uint64_t hash);
 struct class_member *type__last_member(struct type *type);
 
 size_t typedef__fprintf(const struct tag *tag_type, const struct cu *cu,
@@ -1083,6 +1154,9 @@ static inline struct tag *class__tag(const struct class *cls)
 
 struct class *class__clone(const struct class *from,
 			   const char *new_class_name, struct cu *cu);
+struct class *class__clone_obstack(const struct class *from,
+				   const char *new_class_name,
+				   struct obstack *obstack);
 void class__delete(struct class *cls, struct cu *cu);
 
 static inline struct list_head *class__tags(struct class *cls)
@@ -1115,6 +1189,12 @@ static inline int class__is_struct(const struct class *cls)
 
 void class__find_holes(struct class *cls);
 int class__has_hole_ge(const struct class *cls, const uint16_t size);
+uint32_t class__packed_size(struct class *cls, const struct cu *cu);
+bool class__is_pod_for_layout(struct class *cls, const struct cu *cu);
+uint32_t class__dsize(struct class *cls, const struct cu *cu);
+uint32_t class__base_tail_reuse(struct class *cls, struct class_member *base);
+uint32_t class_member__base_dsize(const struct class_member *base,
+				  const struct cu *cu);
 
 bool class__infer_packed_attributes(struct class *cls, const struct cu *cu);
 
@@ -1217,7 +1297,6 @@ static inline uint16_t base_type__size(const struct tag *tag)
 const char *base_type__name(const struct base_type *btype, const struct cu *cu,
 			    char *bf, size_t len);
 
-void base_type_name_to_size_table__init(struct strings *strings);
 size_t base_type__name_to_size(struct base_type *btype, struct cu *cu);
 
 struct array_type {
@@ -1232,6 +1311,8 @@ static inline struct array_type *tag__array_type(const struct tag *tag)
 	return (struct array_type *)tag;
 }
 
+size_t array_type__nr_entries(const struct array_type *at);
+
 struct enumerator {
 	struct tag	 tag;
 	strings_t	 name;
@@ -1250,6 +1331,25 @@ size_t enumeration__fprintf(const struct tag *tag_enum, const struct cu *cu,
 			    const struct conf_fprintf *conf, FILE *fp);
 
 int dwarves__init(uint16_t user_cacheline_size);
+size_t dwarves__cacheline_size(void);
+
+/** struct hw_profile - memory hierarchy granularities to evaluate layouts against
+ * @name - "x86_64", "arm64", etc, or the "name" key in a profile file
+ * @cacheline_size - L1 data cacheline size
+ * @prefetch_size - unit fetched by the adjacent line prefetcher, e.g. a pair of
+ *		    64 byte lines on Intel, same as @cacheline_size if there is none
+ * @page_size - base page size
+ */
+struct hw_profile {
+	const char *name;
+	uint32_t   cacheline_size;
+	uint32_t   prefetch_size;
+	uint32_t   page_size;
+};
+
+const struct hw_profile *hw_profile__find(const char *name);
+int hw_profile__load(struct hw_profile *profile, const char *filename);
+size_t hw_profile__fprintf_names(FILE *fp);
 void dwarves__exit(void);
 
 const char *dwarf_tag_name(const uint32_t tag);
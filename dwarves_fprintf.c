@@ -9,7 +9,10 @@
 
 #include <dwarf.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
@@ -163,15 +166,65 @@ static const char *tag__accessibility(const struct tag *tag)
 	return NULL;
 }
 
-static size_t __tag__id_not_found_snprintf(char *bf, size_t len, uint32_t id,
-					   const char *fn, int line)
+static void __tag__id_not_found_strbuf(struct strbuf *sb, uint32_t id,
+				       const char *fn, int line)
 {
-	return snprintf(bf, len, "<ERROR(%s:%d): %#llx not found!>", fn, line,
-			(unsigned long long)id);
+	strbuf__addf(sb, "<ERROR(%s:%d): %#llx not found!>", fn, line,
+		     (unsigned long long)id);
 }
 
-#define tag__id_not_found_snprintf(bf, len, id) \
-	__tag__id_not_found_snprintf(bf, len, id, __func__, __LINE__)
+#define tag__id_not_found_strbuf(sb, id) \
+	__tag__id_not_found_strbuf(sb, id, __func__, __LINE__)
+
+static bool __tag__has_type_loop_strbuf(const struct tag *tag,
+					const struct tag *type,
+					struct strbuf *sb,
+					const char *fn, int line)
+{
+	if (type == NULL || tag->type != type->type)
+		return false;
+
+	strbuf__addf(sb, "<ERROR(%s:%d): detected type loop: type=%d, tag=%s>",
+		     fn, line, tag->type, dwarf_tag_name(tag->tag));
+	return true;
+}
+
+#define tag__has_type_loop_strbuf(tag, type, sb) \
+	__tag__has_type_loop_strbuf(tag, type, sb, __func__, __LINE__)
+
+/*
+ * Names and function types are built appending to a struct strbuf, so that
+ * nesting doesn't need intermediate buffers and isn't limited by their sizes.
+ */
+static void __tag__name(const struct tag *tag, const struct cu *cu,
+			struct strbuf *sb, const struct conf_fprintf *conf);
+
+static void ftype__strbuf(const struct ftype *ftype, const struct cu *cu,
+			  const char *name, const int inlined,
+			  const int is_pointer, int type_spacing,
+			  bool is_prototype, const struct conf_fprintf *conf,
+			  struct strbuf *sb);
+
+/* The whole name, for the fprintf routines here, release with strbuf__exit() */
+static const char *tag__strbuf_name(const struct tag *tag, const struct cu *cu,
+				    struct strbuf *sb,
+				    const struct conf_fprintf *conf)
+{
+	__tag__name(tag, cu, sb, conf);
+	return sb->s;
+}
+
+/* Hand what fits in @bf to a caller of the fixed size buffer APIs */
+static const char *strbuf__exit_into(struct strbuf *sb, char *bf, size_t len)
+{
+	if (sb->s != bf) {
+		if (len != 0)
+			snprintf(bf, len, "%s", sb->s);
+		strbuf__exit(sb);
+	}
+
+	return bf;
+}
 
 size_t tag__fprintf_decl_info(const struct tag *tag,
 			      const struct cu *cu, FILE *fp)
@@ -253,6 +306,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 	const struct conf_fprintf *pconf = conf ?: &conf_fprintf__defaults;
 	const struct tag *tag_type;
 	const struct tag *ptr_type;
+	struct strbuf sb;
 	char bf[512];
 	int is_pointer = 0;
 	size_t printed;
@@ -309,9 +363,12 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 	}
 	}
 
-	return fprintf(fp, "typedef %s %s",
-		       tag__name(tag_type, cu, bf, sizeof(bf), pconf),
-				 type__name(type, cu));
+	strbuf__init(&sb, bf, sizeof(bf));
+	printed = fprintf(fp, "typedef %s %s",
+			  tag__strbuf_name(tag_type, cu, &sb, pconf),
+			  type__name(type, cu));
+	strbuf__exit(&sb);
+	return printed;
 }
 
 static size_t imported_declaration__fprintf(const struct tag *tag,
@@ -393,23 +450,18 @@ static const char *tag__prefix(const struct cu *cu, const uint32_t tag,
 	return "";
 }
 
-static const char *__tag__name(const struct tag *tag, const struct cu *cu,
-			       char *bf, size_t len,
-			       const struct conf_fprintf *conf);
-
-static const char *tag__ptr_name(const struct tag *tag, const struct cu *cu,
-				 char *bf, size_t len, const char *ptr_suffix)
+static void tag__ptr_name(const struct tag *tag, const struct cu *cu,
+			  struct strbuf *sb, const char *ptr_suffix)
 {
 	if (tag->type == 0) /* No type == void */
-		snprintf(bf, len, "void %s", ptr_suffix);
+		strbuf__addf(sb, "void %s", ptr_suffix);
 	else {
 		const struct tag *type = cu__type(cu, tag->type);
 
 		if (type == NULL) {
-			size_t l = tag__id_not_found_snprintf(bf, len, tag->type);
-			snprintf(bf + l, len - l, " %s", ptr_suffix);
-		} else if (!tag__has_type_loop(tag, type, bf, len, NULL)) {
-			char tmpbf[1024];
+			tag__id_not_found_strbuf(sb, tag->type);
+			strbuf__addf(sb, " %s", ptr_suffix);
+		} else if (!tag__has_type_loop_strbuf(tag, type, sb)) {
 			const char *const_pointer = "";
 
 			if (tag__is_const(type)) {
@@ -421,26 +473,20 @@ static const char *tag__ptr_name(const struct tag *tag, const struct cu *cu,
 				}
 			}
 
-			snprintf(bf, len, "%s %s%s",
-				 __tag__name(type, cu,
-					     tmpbf, sizeof(tmpbf), NULL),
-				 const_pointer,
-				 ptr_suffix);
+			__tag__name(type, cu, sb, NULL);
+			strbuf__addf(sb, " %s%s", const_pointer, ptr_suffix);
 		}
 	}
-
-	return bf;
 }
 
-static const char *__tag__name(const struct tag *tag, const struct cu *cu,
-			       char *bf, size_t len,
-			       const struct conf_fprintf *conf)
+static void __tag__name(const struct tag *tag, const struct cu *cu,
+			struct strbuf *sb, const struct conf_fprintf *conf)
 {
 	struct tag *type;
 	const struct conf_fprintf *pconf = conf ?: &conf_fprintf__defaults;
 
 	if (tag == NULL)
-		strncpy(bf, "void", len);
+		strbuf__adds(sb, "void");
 	else switch (tag->tag) {
 	case DW_TAG_base_type: {
 		const struct base_type *bt = tag__base_type(tag);
@@ -451,100 +497,86 @@ static const char *__tag__name(const struct tag *tag, const struct cu *cu,
 			name = base_type__name(tag__base_type(tag), cu,
 					       bf2, sizeof(bf2));
 
-		strncpy(bf, name, len);
+		strbuf__adds(sb, name);
 	}
 		break;
 	case DW_TAG_subprogram:
-		strncpy(bf, function__name(tag__function(tag), cu), len);
+		strbuf__adds(sb, function__name(tag__function(tag), cu));
 		break;
 	case DW_TAG_pointer_type:
-		return tag__ptr_name(tag, cu, bf, len, "*");
+		tag__ptr_name(tag, cu, sb, "*");
+		break;
 	case DW_TAG_reference_type:
-		return tag__ptr_name(tag, cu, bf, len, "&");
+		tag__ptr_name(tag, cu, sb, "&");
+		break;
 	case DW_TAG_ptr_to_member_type: {
-		char suffix[512];
+		char bf[128];
+		struct strbuf suffix;
 		type_id_t id = tag__ptr_to_member_type(tag)->containing_type;
 
+		strbuf__init(&suffix, bf, sizeof(bf));
 		type = cu__type(cu, id);
 		if (type != NULL)
-			snprintf(suffix, sizeof(suffix), "%s::*",
-				 class__name(tag__class(type), cu));
-		else {
-			size_t l = tag__id_not_found_snprintf(suffix,
-							      sizeof(suffix),
-							      id);
-			snprintf(suffix + l, sizeof(suffix) - l, "::*");
-		}
+			strbuf__addf(&suffix, "%s", class__name(tag__class(type), cu));
+		else
+			tag__id_not_found_strbuf(&suffix, id);
+		strbuf__adds(&suffix, "::*");
 
-		return tag__ptr_name(tag, cu, bf, len, suffix);
+		tag__ptr_name(tag, cu, sb, suffix.s);
+		strbuf__exit(&suffix);
 	}
+		break;
 	case DW_TAG_volatile_type:
 	case DW_TAG_const_type:
 	case DW_TAG_restrict_type:
 	case DW_TAG_unspecified_type:
 		type = cu__type(cu, tag->type);
 		if (type == NULL && tag->type != 0)
-			tag__id_not_found_snprintf(bf, len, tag->type);
-		else if (!tag__has_type_loop(tag, type, bf, len, NULL)) {
-			char tmpbf[128];
-			const char *prefix = "", *suffix = "",
-				   *type_str = __tag__name(type, cu, tmpbf,
-							   sizeof(tmpbf),
-							   pconf);
+			tag__id_not_found_strbuf(sb, tag->type);
+		else if (!tag__has_type_loop_strbuf(tag, type, sb)) {
+			const char *prefix = "", *suffix = "";
+
 			switch (tag->tag) {
 			case DW_TAG_volatile_type: prefix = "volatile "; break;
 			case DW_TAG_const_type:    prefix = "const ";	 break;
 			case DW_TAG_restrict_type: suffix = " restrict"; break;
 			}
-			snprintf(bf, len, "%s%s%s ", prefix, type_str, suffix);
+			strbuf__adds(sb, prefix);
+			__tag__name(type, cu, sb, pconf);
+			strbuf__addf(sb, "%s ", suffix);
 		}
 		break;
 	case DW_TAG_array_type:
 		type = cu__type(cu, tag->type);
 		if (type == NULL)
-			tag__id_not_found_snprintf(bf, len, tag->type);
-		else if (!tag__has_type_loop(tag, type, bf, len, NULL))
-			return __tag__name(type, cu, bf, len, pconf);
+			tag__id_not_found_strbuf(sb, tag->type);
+		else if (!tag__has_type_loop_strbuf(tag, type, sb))
+			__tag__name(type, cu, sb, pconf);
 		break;
-	case DW_TAG_subroutine_type: {
-		FILE *bfp = fmemopen(bf, len, "w");
-
-		if (bfp != NULL) {
-			ftype__fprintf(tag__ftype(tag), cu, NULL, 0, 0, 0, true, pconf, bfp);
-			fclose(bfp);
-		} else
-			snprintf(bf, len, "<ERROR(%s): fmemopen failed!>",
-				 __func__);
-	}
+	case DW_TAG_subroutine_type:
+		ftype__strbuf(tag__ftype(tag), cu, NULL, 0, 0, 0, true, pconf, sb);
 		break;
 	case DW_TAG_member:
-		snprintf(bf, len, "%s", class_member__name(tag__class_member(tag), cu));
+		strbuf__addf(sb, "%s", class_member__name(tag__class_member(tag), cu));
 		break;
 	case DW_TAG_variable:
-		snprintf(bf, len, "%s", variable__name(tag__variable(tag), cu));
+		strbuf__addf(sb, "%s", variable__name(tag__variable(tag), cu));
 		break;
 	default:
-		snprintf(bf, len, "%s%s", tag__prefix(cu, tag->tag, pconf),
-			 type__name(tag__type(tag), cu) ?: "");
+		strbuf__adds(sb, tag__prefix(cu, tag->tag, pconf));
+		strbuf__adds(sb, type__name(tag__type(tag), cu) ?: "");
 		break;
 	}
-
-	return bf;
 }
 
 const char *tag__name(const struct tag *tag, const struct cu *cu,
 		      char *bf, size_t len, const struct conf_fprintf *conf)
 {
-	int printed = 0;
-
-	if (tag == NULL) {
-		strncpy(bf, "void", len);
-		return bf;
-	}
+	struct strbuf sb;
 
-	__tag__name(tag, cu, bf + printed, len - printed, conf);
-
-	return bf;
+	strbuf__init(&sb, bf, len);
+	__tag__name(tag, cu, &sb, conf);
+	return strbuf__exit_into(&sb, bf, len);
 }
 
 static const char *variable__prefix(const struct variable *var)
@@ -579,6 +611,16 @@ static size_t type__fprintf_stats(struct type *type, const struct cu *cu,
 	else
 		printed += fprintf(fp, " */\n");
 
+	for (int i = 0; i < conf->nr_hw_profiles; ++i) {
+		const struct hw_profile *hw = &conf->hw_profiles[i];
+
+		printed += fprintf(fp, "%.*s/* %s: cachelines: %u, prefetch units: %u, pages: %u */\n",
+				   conf->indent, tabs, hw->name,
+				   (type->size + hw->cacheline_size - 1) / hw->cacheline_size,
+				   (type->size + hw->prefetch_size - 1) / hw->prefetch_size,
+				   (type->size + hw->page_size - 1) / hw->page_size);
+	}
+
 	return printed;
 }
 
@@ -588,6 +630,18 @@ static size_t union__fprintf(struct type *type, const struct cu *cu,
 static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			       const struct conf_fprintf *conf, FILE *fp);
 
+static bool conf_fprintf__expanding(const struct conf_fprintf *conf,
+				    const struct tag *type)
+{
+	const struct conf_fprintf_expansion *pos;
+
+	for (pos = conf->expansions; pos != NULL; pos = pos->prev)
+		if (pos->type == type)
+			return true;
+
+	return false;
+}
+
 static size_t type__fprintf(struct tag *type, const struct cu *cu,
 			    const char *name, const struct conf_fprintf *conf,
 			    FILE *fp)
@@ -596,7 +650,7 @@ static size_t type__fprintf(struct tag *type, const struct cu *cu,
 	char namebf[256];
 	char namebfptr[258];
 	struct type *ctype;
-	struct tag *type_expanded = NULL;
+	struct conf_fprintf_expansion expansion = { .type = NULL, };
 	struct conf_fprintf tconf = {
 		.type_spacing = conf->type_spacing,
 	};
@@ -639,10 +693,10 @@ static size_t type__fprintf(struct tag *type, const struct cu *cu,
 			suppress_offset_comment = !!nr_indirections;
 
 		/* Avoid loops */
-		if (type->recursivity_level != 0)
+		if (conf_fprintf__expanding(conf, type))
 			expand_types = 0;
-		++type->recursivity_level;
-		type_expanded = type;
+		expansion.type = type;
+		expansion.prev = conf->expansions;
 	}
 
 	if (expand_types) {
@@ -674,6 +728,8 @@ static size_t type__fprintf(struct tag *type, const struct cu *cu,
 	}
 
 	tconf = *conf;
+	if (expansion.type != NULL)
+		tconf.expansions = &expansion;
 
 	if (tag__is_struct(type) || tag__is_union(type) ||
 	    tag__is_enumeration(type)) {
@@ -716,10 +772,15 @@ next_type:
 		}
 		/* Fall Thru */
 	default:
-print_default:
+print_default: {
+		struct strbuf sb;
+
+		strbuf__init(&sb, tbf, sizeof(tbf));
 		printed += fprintf(fp, "%-*s %s", tconf.type_spacing,
-				   tag__name(type, cu, tbf, sizeof(tbf), &tconf),
+				   tag__strbuf_name(type, cu, &sb, &tconf),
 				   name);
+		strbuf__exit(&sb);
+	}
 		break;
 	case DW_TAG_subroutine_type:
 		printed += ftype__fprintf(tag__ftype(type), cu, name, 0, 0,
@@ -785,9 +846,6 @@ print_default:
 		break;
 	}
 out:
-	if (type_expanded)
-		--type_expanded->recursivity_level;
-
 	return printed;
 out_type_not_found:
 	printed = fprintf(fp, "%-*s%s> %s", tconf.type_spacing, "<ERROR",
@@ -795,6 +853,31 @@ out_type_not_found:
 	goto out;
 }
 
+/*
+ * Coarser granularities from the first hardware profile, only emitted when
+ * crossed together with a cacheline one, i.e. when they are multiples of it.
+ */
+static size_t class__fprintf_hw_boundary(struct conf_fprintf *conf, const char *kind,
+					 uint32_t unit, uint32_t prev_offset,
+					 uint32_t offset, FILE *fp)
+{
+	const uint32_t boundary = offset / unit;
+	const uint32_t pos = offset % unit;
+	size_t printed;
+
+	if (unit <= cacheline_size || boundary <= prev_offset / unit)
+		return 0;
+
+	if (pos == 0)
+		printed = fprintf(fp, "/* --- %s %u boundary (%u bytes) --- */\n",
+				  kind, boundary, offset);
+	else
+		printed = fprintf(fp, "/* --- %s %u boundary (%u bytes) was %u bytes ago --- */\n",
+				  kind, boundary, offset - pos, pos);
+
+	return printed + fprintf(fp, "%.*s", conf->indent, tabs);
+}
+
 static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
 						uint32_t offset,
 						FILE *fp);
@@ -1003,84 +1086,90 @@ static size_t union__fprintf(struct type *type, const struct cu *cu,
 const char *function__prototype(const struct function *func,
 				const struct cu *cu, char *bf, size_t len)
 {
-	FILE *bfp = fmemopen(bf, len, "w");
-
-	if (bfp != NULL) {
-		ftype__fprintf(&func->proto, cu, NULL, 0, 0, 0, true,
-			       &conf_fprintf__defaults, bfp);
-		fclose(bfp);
-	} else
-		snprintf(bf, len, "<ERROR(%s): fmemopen failed!>", __func__);
+	struct strbuf sb;
 
-	return bf;
+	strbuf__init(&sb, bf, len);
+	ftype__strbuf(&func->proto, cu, NULL, 0, 0, 0, true,
+		      &conf_fprintf__defaults, &sb);
+	return strbuf__exit_into(&sb, bf, len);
 }
 
-size_t ftype__fprintf_parms(const struct ftype *ftype,
-			    const struct cu *cu, int indent,
-			    const struct conf_fprintf *conf, FILE *fp)
+static void ftype__strbuf_parms(const struct ftype *ftype,
+				const struct cu *cu, int indent,
+				const struct conf_fprintf *conf,
+				struct strbuf *sb)
 {
 	struct parameter *pos;
 	int first_parm = 1;
-	char sbf[128];
 	struct tag *type;
-	const char *name, *stype;
-	size_t printed = fprintf(fp, "(");
+	const char *name;
+
+	strbuf__adds(sb, "(");
 
 	ftype__for_each_parameter(ftype, pos) {
 		if (!first_parm) {
 			if (indent == 0)
-				printed += fprintf(fp, ", ");
+				strbuf__adds(sb, ", ");
 			else
-				printed += fprintf(fp, ",\n%.*s",
-						   indent, tabs);
+				strbuf__addf(sb, ",\n%.*s", indent, tabs);
 		} else
 			first_parm = 0;
 		name = conf->no_parm_names ? NULL : parameter__name(pos, cu);
 		type = cu__type(cu, pos->tag.type);
 		if (type == NULL) {
-			snprintf(sbf, sizeof(sbf),
-				 "<ERROR: type %d not found>", pos->tag.type);
-			stype = sbf;
-			goto print_it;
+			strbuf__addf(sb, "<ERROR: type %d not found>",
+				     pos->tag.type);
+			goto print_name;
 		}
 		if (tag__is_pointer(type)) {
 			if (type->type != 0) {
-				int n;
 				struct tag *ptype = cu__type(cu, type->type);
 				if (ptype == NULL) {
-					printed +=
-					    tag__id_not_found_fprintf(fp, type->type);
+					tag__id_not_found_strbuf(sb, type->type);
 					continue;
 				}
-				n = tag__has_type_loop(type, ptype, NULL, 0, fp);
-				if (n)
-					return printed + n;
+				if (tag__has_type_loop_strbuf(type, ptype, sb))
+					return;
 				if (ptype->tag == DW_TAG_subroutine_type) {
-					printed +=
-					     ftype__fprintf(tag__ftype(ptype),
-							    cu, name, 0, 1, 0,
-							    true, conf, fp);
+					ftype__strbuf(tag__ftype(ptype), cu,
+						      name, 0, 1, 0, true,
+						      conf, sb);
 					continue;
 				}
 			}
 		} else if (type->tag == DW_TAG_subroutine_type) {
-			printed += ftype__fprintf(tag__ftype(type), cu, name,
-						  true, 0, 0, 0, conf, fp);
+			ftype__strbuf(tag__ftype(type), cu, name,
+				      true, 0, 0, 0, conf, sb);
 			continue;
 		}
-		stype = tag__name(type, cu, sbf, sizeof(sbf), conf);
-print_it:
-		printed += fprintf(fp, "%s%s%s", stype, name ? " " : "",
-				   name ?: "");
+		__tag__name(type, cu, sb, conf);
+print_name:
+		if (name)
+			strbuf__addf(sb, " %s", name);
 	}
 
 	/* No parameters? */
 	if (first_parm)
-		printed += fprintf(fp, "void)");
+		strbuf__adds(sb, "void)");
 	else if (ftype->unspec_parms)
-		printed += fprintf(fp, ", ...)");
+		strbuf__adds(sb, ", ...)");
 	else
-		printed += fprintf(fp, ")");
+		strbuf__adds(sb, ")");
+}
+
+size_t ftype__fprintf_parms(const struct ftype *ftype,
+			    const struct cu *cu, int indent,
+			    const struct conf_fprintf *conf, FILE *fp)
+{
+	char bf[512];
+	struct strbuf sb;
+	size_t printed;
+
+	strbuf__init(&sb, bf, sizeof(bf));
+	ftype__strbuf_parms(ftype, cu, indent, conf, &sb);
+	printed = fwrite(sb.s, 1, sb.len, fp);
+	strbuf__exit(&sb);
+
 	return printed;
 }
 
@@ -1196,22 +1285,49 @@ size_t lexblock__fprintf(const struct lexblock *block, const struct cu *cu,
 	return printed;
 }
 
+static void ftype__strbuf(const struct ftype *ftype, const struct cu *cu,
+			  const char *name, const int inlined,
+			  const int is_pointer, int type_spacing,
+			  bool is_prototype, const struct conf_fprintf *conf,
+			  struct strbuf *sb)
+{
+	struct tag *type = cu__type(cu, ftype->tag.type);
+	size_t stype_start;
+	int stype_len;
+
+	if (inlined)
+		strbuf__adds(sb, "inline ");
+
+	stype_start = sb->len;
+	__tag__name(type, cu, sb, conf);
+	stype_len = sb->len - stype_start;
+	/* Same as "%-*s" */
+	if (stype_len < type_spacing)
+		strbuf__addf(sb, "%*s", type_spacing - stype_len, "");
+
+	strbuf__addf(sb, " %s%s%s%s", is_prototype ?  "(" : "",
+		     is_pointer ? "*" : "", name ?: "",
+		     is_prototype ?  ")" : "");
+
+	ftype__strbuf_parms(ftype, cu, 0, conf, sb);
+}
+
 size_t ftype__fprintf(const struct ftype *ftype, const struct cu *cu,
 		      const char *name, const int inlined,
 		      const int is_pointer, int type_spacing, bool is_prototype,
 		      const struct conf_fprintf *conf, FILE *fp)
 {
-	struct tag *type = cu__type(cu, ftype->tag.type);
-	char sbf[128];
-	const char *stype = tag__name(type, cu, sbf, sizeof(sbf), conf);
-	size_t printed = fprintf(fp, "%s%-*s %s%s%s%s",
-				 inlined ? "inline " : "",
-				 type_spacing, stype,
-				 is_prototype ?  "(" : "",
-				 is_pointer ? "*" : "", name ?: "",
-				 is_prototype ?  ")" : "");
-
-	return printed + ftype__fprintf_parms(ftype, cu, 0, conf, fp);
+	char bf[512];
+	struct strbuf sb;
+	size_t printed;
+
+	strbuf__init(&sb, bf, sizeof(bf));
+	ftype__strbuf(ftype, cu, name, inlined, is_pointer, type_spacing,
+		      is_prototype, conf, &sb);
+	printed = fwrite(sb.s, 1, sb.len, fp);
+	strbuf__exit(&sb);
+
+	return printed;
 }
 
 static size_t function__fprintf(const struct tag *tag, const struct cu *cu,
@@ -1238,8 +1354,15 @@ static size_t function__fprintf(const struct tag *tag, const struct cu *cu,
 size_t function__fprintf_stats(const struct tag *tag, const struct cu *cu,
 			       const struct conf_fprintf *conf, FILE *fp)
 {
-	struct function *func = tag__function(tag);
-	size_t printed = lexblock__fprintf(&func->lexblock, cu, func, 0, conf, fp);
+	struct function *func;
+	size_t printed;
+
+	/* Function types don't have a body */
+	if (!tag__is_function(tag))
+		return 0;
+
+	func	= tag__function(tag);
+	printed = lexblock__fprintf(&func->lexblock, cu, func, 0, conf, fp);
 
 	printed += fprintf(fp, "/* size: %d", function__size(func));
 	if (func->lexblock.nr_variables > 0)
@@ -1279,6 +1402,16 @@ static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
 
 		printed += fprintf(fp, "%.*s", indent, tabs);
 
+		if (conf->hw_profiles != NULL) {
+			const struct hw_profile *hw = &conf->hw_profiles[0];
+			const uint32_t prev_offset = *conf->cachelinep * cacheline_size;
+
+			printed += class__fprintf_hw_boundary(conf, "prefetch unit", hw->prefetch_size,
+							      prev_offset, offset, fp);
+			printed += class__fprintf_hw_boundary(conf, "page", hw->page_size,
+							      prev_offset, offset, fp);
+		}
+
 		*conf->cachelinep = cacheline;
 	}
 	return printed;
@@ -1552,6 +1685,21 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 						   tabs, padding,
 						   padding != 1 ? "s" : "");
 			}
+
+			if (tag_pos->tag == DW_TAG_inheritance) {
+				const uint32_t reused = class__base_tail_reuse(class, pos);
+
+				if (reused != 0) {
+					if (!newline++) {
+						fputc('\n', fp);
+						++printed;
+					}
+					printed += fprintf(fp, "\n%.*s/* %u byte%s of "
+							   "its tail padding reused */",
+							   cconf.indent, tabs, reused,
+							   reused != 1 ? "s" : "");
+				}
+			}
 		}
 
 		if (pos->bit_hole != 0 && !cconf.suppress_comments) {
@@ -1581,9 +1729,17 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 		fputc('\n', fp);
 		++printed;
 
-		/* XXX for now just skip these */
-		if (tag_pos->tag == DW_TAG_inheritance)
+		/*
+		 * Virtual bases are not handled by class__find_holes(), the
+		 * others are accounted as members, but just the bytes not
+		 * reused by what comes after them.
+		 */
+		if (tag_pos->tag == DW_TAG_inheritance) {
+			if (pos->virtuality != DW_VIRTUALITY_virtual)
+				sum_bytes += pos->byte_size -
+					     class__base_tail_reuse(class, pos);
 			continue;
+		}
 #if 0
 		/*
  		 * This one was being skipped but caused problems with:
@@ -1801,6 +1957,7 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 {
 	size_t printed = 0;
 	struct conf_fprintf tconf;
+	struct conf_fprintf_expansion expansion;
 	const struct conf_fprintf *pconf = conf;
 
 	if (conf == NULL) {
@@ -1825,8 +1982,15 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 			tconf.type_spacing = 26;
 	}
 
-	if (pconf->expand_types)
-		++tag->recursivity_level;
+	if (pconf->expand_types) {
+		if (pconf != &tconf) {
+			tconf = *conf;
+			pconf = &tconf;
+		}
+		expansion.type = tag;
+		expansion.prev = tconf.expansions;
+		tconf.expansions = &expansion;
+	}
 
 	if (pconf->show_decl_info) {
 		printed += fprintf(fp, "%.*s", pconf->indent, tabs);
@@ -1891,9 +2055,6 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 					   function__linkage_name(func, cu));
 	}
 
-	if (pconf->expand_types)
-		--tag->recursivity_level;
-
 	return printed;
 }
 
@@ -1907,6 +2068,137 @@ void cus__print_error_msg(const char *progname, const struct cus *cus,
 		fprintf(stderr, "%s: %s\n", progname, strerror(err));
 }
 
+size_t dwarves__cacheline_size(void)
+{
+	return cacheline_size;
+}
+
+static const struct hw_profile hw_profiles[] = {
+	{ .name = "x86_64",  .cacheline_size = 64,  .prefetch_size = 128, .page_size = 4096, },
+	{ .name = "arm64",   .cacheline_size = 128, .prefetch_size = 128, .page_size = 4096, },
+	{ .name = "arm64_64k", .cacheline_size = 128, .prefetch_size = 128, .page_size = 65536, },
+	{ .name = "ppc64",   .cacheline_size = 128, .prefetch_size = 128, .page_size = 65536, },
+	{ .name = "s390x",   .cacheline_size = 256, .prefetch_size = 256, .page_size = 4096, },
+};
+
+#define NR_HW_PROFILES (sizeof(hw_profiles) / sizeof(hw_profiles[0]))
+
+const struct hw_profile *hw_profile__find(const char *name)
+{
+	for (size_t i = 0; i < NR_HW_PROFILES; ++i)
+		if (strcmp(hw_profiles[i].name, name) == 0)
+			return &hw_profiles[i];
+
+	return NULL;
+}
+
+size_t hw_profile__fprintf_names(FILE *fp)
+{
+	size_t printed = 0;
+
+	for (size_t i = 0; i < NR_HW_PROFILES; ++i)
+		printed += fprintf(fp, "%s%s", i ? ", " : "", hw_profiles[i].name);
+
+	return printed;
+}
+
+/*
+ * Profile files have "key = value" lines, keys being "name",
+ * "cacheline_size", "prefetch_size" and "page_size", '#' starts a comment.
+ * prefetch_size defaults to cacheline_size, page_size to 4096, name to the
+ * file name.
+ */
+int hw_profile__load(struct hw_profile *profile, const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	char line[256], *name = NULL;
+	int err = -EINVAL;
+
+	if (fp == NULL)
+		return -errno;
+
+	memset(profile, 0, sizeof(*profile));
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *key = line, *value, *end;
+
+		end = strchr(line, '#');
+		if (end != NULL)
+			*end = '\0';
+
+		key += strspn(key, " \t");
+		value = strchr(key, '=');
+		if (value == NULL) {
+			if (key[strspn(key, " \t\r\n")] != '\0')
+				goto out_err;
+			continue;
+		}
+
+		end = value;
+		while (end > key && (end[-1] == ' ' || end[-1] == '\t'))
+			--end;
+		*end = '\0';
+
+		++value;
+		value += strspn(value, " \t");
+		end = value + strlen(value);
+		while (end > value && (end[-1] == ' ' || end[-1] == '\t' ||
+				       end[-1] == '\r' || end[-1] == '\n'))
+			--end;
+		*end = '\0';
+
+		if (strcmp(key, "name") == 0) {
+			free(name);
+			name = strdup(value);
+			if (name == NULL) {
+				err = -ENOMEM;
+				goto out_err;
+			}
+			continue;
+		}
+
+		unsigned long size = strtoul(value, &end, 0);
+
+		if (*end != '\0' || !is_power_of_2(size) || size > UINT32_MAX)
+			goto out_err;
+
+		if (strcmp(key, "cacheline_size") == 0)
+			profile->cacheline_size = size;
+		else if (strcmp(key, "prefetch_size") == 0)
+			profile->prefetch_size = size;
+		else if (strcmp(key, "page_size") == 0)
+			profile->page_size = size;
+		else
+			goto out_err;
+	}
+
+	if (profile->cacheline_size == 0)
+		goto out_err;
+	if (profile->prefetch_size == 0)
+		profile->prefetch_size = profile->cacheline_size;
+	if (profile->page_size == 0)
+		profile->page_size = 4096;
+	if (profile->prefetch_size < profile->cacheline_size ||
+	    profile->page_size < profile->prefetch_size)
+		goto out_err;
+
+	if (name == NULL) {
+		name = strdup(filename);
+		if (name == NULL) {
+			err = -ENOMEM;
+			goto out_err;
+		}
+	}
+
+	profile->name = name;
+	fclose(fp);
+	return 0;
+out_err:
+	free(name);
+	fclose(fp);
+	return err;
+}
+
 void dwarves__fprintf_init(uint16_t user_cacheline_size)
 {
 	if (user_cacheline_size == 0) {
@@ -1919,3 +2211,198 @@ void dwarves__fprintf_init(uint16_t user_cacheline_size)
 	} else
 		cacheline_size = user_cacheline_size;
 }
+
+struct fprintf_queue_entry {
+	fprintf_queue__fprintf_t fn;
+	struct tag		 *tag;
+	struct cu		 *cu;
+	uint32_t		 id;
+	bool			 has_conf;
+	struct conf_fprintf	 conf;
+	/* Where it was formatted */
+	uint32_t		 worker;
+	size_t			 offset;
+	size_t			 len;
+};
+
+struct fprintf_queue_worker {
+	struct fprintf_queue *queue;
+	pthread_t	     thread;
+	FILE		     *fp;
+	char		     *bf;
+	size_t		     size;
+};
+
+struct fprintf_queue {
+	struct fprintf_queue_entry  *entries;
+	uint32_t		    nr_entries;
+	uint32_t		    allocated;
+	uint32_t		    next;
+	int			    nr_jobs;
+	struct fprintf_queue_worker workers[];
+};
+
+struct fprintf_queue *fprintf_queue__new(int nr_jobs)
+{
+	struct fprintf_queue *queue;
+
+	if (nr_jobs < 1)
+		nr_jobs = 1;
+
+	queue = zalloc(sizeof(*queue) + nr_jobs * sizeof(queue->workers[0]));
+	if (queue != NULL)
+		queue->nr_jobs = nr_jobs;
+
+	return queue;
+}
+
+void fprintf_queue__delete(struct fprintf_queue *queue)
+{
+	if (queue == NULL)
+		return;
+
+	free(queue->entries);
+	free(queue);
+}
+
+int fprintf_queue__add(struct fprintf_queue *queue,
+		       fprintf_queue__fprintf_t fn, struct tag *tag,
+		       struct cu *cu, uint32_t id,
+		       const struct conf_fprintf *conf)
+{
+	struct fprintf_queue_entry *entry;
+
+	if (queue->nr_entries == queue->allocated) {
+		uint32_t allocated = queue->allocated ? queue->allocated * 2 : 1024;
+		struct fprintf_queue_entry *entries = realloc(queue->entries,
+							      allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		queue->entries	 = entries;
+		queue->allocated = allocated;
+	}
+
+	entry = &queue->entries[queue->nr_entries++];
+	entry->fn	= fn;
+	entry->tag	= tag;
+	entry->cu	= cu;
+	entry->id	= id;
+	entry->has_conf = conf != NULL;
+	if (conf != NULL)
+		entry->conf = *conf;
+
+	return 0;
+}
+
+static void fprintf_queue_entry__fprintf(struct fprintf_queue_entry *entry,
+					 FILE *fp)
+{
+	entry->fn(entry->tag, entry->cu, entry->id,
+		       entry->has_conf ? &entry->conf : NULL, fp);
+}
+
+static void *fprintf_queue_worker__run(void *arg)
+{
+	struct fprintf_queue_worker *worker = arg;
+	struct fprintf_queue *queue = worker->queue;
+	uint32_t i;
+
+	while ((i = __atomic_fetch_add(&queue->next, 1,
+				       __ATOMIC_RELAXED)) < queue->nr_entries) {
+		struct fprintf_queue_entry *entry = &queue->entries[i];
+
+		entry->worker = worker - queue->workers;
+		entry->offset = ftell(worker->fp);
+		fprintf_queue_entry__fprintf(entry, worker->fp);
+		entry->len = ftell(worker->fp) - entry->offset;
+	}
+
+	return NULL;
+}
+
+int fprintf_queue__flush(struct fprintf_queue *queue, FILE *fp)
+{
+	int nr_threads = queue->nr_jobs, i;
+	struct cu *prepared = NULL;
+	bool serial = false;
+	uint32_t e;
+
+	if (queue->nr_entries == 0)
+		return 0;
+
+	if (nr_threads > (int)queue->nr_entries)
+		nr_threads = queue->nr_entries;
+
+	/* Not worth it, or what we would get is the same serial formatting */
+	if (nr_threads == 1)
+		goto out_serial;
+
+	for (e = 0; e < queue->nr_entries; ++e) {
+		if (queue->entries[e].cu != prepared) {
+			prepared = queue->entries[e].cu;
+			cu__prepare_for_sharing(prepared);
+		}
+	}
+
+	for (i = 0; i < nr_threads; ++i) {
+		struct fprintf_queue_worker *worker = &queue->workers[i];
+
+		worker->queue = queue;
+		worker->fp = open_memstream(&worker->bf, &worker->size);
+		if (worker->fp == NULL) {
+			serial = true;
+			goto out_close;
+		}
+		__fsetlocking(worker->fp, FSETLOCKING_BYCALLER);
+	}
+
+	queue->next = 0;
+
+	/* The calling thread is one of the workers */
+	for (i = 1; i < nr_threads; ++i)
+		if (pthread_create(&queue->workers[i].thread, NULL,
+				   fprintf_queue_worker__run, &queue->workers[i]) != 0)
+			break;
+
+	fprintf_queue_worker__run(&queue->workers[0]);
+
+	while (--i > 0)
+		pthread_join(queue->workers[i].thread, NULL);
+
+	for (i = 0; i < nr_threads; ++i) {
+		struct fprintf_queue_worker *worker = &queue->workers[i];
+
+		fclose(worker->fp);
+		worker->fp = NULL;
+	}
+
+	for (e = 0; e < queue->nr_entries; ++e) {
+		const struct fprintf_queue_entry *entry = &queue->entries[e];
+
+		fwrite(queue->workers[entry->worker].bf + entry->offset, 1,
+		       entry->len, fp);
+	}
+
+	i = nr_threads;
+out_close:
+	while (--i >= 0) {
+		struct fprintf_queue_worker *worker = &queue->workers[i];
+
+		if (worker->fp != NULL)
+			fclose(worker->fp);
+		free(worker->bf);
+		worker->fp = NULL;
+		worker->bf = NULL;
+	}
+
+	/* No memory for the streams, still print them all, serially */
+	if (!serial)
+		goto out;
+out_serial:
+	for (e = 0; e < queue->nr_entries; ++e)
+		fprintf_queue_entry__fprintf(&queue->entries[e], fp);
+out:
+	queue->nr_entries = 0;
+	return 0;
+}
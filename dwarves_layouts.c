@@ -0,0 +1,471 @@
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Columnar export of the struct layouts, see dwarves_layouts.h.
+*/
+
+#include <dwarf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dwarves_layouts.h"
+#include "dwarves.h"
+#include "dutil.h"
+#include "strings.h"
+
+#define LAYOUTS__NR_TYPE_COLUMNS   (LAYOUTS_MEMBER_NAME - LAYOUTS_TYPE_NAME)
+#define LAYOUTS__NR_MEMBER_COLUMNS (LAYOUTS__NR_COLUMNS - LAYOUTS_MEMBER_NAME)
+
+/* The writer keeps a row of uint32_t per type and per member */
+#define TYPE_COL(row, id)   (row)[(id) - LAYOUTS_TYPE_NAME]
+#define MEMBER_COL(row, id) (row)[(id) - LAYOUTS_MEMBER_NAME]
+
+static const uint8_t layouts__elem_size[LAYOUTS__NR_COLUMNS] = {
+	[LAYOUTS_TYPE_NAME]		 = 4,
+	[LAYOUTS_TYPE_KIND]		 = 1,
+	[LAYOUTS_TYPE_SIZE]		 = 4,
+	[LAYOUTS_TYPE_NR_CACHELINES]	 = 4,
+	[LAYOUTS_TYPE_NR_HOLES]		 = 4,
+	[LAYOUTS_TYPE_SUM_HOLES]	 = 4,
+	[LAYOUTS_TYPE_NR_BIT_HOLES]	 = 4,
+	[LAYOUTS_TYPE_SUM_BIT_HOLES]	 = 4,
+	[LAYOUTS_TYPE_PADDING]		 = 4,
+	[LAYOUTS_TYPE_BIT_PADDING]	 = 1,
+	[LAYOUTS_TYPE_DECL_FILE]	 = 4,
+	[LAYOUTS_TYPE_DECL_LINE]	 = 4,
+	[LAYOUTS_TYPE_FIRST_MEMBER]	 = 4,
+	[LAYOUTS_TYPE_NR_MEMBERS]	 = 4,
+	[LAYOUTS_MEMBER_NAME]		 = 4,
+	[LAYOUTS_MEMBER_TYPE]		 = 4,
+	[LAYOUTS_MEMBER_OFFSET]		 = 4,
+	[LAYOUTS_MEMBER_SIZE]		 = 4,
+	[LAYOUTS_MEMBER_BITFIELD_OFFSET] = 1,
+	[LAYOUTS_MEMBER_BITFIELD_SIZE]	 = 1,
+	[LAYOUTS_MEMBER_HOLE]		 = 4,
+	[LAYOUTS_MEMBER_BIT_HOLE]	 = 1,
+};
+
+static bool layouts__is_member_column(uint32_t id)
+{
+	return id >= LAYOUTS_MEMBER_NAME;
+}
+
+struct layouts_writer {
+	struct strings *strings;
+	uint32_t       *types;
+	uint32_t       *members;
+	uint32_t       nr_types;
+	uint32_t       allocated_types;
+	uint32_t       nr_members;
+	uint32_t       allocated_members;
+};
+
+struct layouts_writer *layouts_writer__new(void)
+{
+	struct layouts_writer *writer = zalloc(sizeof(*writer));
+
+	if (writer == NULL)
+		return NULL;
+
+	writer->strings = strings__new();
+	if (writer->strings == NULL) {
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+void layouts_writer__delete(struct layouts_writer *writer)
+{
+	if (writer == NULL)
+		return;
+
+	strings__delete(writer->strings);
+	free(writer->types);
+	free(writer->members);
+	free(writer);
+}
+
+static uint32_t *layouts_writer__new_row(uint32_t **rows, uint32_t *nr_rows,
+					 uint32_t *allocated, size_t width)
+{
+	uint32_t *row;
+
+	if (*nr_rows == *allocated) {
+		uint32_t nr = *allocated ? *allocated * 2 : 1024;
+		uint32_t *entries = realloc(*rows, nr * width * sizeof(*entries));
+
+		if (entries == NULL)
+			return NULL;
+
+		*rows	   = entries;
+		*allocated = nr;
+	}
+
+	row = *rows + *nr_rows * width;
+	memset(row, 0, width * sizeof(*row));
+	++*nr_rows;
+	return row;
+}
+
+static int layouts_writer__string(struct layouts_writer *writer,
+				  const char *s, uint32_t *offset)
+{
+	strings_t index;
+
+	*offset = 0;
+	if (s == NULL || s[0] == '\0')
+		return 0;
+
+	index = strings__add(writer->strings, s);
+	if (index == 0)
+		return -ENOMEM;
+	/* The offsets in the columns are 32-bit */
+	if (index > UINT32_MAX)
+		return -E2BIG;
+
+	*offset = index;
+	return 0;
+}
+
+/* The type name as in a declaration, with the array dimensions, if any */
+static const char *class_member__type_name(const struct class_member *member,
+					   const struct cu *cu,
+					   char *bf, size_t len)
+{
+	struct tag *type = cu__type(cu, member->tag.type);
+	size_t printed;
+
+	tag__name(type, cu, bf, len, NULL);
+
+	if (type != NULL && type->tag == DW_TAG_array_type) {
+		const struct array_type *at = tag__array_type(type);
+		int i;
+
+		printed = strlen(bf);
+		for (i = 0; i < at->dimensions && printed < len; ++i)
+			printed += snprintf(bf + printed, len - printed, "[%u]",
+					    at->nr_entries[i]);
+	}
+
+	return bf;
+}
+
+static int layouts_writer__add_member(struct layouts_writer *writer,
+				      const struct class_member *member,
+				      const struct cu *cu)
+{
+	uint32_t *row = layouts_writer__new_row(&writer->members,
+						&writer->nr_members,
+						&writer->allocated_members,
+						LAYOUTS__NR_MEMBER_COLUMNS);
+	char bf[1024];
+	int err;
+
+	if (row == NULL)
+		return -ENOMEM;
+
+	err = layouts_writer__string(writer, class_member__name(member, cu),
+				     &MEMBER_COL(row, LAYOUTS_MEMBER_NAME));
+	if (err == 0)
+		err = layouts_writer__string(writer,
+					     class_member__type_name(member, cu, bf, sizeof(bf)),
+					     &MEMBER_COL(row, LAYOUTS_MEMBER_TYPE));
+	if (err != 0)
+		return err;
+
+	MEMBER_COL(row, LAYOUTS_MEMBER_OFFSET)	       = member->byte_offset;
+	MEMBER_COL(row, LAYOUTS_MEMBER_SIZE)	       = member->byte_size;
+	MEMBER_COL(row, LAYOUTS_MEMBER_BITFIELD_OFFSET) = (uint8_t)member->bitfield_offset;
+	MEMBER_COL(row, LAYOUTS_MEMBER_BITFIELD_SIZE)   = member->bitfield_size;
+	MEMBER_COL(row, LAYOUTS_MEMBER_HOLE)	       = member->hole;
+	MEMBER_COL(row, LAYOUTS_MEMBER_BIT_HOLE)       = member->bit_hole;
+	return 0;
+}
+
+int layouts_writer__add(struct layouts_writer *writer, struct class *class,
+			const struct cu *cu, uint32_t id)
+{
+	struct tag *tag = class__tag(class);
+	const char *name = type__name(&class->type, cu);
+	struct class_member *pos;
+	uint32_t *row, first_member = writer->nr_members, nr_members = 0;
+	uint32_t sum_holes = 0, sum_bit_holes = 0;
+	int err;
+
+	if (name == NULL) {
+		const struct tag *tdef = cu__find_first_typedef_of_type(cu, id);
+
+		if (tdef != NULL)
+			name = type__name(tag__type(tdef), cu);
+	}
+
+	/* Unions are not a struct class when loaded from BTF */
+	if (tag__is_struct(tag))
+		class__find_holes(class);
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->is_static)
+			continue;
+
+		err = layouts_writer__add_member(writer, pos, cu);
+		if (err != 0)
+			return err;
+
+		sum_holes     += pos->hole;
+		sum_bit_holes += pos->bit_hole;
+		++nr_members;
+	}
+
+	row = layouts_writer__new_row(&writer->types, &writer->nr_types,
+				      &writer->allocated_types,
+				      LAYOUTS__NR_TYPE_COLUMNS);
+	if (row == NULL)
+		return -ENOMEM;
+
+	err = layouts_writer__string(writer, name,
+				     &TYPE_COL(row, LAYOUTS_TYPE_NAME));
+	if (err == 0)
+		err = layouts_writer__string(writer, tag__decl_file(tag, cu),
+					     &TYPE_COL(row, LAYOUTS_TYPE_DECL_FILE));
+	if (err != 0)
+		return err;
+
+	switch (tag->tag) {
+	case DW_TAG_union_type:
+		TYPE_COL(row, LAYOUTS_TYPE_KIND) = LAYOUTS_KIND__UNION;	break;
+	case DW_TAG_class_type:
+		TYPE_COL(row, LAYOUTS_TYPE_KIND) = LAYOUTS_KIND__CLASS;	break;
+	default:
+		TYPE_COL(row, LAYOUTS_TYPE_KIND) = LAYOUTS_KIND__STRUCT;	break;
+	}
+
+	TYPE_COL(row, LAYOUTS_TYPE_SIZE)	  = class->type.size;
+	TYPE_COL(row, LAYOUTS_TYPE_NR_CACHELINES) = tag__nr_cachelines(tag, cu);
+	TYPE_COL(row, LAYOUTS_TYPE_SUM_HOLES)	  = sum_holes;
+	TYPE_COL(row, LAYOUTS_TYPE_SUM_BIT_HOLES) = sum_bit_holes;
+	TYPE_COL(row, LAYOUTS_TYPE_DECL_LINE)	  = tag__decl_line(tag, cu);
+	TYPE_COL(row, LAYOUTS_TYPE_FIRST_MEMBER)  = first_member;
+	TYPE_COL(row, LAYOUTS_TYPE_NR_MEMBERS)	  = nr_members;
+
+	if (tag__is_struct(tag)) {
+		TYPE_COL(row, LAYOUTS_TYPE_NR_HOLES)	 = class->nr_holes;
+		TYPE_COL(row, LAYOUTS_TYPE_NR_BIT_HOLES) = class->nr_bit_holes;
+		TYPE_COL(row, LAYOUTS_TYPE_PADDING)	 = class->padding;
+		TYPE_COL(row, LAYOUTS_TYPE_BIT_PADDING)	 = class->bit_padding;
+	}
+
+	return 0;
+}
+
+static int layouts_writer__write_column(struct layouts_writer *writer,
+					uint32_t id, FILE *fp)
+{
+	const bool members = layouts__is_member_column(id);
+	const uint32_t nr_rows = members ? writer->nr_members : writer->nr_types;
+	const uint32_t *rows = members ? writer->members : writer->types;
+	const size_t width = members ? LAYOUTS__NR_MEMBER_COLUMNS : LAYOUTS__NR_TYPE_COLUMNS;
+	const uint32_t col = id - (members ? LAYOUTS_MEMBER_NAME : LAYOUTS_TYPE_NAME);
+	const size_t elem_size = layouts__elem_size[id];
+	uint8_t *column;
+	uint32_t i;
+
+	if (nr_rows == 0)
+		return 0;
+
+	column = malloc(nr_rows * elem_size);
+	if (column == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_rows; ++i) {
+		const uint32_t value = rows[i * width + col];
+
+		if (elem_size == 1)
+			column[i] = value;
+		else
+			memcpy(column + i * elem_size, &value, elem_size);
+	}
+
+	i = fwrite(column, elem_size, nr_rows, fp);
+	free(column);
+
+	return i == nr_rows ? 0 : -EIO;
+}
+
+static int layouts__pad(FILE *fp, uint64_t offset)
+{
+	static const char zeroes[8];
+	const long pos = ftell(fp);
+
+	if (pos < 0 || (uint64_t)pos > offset || offset - pos > sizeof(zeroes))
+		return -EIO;
+
+	return fwrite(zeroes, 1, offset - pos, fp) == offset - pos ? 0 : -EIO;
+}
+
+int layouts_writer__write(struct layouts_writer *writer, const char *filename)
+{
+	struct layouts_column columns[LAYOUTS__NR_COLUMNS - LAYOUTS_TYPE_NAME];
+	struct layouts_header header = {
+		.version    = LAYOUTS__VERSION,
+		.byte_order = LAYOUTS__BYTE_ORDER,
+		.nr_columns = LAYOUTS__NR_COLUMNS - LAYOUTS_TYPE_NAME,
+		.nr_types   = writer->nr_types,
+		.nr_members = writer->nr_members,
+	};
+	const char *strings = strings__entries(writer->strings);
+	size_t strings_size = strings__size(writer->strings);
+	uint64_t offset = sizeof(header) + sizeof(columns);
+	uint32_t id;
+	FILE *fp;
+	int err = 0;
+
+	memcpy(header.magic, LAYOUTS__MAGIC, sizeof(header.magic));
+
+	for (id = LAYOUTS_TYPE_NAME; id < LAYOUTS__NR_COLUMNS; ++id) {
+		struct layouts_column *column = &columns[id - LAYOUTS_TYPE_NAME];
+		const uint32_t nr_rows = layouts__is_member_column(id) ?
+					 writer->nr_members : writer->nr_types;
+
+		column->id	  = id;
+		column->elem_size = layouts__elem_size[id];
+		column->offset	  = roundup(offset, 8);
+		offset = column->offset + (uint64_t)nr_rows * column->elem_size;
+	}
+
+	/* The first byte of the strings gobuffer is not used, 0 is "" */
+	header.strings_offset = roundup(offset, 8);
+	header.strings_size   = strings_size;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+		return -errno;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(columns, sizeof(columns), 1, fp) != 1) {
+		err = -EIO;
+		goto out_close;
+	}
+
+	for (id = LAYOUTS_TYPE_NAME; id < LAYOUTS__NR_COLUMNS; ++id) {
+		err = layouts__pad(fp, columns[id - LAYOUTS_TYPE_NAME].offset);
+		if (err == 0)
+			err = layouts_writer__write_column(writer, id, fp);
+		if (err != 0)
+			goto out_close;
+	}
+
+	err = layouts__pad(fp, header.strings_offset);
+	if (err != 0)
+		goto out_close;
+
+	if (fputc('\0', fp) == EOF ||
+	    (strings_size > 1 &&
+	     fwrite(strings + 1, strings_size - 1, 1, fp) != 1))
+		err = -EIO;
+out_close:
+	if (fclose(fp) != 0 && err == 0)
+		err = -errno;
+	if (err != 0)
+		unlink(filename);
+	return err;
+}
+
+int layouts__open(struct layouts *layouts, const char *filename)
+{
+	const struct layouts_header *header;
+	const struct layouts_column *columns;
+	struct stat st;
+	uint32_t i;
+	int fd, err = -EINVAL;
+
+	memset(layouts, 0, sizeof(*layouts));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) != 0) {
+		err = -errno;
+		goto out_close;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header))
+		goto out_close;
+
+	layouts->map_size = st.st_size;
+	layouts->map = mmap(NULL, layouts->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (layouts->map == MAP_FAILED) {
+		err = -errno;
+		layouts->map = NULL;
+		goto out_close;
+	}
+
+	header = layouts->map;
+	if (memcmp(header->magic, LAYOUTS__MAGIC, sizeof(header->magic)) != 0)
+		goto out_unmap;
+
+	if (header->version != LAYOUTS__VERSION ||
+	    header->byte_order != LAYOUTS__BYTE_ORDER) {
+		err = -EPROTO;
+		goto out_unmap;
+	}
+
+	if (header->nr_columns > (layouts->map_size - sizeof(*header)) / sizeof(*columns) ||
+	    header->strings_size == 0 ||
+	    header->strings_offset > layouts->map_size ||
+	    header->strings_size > layouts->map_size - header->strings_offset)
+		goto out_unmap;
+
+	layouts->nr_types     = header->nr_types;
+	layouts->nr_members   = header->nr_members;
+	layouts->strings      = (const char *)layouts->map + header->strings_offset;
+	layouts->strings_size = header->strings_size;
+
+	if (layouts->strings[0] != '\0' ||
+	    layouts->strings[layouts->strings_size - 1] != '\0')
+		goto out_unmap;
+
+	columns = (const void *)((const char *)layouts->map + sizeof(*header));
+	for (i = 0; i < header->nr_columns; ++i) {
+		const struct layouts_column *column = &columns[i];
+		const uint64_t nr_rows = layouts__is_member_column(column->id) ?
+					 layouts->nr_members : layouts->nr_types;
+
+		/* Added after this reader was written? */
+		if (column->id < LAYOUTS_TYPE_NAME || column->id >= LAYOUTS__NR_COLUMNS)
+			continue;
+
+		if (column->elem_size != layouts__elem_size[column->id] ||
+		    column->offset % 8 != 0 || column->offset > layouts->map_size ||
+		    nr_rows * column->elem_size > layouts->map_size - column->offset)
+			goto out_unmap;
+
+		layouts->columns[column->id] = (const char *)layouts->map + column->offset;
+	}
+
+	close(fd);
+	return 0;
+
+out_unmap:
+	munmap(layouts->map, layouts->map_size);
+	memset(layouts, 0, sizeof(*layouts));
+out_close:
+	close(fd);
+	return err;
+}
+
+void layouts__close(struct layouts *layouts)
+{
+	if (layouts->map != NULL)
+		munmap(layouts->map, layouts->map_size);
+	memset(layouts, 0, sizeof(*layouts));
+}
@@ -0,0 +1,132 @@
+#ifndef _DWARVES_LAYOUTS_H_
+#define _DWARVES_LAYOUTS_H_ 1
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Compact columnar export of the struct, union and class layouts, written by
+  pahole --export_layouts, so that tracking sizes, holes and cachelines over
+  many builds is a matter of mapping the files and scanning some arrays,
+  instead of parsing pahole's text output.
+
+  File format, version 1, integers in the byte order of the writer, see
+  layouts_header.byte_order:
+
+    struct layouts_header
+    struct layouts_column[header.nr_columns], the column directory
+    the columns, each at the 8 byte aligned offset in its directory entry,
+    with header.nr_types or header.nr_members entries, see enum
+    layouts_column_id, of elem_size bytes each
+    the string table, header.strings_size bytes of NUL terminated strings,
+    string columns have offsets into it, 0 is the empty string
+
+  The members of each type are consecutive in the member columns, starting
+  at LAYOUTS_TYPE_FIRST_MEMBER. Readers must skip the columns they don't
+  know about, new ones may be added without changing the version.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct class;
+struct cu;
+
+#define LAYOUTS__MAGIC	     "PAHOLELT"
+#define LAYOUTS__VERSION     1
+#define LAYOUTS__BYTE_ORDER  0x01020304
+
+struct layouts_header {
+	char	 magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t nr_columns;
+	uint32_t nr_types;
+	uint32_t nr_members;
+	uint32_t reserved;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+};
+
+struct layouts_column {
+	uint32_t id;
+	uint32_t elem_size;
+	uint64_t offset;
+};
+
+enum layouts_kind {
+	LAYOUTS_KIND__STRUCT = 1,
+	LAYOUTS_KIND__UNION,
+	LAYOUTS_KIND__CLASS,
+};
+
+enum layouts_column_id {
+	/* One entry per type, elem_size in bytes, str is a string offset */
+	LAYOUTS_TYPE_NAME = 1,		/* 4 str, the first typedef if anonymous */
+	LAYOUTS_TYPE_KIND,		/* 1 enum layouts_kind */
+	LAYOUTS_TYPE_SIZE,		/* 4 bytes */
+	LAYOUTS_TYPE_NR_CACHELINES,	/* 4 */
+	LAYOUTS_TYPE_NR_HOLES,		/* 4 */
+	LAYOUTS_TYPE_SUM_HOLES,		/* 4 bytes */
+	LAYOUTS_TYPE_NR_BIT_HOLES,	/* 4 */
+	LAYOUTS_TYPE_SUM_BIT_HOLES,	/* 4 bits */
+	LAYOUTS_TYPE_PADDING,		/* 4 bytes */
+	LAYOUTS_TYPE_BIT_PADDING,	/* 1 bits */
+	LAYOUTS_TYPE_DECL_FILE,		/* 4 str */
+	LAYOUTS_TYPE_DECL_LINE,		/* 4 */
+	LAYOUTS_TYPE_FIRST_MEMBER,	/* 4 index into the member columns */
+	LAYOUTS_TYPE_NR_MEMBERS,	/* 4 */
+	/* One entry per member, including base classes, not the static ones */
+	LAYOUTS_MEMBER_NAME,		/* 4 str, empty for base classes */
+	LAYOUTS_MEMBER_TYPE,		/* 4 str, e.g. "struct list_head", "int[4]" */
+	LAYOUTS_MEMBER_OFFSET,		/* 4 bytes */
+	LAYOUTS_MEMBER_SIZE,		/* 4 bytes */
+	LAYOUTS_MEMBER_BITFIELD_OFFSET,	/* 1 bits, as in pahole's output */
+	LAYOUTS_MEMBER_BITFIELD_SIZE,	/* 1 bits, 0 if not a bitfield */
+	LAYOUTS_MEMBER_HOLE,		/* 4 bytes after it */
+	LAYOUTS_MEMBER_BIT_HOLE,	/* 1 bits after it */
+	LAYOUTS__NR_COLUMNS,
+};
+
+/** struct layouts_writer - collects the layouts, see layouts_writer__write() */
+struct layouts_writer;
+
+struct layouts_writer *layouts_writer__new(void);
+void layouts_writer__delete(struct layouts_writer *writer);
+int layouts_writer__add(struct layouts_writer *writer, struct class *class,
+			const struct cu *cu, uint32_t id);
+int layouts_writer__write(struct layouts_writer *writer, const char *filename);
+
+/** struct layouts - a mapped export, with pointers to its columns
+ * @columns - indexed by enum layouts_column_id, NULL if not in the file
+ */
+struct layouts {
+	void	   *map;
+	size_t	   map_size;
+	uint32_t   nr_types;
+	uint32_t   nr_members;
+	const char *strings;
+	uint64_t   strings_size;
+	const void *columns[LAYOUTS__NR_COLUMNS];
+};
+
+int layouts__open(struct layouts *layouts, const char *filename);
+void layouts__close(struct layouts *layouts);
+
+static inline const uint32_t *layouts__u32(const struct layouts *layouts,
+					   enum layouts_column_id id)
+{
+	return layouts->columns[id];
+}
+
+static inline const uint8_t *layouts__u8(const struct layouts *layouts,
+					 enum layouts_column_id id)
+{
+	return layouts->columns[id];
+}
+
+static inline const char *layouts__string(const struct layouts *layouts,
+					  uint32_t offset)
+{
+	return offset < layouts->strings_size ? layouts->strings + offset : NULL;
+}
+
+#endif /* _DWARVES_LAYOUTS_H_ */
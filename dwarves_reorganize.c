@@ -7,10 +7,18 @@
   Copyright (C) 2007 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "list.h"
 #include "dwarves_reorganize.h"
 #include "dwarves.h"
 
+#define max(x, y) ((x) > (y) ? (x) : (y))
+
 static void class__recalc_holes(struct class *class)
 {
 	class->holes_searched = 0;
@@ -192,13 +200,12 @@ static bool class__move_member(struct class *class, struct class_member *dest,
 	const size_t from_size = from->byte_size;
 	const size_t dest_size = dest->byte_size;
 
-#ifndef BITFIELD_REORG_ALGORITHMS_ENABLED
 	/*
-	 * For now refuse to move a bitfield, we need to first fixup some BRAIN FARTs
+	 * Bitfields are laid out by class__reorganize_bitfields(), moving them
+	 * here would need their types and the ones around them changed too.
 	 */
 	if (from->bitfield_size != 0)
 		return false;
-#endif
 	const bool from_was_last = from->tag.node.next == class__tags(class);
 	struct class_member *tail_from = from;
 	struct class_member *from_prev = list_entry(from->tag.node.prev,
@@ -312,114 +319,6 @@ static bool class__move_member(struct class *class, struct class_member *dest,
 	return true;
 }
 
-#ifdef BITFIELD_REORG_ALGORITHMS_ENABLED
-static struct class_member *
-	class__find_next_bit_hole_of_size(struct class *class,
-					  struct class_member *from,
-					  size_t size)
-{
-	struct class_member *member;
-
-	class__for_each_member_continue(class, from, member) {
-		if (member->tag.tag != DW_TAG_member)
-			continue;
-		if (member->bit_hole != 0 &&
-		    member->bitfield_size <= size)
-		    return member;
-	}
-#if 0
-	/*
-	 * FIXME: Handle the case where the bit padding is on the same bitfield
-	 * that we're looking, i.e. we can't combine a bitfield with itclass,
-	 * perhaps we should tag bitfields with a sequential, clearly marking
-	 * each of the bitfields in advance, so that all the algoriths that
-	 * have to deal with bitfields, moving them around, demoting, etc, can
-	 * be simplified.
-	 */
-	/*
-	 * Now look if the last member is a one member bitfield,
-	 * i.e. if we have bit_padding
-	 */
-	if (class->bit_padding != 0)
-		return type__last_member(&class->type);
-#endif
-	return NULL;
-}
-
-static void class__move_bit_member(struct class *class, const struct cu *cu,
-				   struct class_member *dest,
-				   struct class_member *from,
-				   const int verbose, FILE *fp)
-{
-	struct class_member *from_prev = list_entry(from->tag.node.prev,
-						    struct class_member,
-						    tag.node);
-
-	if (verbose)
-		fprintf(fp, "/* Moving '%s:%u' from after '%s' to "
-			"after '%s:%u' */\n",
-			class_member__name(from, cu), from->bitfield_size,
-			class_member__name(from_prev, cu),
-			class_member__name(dest, cu), dest->bitfield_size);
-	/*
-	 *  Remove 'from' from the list
-	 */
-	list_del(&from->tag.node);
-	/*
-	 * Add from after dest:
-	 */
-	__list_add(&from->tag.node,
-		   &dest->tag.node,
-		   dest->tag.node.next);
-
-	/* Check if this was the last entry in the bitfield */
-	if (from_prev->bitfield_size == 0) {
-		size_t from_size = from->byte_size;
-		/*
-		 * Are we shrinking the struct?
-		 */
-		if (from_size + from->hole >= cu->addr_size) {
-			class->type.size -= from_size + from->hole;
-			class__subtract_offsets_from(class, from_prev,
-						     from_size + from->hole);
-		}
-	}
-	/*
-	 * Tricky, what are the rules for bitfield layouts on this arch?
-	 * Assume its IA32
-	 */
-	from->bitfield_offset = dest->bitfield_offset + dest->bitfield_size;
-	/*
-	 * Now both have the same offset:
-	 */
-	from->byte_offset = dest->byte_offset;
-	from->bit_offset = dest->byte_offset * 8 + from->bitfield_offset;
-
-	class__recalc_holes(class);
-
-	if (verbose > 1) {
-		class__fprintf(class, cu, fp);
-		fputc('\n', fp);
-	}
-}
-
-static void class__demote_bitfield_members(struct class *class,
-					   struct class_member *from,
-					   struct class_member *to,
-					   const struct base_type *old_type,
-					   const struct base_type *new_type,
-					   type_id_t new_type_id)
-{
-	struct class_member *member;
-
-	class__for_each_member_from(class, from, member) {
-		member->byte_size = new_type->bit_size / 8;
-		member->tag.type = new_type_id;
-		if (member == to)
-			break;
-	}
-}
-
 static struct tag *cu__find_base_type_of_size(const struct cu *cu,
 					      const size_t size, type_id_t *id)
 {
@@ -435,13 +334,15 @@ static struct tag *cu__find_base_type_of_size(const struct cu *cu,
 		type_name = "unsigned int";
 		type_name_alt = "unsigned"; break;
 	case sizeof(unsigned long long):
+		/* 'long' is 8 bytes on 64-bit, but the CU may only use 'long long' */
 		if (cu->addr_size == 8) {
-			type_name = "long unsigned int";
-			type_name_alt = "unsigned long";
-		} else {
-			type_name = "long long unsigned int";
-			type_name_alt = "unsigned long long";
+			struct tag *ret = cu__find_base_type_by_name(cu, "long unsigned int", id) ?:
+					  cu__find_base_type_by_name(cu, "unsigned long", id);
+			if (ret != NULL)
+				return ret;
 		}
+		type_name = "long long unsigned int";
+		type_name_alt = "unsigned long long";
 		break;
 	default:
 		return NULL;
@@ -451,280 +352,237 @@ static struct tag *cu__find_base_type_of_size(const struct cu *cu,
 	return ret ?: cu__find_base_type_by_name(cu, type_name_alt, id);
 }
 
-static int class__demote_bitfields(struct class *class, const struct cu *cu,
-				   const int verbose, FILE *fp)
+/*
+ * The signedness of the enum's underlying type, if the loader found one,
+ * e.g. DW_AT_type, -1 if not known.
+ */
+static int enumeration__is_signed(struct type *enumeration, const struct cu *cu)
 {
-	struct class_member *member;
-	struct class_member *bitfield_head = NULL;
-	const struct tag *old_type_tag, *new_type_tag;
-	size_t current_bitfield_size = 0, size, bytes_needed;
-	int some_was_demoted = 0;
-
-	type__for_each_data_member(&class->type, member) {
-		/*
-		 * Check if we are moving away from a bitfield
-		 */
-		if (member->bitfield_size == 0) {
-			current_bitfield_size = 0;
-			bitfield_head = NULL;
-		} else {
-			if (bitfield_head == NULL) {
-				bitfield_head = member;
-				current_bitfield_size = member->bitfield_size;
-			} else if (bitfield_head->byte_offset != member->byte_offset) {
-				/*
-				 * We moved from one bitfield to another, for
-				 * now don't handle this case, just move on to
-				 * the next bitfield, we may well move it to
-				 * another place and then the first bitfield will
-				 * be isolated and will be handled in the next
-				 * pass.
-				 */
-				bitfield_head = member;
-				current_bitfield_size = member->bitfield_size;
-			} else
-				current_bitfield_size += member->bitfield_size;
-		}
-
-		/*
-		 * Have we got to the end of a bitfield with holes?
-		 */
-		if (member->bit_hole == 0)
-			continue;
+	struct tag *type = tag__strip_typedefs_and_modifiers(type__tag(enumeration), cu);
 
-		size = member->byte_size;
-	    	bytes_needed = (current_bitfield_size + 7) / 8;
-		bytes_needed = roundup_pow_of_two(bytes_needed);
-		if (bytes_needed == size)
-			continue;
+	if (type == NULL || type->tag != DW_TAG_base_type)
+		return -1;
 
-		type_id_t new_type_id;
-		old_type_tag = cu__type(cu, member->tag.type);
-		new_type_tag = cu__find_base_type_of_size(cu, bytes_needed,
-							  &new_type_id);
+	return tag__base_type(type)->is_signed;
+}
 
-		if (new_type_tag == NULL) {
-			fprintf(fp, "/* BRAIN FART ALERT! couldn't find a "
-				    "%zd bytes base type */\n\n", bytes_needed);
-			continue;
+/*
+ * The loaders store the enumerator values in 32 bits, negative ones as two's
+ * complement, so take them as signed when the underlying type is, then
+ * { ERR = -1, OK, AGAIN } fits in a signed char, and as unsigned when it is
+ * unsigned, as 0xffffffff needs 4 bytes. When not known, values with bit 31
+ * set could be either, so keep those enums as is. The values of enums wider
+ * than 4 bytes are truncated, so the callers must not use this for them.
+ */
+static size_t enumeration__min_byte_size(struct type *enumeration,
+					 const struct cu *cu)
+{
+	const int is_signed = enumeration__is_signed(enumeration, cu);
+	struct enumerator *pos;
+	int64_t min = 0, max = 0;
+
+	type__for_each_enumerator(enumeration, pos) {
+		int64_t value = pos->value;
+
+		if (pos->value & 0x80000000) {
+			if (is_signed < 0)
+				return enumeration->size / 8;
+			if (is_signed)
+				value = (int32_t)pos->value;
 		}
-		if (verbose) {
-			char old_bf[64], new_bf[64];
-			fprintf(fp, "/* Demoting bitfield ('%s' ... '%s') "
-				"from '%s' to '%s' */\n",
-				class_member__name(bitfield_head, cu),
-				class_member__name(member, cu),
-				base_type__name(tag__base_type(old_type_tag),
-						cu, old_bf, sizeof(old_bf)),
-				base_type__name(tag__base_type(new_type_tag),
-						cu, new_bf, sizeof(new_bf)));
-		}
-
-		class__demote_bitfield_members(class,
-					       bitfield_head, member,
-					       tag__base_type(old_type_tag),
-					       tag__base_type(new_type_tag),
-					       new_type_id);
-		class__recalc_holes(class);
-		some_was_demoted = 1;
 
-		if (verbose > 1) {
-			class__fprintf(class, cu, fp);
-			fputc('\n', fp);
-		}
-	}
-	/*
-	 * Now look if we have bit padding, i.e. if the the last member
-	 * is a bitfield and its the sole member in this bitfield, i.e.
-	 * if it wasn't already demoted as part of a bitfield of more than
-	 * one member:
-	 */
-	member = type__last_member(&class->type);
-	if (class->bit_padding != 0 && bitfield_head == member) {
-		size = member->byte_size;
-		bytes_needed = (member->bitfield_size + 7) / 8;
-		if (bytes_needed < size) {
-			old_type_tag = cu__type(cu, member->tag.type);
-			type_id_t new_type_id;
-			new_type_tag =
-				cu__find_base_type_of_size(cu, bytes_needed,
-							   &new_type_id);
-
-			tag__assert_search_result(old_type_tag);
-			tag__assert_search_result(new_type_tag);
-
-			if (verbose) {
-				char old_bf[64], new_bf[64];
-				fprintf(fp, "/* Demoting bitfield ('%s') "
-					"from '%s' to '%s' */\n",
-					class_member__name(member, cu),
-					base_type__name(tag__base_type(old_type_tag),
-							cu, old_bf, sizeof(old_bf)),
-					base_type__name(tag__base_type(new_type_tag),
-							cu, new_bf, sizeof(new_bf)));
-			}
-			class__demote_bitfield_members(class,
-						       member, member,
-						       tag__base_type(old_type_tag),
-						       tag__base_type(new_type_tag),
-						       new_type_id);
-			class__recalc_holes(class);
-			some_was_demoted = 1;
-
-			if (verbose > 1) {
-				class__fprintf(class, cu, fp);
-				fputc('\n', fp);
-			}
-		}
+		if (value < min)
+			min = value;
+		if (value > max)
+			max = value;
 	}
 
-	return some_was_demoted;
+	if (min >= 0)
+		return max <= UINT8_MAX ? 1 : max <= UINT16_MAX ? 2 : 4;
+
+	return (min >= INT8_MIN && max <= INT8_MAX) ? 1 :
+	       (min >= INT16_MIN && max <= INT16_MAX) ? 2 : 4;
 }
 
-static void class__reorganize_bitfields(struct class *class,
-					const struct cu *cu,
-					const int verbose, FILE *fp)
+/*
+ * Same trick as the one the DWARF loader uses for enum bitfields: a new
+ * enumeration sharing the enumerators, just with a smaller size, so that
+ * the member keeps being printed as 'enum foo'.
+ */
+static struct tag *cu__narrowed_enumeration(struct cu *cu,
+					    const struct type *enumeration,
+					    const uint16_t bit_size,
+					    type_id_t *idp)
 {
-	struct class_member *member, *brother;
-restart:
-	type__for_each_data_member(&class->type, member) {
-		/* See if we have a hole after this member */
-		if (member->bit_hole != 0) {
-			/*
-			 * OK, try to find a member that has a bit hole after
-			 * it and that has a size that fits the current hole:
-			*/
-			brother =
-			   class__find_next_bit_hole_of_size(class, member,
-							     member->bit_hole);
-			if (brother != NULL) {
-				class__move_bit_member(class, cu,
-						       member, brother,
-						       verbose, fp);
-				goto restart;
-			}
-		}
+	struct tag *tag = cu__find_enumeration_by_sname_and_size(cu, enumeration->namespace.name,
+								  bit_size, idp);
+	if (tag != NULL)
+		return tag;
+
+	struct type *new_enum = obstack_alloc(&cu->obstack, sizeof(*new_enum));
+	if (new_enum == NULL)
+		return NULL;
+
+	memcpy(new_enum, enumeration, sizeof(*new_enum));
+	new_enum->namespace.tags.next = enumeration->namespace.shared_tags ?
+						enumeration->namespace.tags.next :
+						(struct list_head *)&enumeration->namespace.tags;
+	new_enum->namespace.shared_tags = 1;
+	new_enum->size = bit_size;
+
+	if (cu__add_tag(cu, &new_enum->namespace.tag, idp) != 0) {
+		obstack_free(&cu->obstack, new_enum);
+		return NULL;
 	}
+
+	return &new_enum->namespace.tag;
 }
 
-static void class__fixup_bitfield_types(struct class *class,
-					struct class_member *from,
-					struct class_member *to_before,
-					type_id_t type)
+/*
+ * Integers used as booleans, i.e. with a typedef named like 'bool', 'BOOL',
+ * 'gboolean', or a boolean base type wider than a byte.
+ */
+static bool class_member__is_bool_like(const struct class_member *member,
+				       const struct cu *cu)
 {
-	struct class_member *member;
+	struct tag *type = cu__type(cu, member->tag.type);
 
-	class__for_each_member_from(class, from, member) {
-		if (member == to_before)
+	while (type != NULL && (tag__is_typedef(type) || tag__is_modifier(type))) {
+		if (tag__is_typedef(type) &&
+		    strcasestr(type__name(tag__type(type), cu) ?: "", "bool") != NULL)
 			break;
-		member->tag.type = type;
+		type = cu__type(cu, type->type);
+	}
+
+	if (type == NULL)
+		return false;
+
+	if (tag__is_typedef(type)) {
+		type = tag__strip_typedefs_and_modifiers(type, cu);
+		return type != NULL && type->tag == DW_TAG_base_type &&
+		       tag__base_type(type)->float_type == 0;
 	}
+
+	return type->tag == DW_TAG_base_type && tag__base_type(type)->is_bool;
 }
 
 /*
- * Think about this pahole output a bit:
- *
- * [filo examples]$ pahole swiss_cheese cheese
- * / * <11b> /home/acme/git/pahole/examples/swiss_cheese.c:3 * /
- * struct cheese {
- * <SNIP>
- *       int         bitfield1:1;   / * 64 4 * /
- *       int         bitfield2:1;   / * 64 4 * /
- *
- *       / * XXX 14 bits hole, try to pack * /
- *       / * Bitfield WARNING: DWARF size=4, real size=2 * /
- *
- *       short int   d;             / * 66 2 * /
- * <SNIP>
+ * 'unsigned char' if there is one, as cu__find_base_type_of_size() does,
+ * else any other integer type of one byte, 'char', '_Bool', etc.
+ */
+static struct tag *cu__find_byte_base_type(const struct cu *cu, type_id_t *idp)
+{
+	struct tag *pos = cu__find_base_type_of_size(cu, 1, idp);
+	uint32_t id;
+
+	if (pos != NULL)
+		return pos;
+
+	cu__for_each_type(cu, id, pos) {
+		if (pos->tag == DW_TAG_base_type &&
+		    tag__base_type(pos)->bit_size == 8 &&
+		    tag__base_type(pos)->float_type == 0) {
+			*idp = id;
+			return pos;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Shrinks the enum members to the smallest size that holds all of their
+ * enumerators and the bool like integers to a byte, so that the
+ * reorganizing routines can then use the holes left behind.
  *
- * The compiler (gcc 4.1.1 20070105 (Red Hat 4.1.1-51) in the above example),
- * Decided to combine what was declared as an int (4 bytes) bitfield but doesn't
- * uses even one byte with the next field, that is a short int (2 bytes),
- * without demoting the type of the bitfield to short int (2 bytes), so in terms
- * of alignment the real size is 2, not 4, to make things easier for the rest of
- * the reorganizing routines we just do the demotion ourselves, fixing up the
- * sizes.
-*/
-static void class__fixup_member_types(struct class *class, const struct cu *cu,
-				      const uint8_t verbose, FILE *fp)
+ * Returns the number of members narrowed or -ENOMEM.
+ */
+int class__narrow_members(struct class *class, struct cu *cu,
+			  const int verbose, FILE *fp)
 {
-	struct class_member *pos, *bitfield_head = NULL;
-	uint8_t fixup_was_done = 0;
+	struct class_member *member;
+	int nr_narrowed = 0;
 
-	type__for_each_data_member(&class->type, pos) {
-		/*
-		 * Is this bitfield member?
-		 */
-		if (pos->bitfield_size != 0) {
-			/*
-			 * The first entry in a bitfield?
-			 */
-			if (bitfield_head == NULL)
-				bitfield_head = pos;
+	class__find_holes(class);
+
+	type__for_each_data_member(&class->type, member) {
+		const size_t size = member->byte_size;
+		struct tag *type, *new_type;
+		type_id_t new_type_id;
+		size_t new_size;
+
+		if (member->bitfield_size != 0 || size <= 1)
 			continue;
-		}
-		/*
-		 * OK, not a bitfield member, but have we just passed
-		 * by a bitfield?
-		 */
-		if (bitfield_head != NULL) {
-			const uint16_t real_size = (pos->byte_offset -
-						  bitfield_head->byte_offset);
-			const size_t size = bitfield_head->byte_size;
-			/*
-			 * Another case:
-struct irq_cfg {
-	struct irq_pin_list *      irq_2_pin;            / *     0     8 * /
-	cpumask_var_t              domain;               / *     8    16 * /
-	cpumask_var_t              old_domain;           / *    24    16 * /
-	u8                         vector;               / *    40     1 * /
-	u8                         move_in_progress:1;   / *    41: 7  1 * /
-	u8                         remapped:1;           / *    41: 6  1 * /
-
-	/ * XXX 6 bits hole, try to pack * /
-	/ * XXX 6 bytes hole, try to pack * /
-
-	union {
-		struct irq_2_iommu irq_2_iommu;          / *          16 * /
-		struct irq_2_irte  irq_2_irte;           / *           4 * /
-	};                                               / *    48    16 * /
-	/ *  --- cacheline 1 boundary (64 bytes) --- * /
-
-			 * So just fix it up if the byte_size of the bitfield is
-			 * greater than what it really uses.
-			 */
-			if (real_size < size) {
-				type_id_t new_type_id;
-				struct tag *new_type_tag =
-					cu__find_base_type_of_size(cu,
-								   real_size,
-								   &new_type_id);
-				if (new_type_tag == NULL) {
-					fprintf(stderr, "%s: couldn't find"
-						" a base_type of %d bytes!\n",
-						__func__, real_size);
-					continue;
-				}
-				class__fixup_bitfield_types(class,
-							    bitfield_head, pos,
-							    new_type_id);
-				fixup_was_done = 1;
-			}
-		}
-		bitfield_head = NULL;
-	}
-	if (fixup_was_done) {
+
+		type = tag__strip_typedefs_and_modifiers(&member->tag, cu);
+		if (type == NULL)
+			continue;
+
+		if (tag__is_enumeration(type)) {
+			/* Can't tell what 8 byte enumerators need, see above */
+			if (tag__type(type)->size > 32)
+				continue;
+			new_size = enumeration__min_byte_size(tag__type(type), cu);
+			if (new_size >= size)
+				continue;
+			new_type = cu__narrowed_enumeration(cu, tag__type(type),
+							    new_size * 8,
+							    &new_type_id);
+			if (new_type == NULL)
+				return -ENOMEM;
+		} else if (class_member__is_bool_like(member, cu)) {
+			new_size = 1;
+			new_type = cu__find_byte_base_type(cu, &new_type_id);
+			if (new_type == NULL)
+				continue;
+		} else
+			continue;
+
+		fprintf(fp, "/* Narrowing '%s' from %zd to %zd byte%s */\n",
+			class_member__name(member, cu), size, new_size,
+			new_size != 1 ? "s" : "");
+
+		member->tag.type = new_type_id;
+		member->byte_size = new_size;
 		class__recalc_holes(class);
-	}
-	if (verbose && fixup_was_done) {
-		fprintf(fp, "/* bitfield types were fixed */\n");
+		++nr_narrowed;
+
 		if (verbose > 1) {
 			class__fprintf(class, cu, fp);
 			fputc('\n', fp);
 		}
 	}
+
+	return nr_narrowed;
+}
+
+static int class__reuse_base_tail_padding(struct class *class,
+					  const struct cu *cu,
+					  const int verbose, FILE *fp);
+static size_t class__bases_end(struct class *class);
+struct reorg_unit;
+static size_t reorg_units__alignment(const struct reorg_unit *units,
+				     int nr_units, struct class *class,
+				     const struct cu *cu);
+
+/*
+ * The padding above comes just from the data members, but the class can't be
+ * smaller than its bases nor lose their alignment, so that an array of it or
+ * a class deriving from it keeps them aligned.
+ */
+static void class__fixup_padding_for_bases(struct class *class,
+					   struct class_member *last_member,
+					   const struct cu *cu)
+{
+	const size_t end = last_member->byte_offset + last_member->byte_size;
+	const size_t min_size = roundup(max(end, class__bases_end(class)),
+					reorg_units__alignment(NULL, 0, class, cu));
+
+	if (class->type.size < min_size) {
+		class->padding	 = min_size - end;
+		class->type.size = min_size;
+	}
 }
-#endif // BITFIELD_REORG_ALGORITHMS_ENABLED
 
 void class__reorganize(struct class *class, const struct cu *cu,
 		       const int verbose, FILE *fp)
@@ -733,11 +591,7 @@ void class__reorganize(struct class *class, const struct cu *cu,
 	size_t alignment_size;
 
 	class__find_holes(class);
-#ifdef BITFIELD_REORG_ALGORITHMS_ENABLED
-	class__fixup_member_types(class, cu, verbose, fp);
-	while (class__demote_bitfields(class, cu, verbose, fp))
-		class__reorganize_bitfields(class, cu, verbose, fp);
-#endif
+	class__reuse_base_tail_padding(class, cu, verbose, fp);
 	/* Now try to combine holes */
 restart:
 	alignment_size = 0;
@@ -776,6 +630,8 @@ restart:
 		}
 	}
 
+	class__fixup_padding_for_bases(class, last_member, cu);
+
 	type__for_each_data_member(&class->type, member) {
 		/* See if we have a hole after this member */
 		if (member->hole != 0) {
@@ -846,3 +702,1147 @@ restart:
 		}
 	}
 }
+
+/*
+ * A member or, for bitfields, all the members sharing the same storage
+ * unit, that have to be moved together.
+ */
+struct reorg_unit {
+	struct class_member *head;
+	uint16_t	    nr_members;
+	uint32_t	    idx;
+	size_t		    size;
+	size_t		    alignment;
+	uint64_t	    weight;
+	size_t		    offset;
+	bool		    placed;
+};
+
+static size_t class_member__alignment(struct class_member *member,
+				      const struct cu *cu)
+{
+	struct tag *type = tag__strip_typedefs_and_modifiers(&member->tag, cu);
+	size_t alignment = type != NULL ? tag__natural_alignment(type, cu) : 1;
+
+	if (member->alignment > alignment)
+		alignment = member->alignment;
+
+	return alignment;
+}
+
+/*
+ * Returns the number of units found, zero if there are no data members or
+ * the layout is one we don't know how to move around safely, or -ENOMEM.
+ */
+static int class__get_reorg_units(struct class *class, const struct cu *cu,
+				  uint64_t (*member_weight)(const struct class_member *member,
+							    const struct cu *cu,
+							    void *priv),
+				  void *priv, struct reorg_unit **punits)
+{
+	struct class_member *pos;
+	struct reorg_unit *units, *unit = NULL;
+	int nr_units = 0, nr_data_members = 0;
+
+	type__for_each_data_member(&class->type, pos)
+		++nr_data_members;
+
+	if (nr_data_members == 0)
+		return 0;
+
+	units = zalloc(nr_data_members * sizeof(*units));
+	if (units == NULL)
+		return -ENOMEM;
+
+	type__for_each_member(&class->type, pos) {
+		/* Leave virtual bases and bases after data members alone */
+		if (pos->tag.tag == DW_TAG_inheritance) {
+			if (unit != NULL || pos->virtuality == DW_VIRTUALITY_virtual)
+				goto out_unsupported;
+			continue;
+		}
+
+		if (pos->is_static)
+			continue;
+
+		if (unit != NULL && pos->bitfield_size != 0 &&
+		    unit->head->bitfield_size != 0 &&
+		    unit->head->byte_offset == pos->byte_offset) {
+			++unit->nr_members;
+			unit->weight += member_weight(pos, cu, priv);
+			continue;
+		}
+
+		if (unit != NULL && pos->byte_offset < unit->head->byte_offset)
+			goto out_unsupported;
+
+		unit = &units[nr_units];
+		unit->head	 = pos;
+		unit->nr_members = 1;
+		unit->idx	 = nr_units++;
+		unit->size	 = pos->byte_size;
+		unit->alignment	 = class_member__alignment(pos, cu);
+		unit->weight	 = member_weight(pos, cu, priv);
+	}
+
+	/*
+	 * Bitfields may share their storage unit with the next member, see
+	 * the comment above class__fixup_member_types(), so use what they
+	 * really use.
+	 */
+	for (int i = 0; i + 1 < nr_units; ++i) {
+		const size_t real_size = units[i + 1].head->byte_offset -
+					 units[i].head->byte_offset;
+
+		if (real_size < units[i].size) {
+			if (units[i].head->bitfield_size == 0)
+				goto out_unsupported;
+			units[i].size = real_size;
+			while (units[i].alignment > 1 &&
+			       (real_size % units[i].alignment) != 0)
+				units[i].alignment /= 2;
+		}
+	}
+
+	*punits = units;
+	return nr_units;
+
+out_unsupported:
+	free(units);
+	return 0;
+}
+
+/*
+ * Where the data members can start: after the bases, or in their tail
+ * padding if they aren't PODs, see class__dsize().
+ */
+static size_t class__reorg_start(struct class *class, const struct cu *cu)
+{
+	struct class_member *pos;
+	size_t start = 0;
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->tag.tag == DW_TAG_inheritance &&
+		    pos->byte_offset + class_member__base_dsize(pos, cu) > start)
+			start = pos->byte_offset + class_member__base_dsize(pos, cu);
+	}
+
+	return start;
+}
+
+/* The class can't be smaller than its bases, tail padding included */
+static size_t class__bases_end(struct class *class)
+{
+	struct class_member *pos;
+	size_t end = 0;
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->tag.tag == DW_TAG_inheritance &&
+		    pos->byte_offset + pos->byte_size > end)
+			end = pos->byte_offset + pos->byte_size;
+	}
+
+	return end;
+}
+
+static size_t reorg_units__alignment(const struct reorg_unit *units,
+				     int nr_units, struct class *class,
+				     const struct cu *cu)
+{
+	size_t alignment = class->type.alignment ?: 1;
+	struct class_member *pos;
+	int i;
+
+	for (i = 0; i < nr_units; ++i)
+		if (units[i].alignment > alignment)
+			alignment = units[i].alignment;
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->tag.tag == DW_TAG_inheritance &&
+		    class_member__alignment(pos, cu) > alignment)
+			alignment = class_member__alignment(pos, cu);
+	}
+
+	return alignment;
+}
+
+/*
+ * Relink the members in the new order, after whatever came before the
+ * first data member, using the offsets in each unit.
+ */
+static void class__relink_reorg_units(struct class *class,
+				      struct reorg_unit *first,
+				      struct reorg_unit **order, int nr_order,
+				      size_t size)
+{
+	struct list_head *prev = first->head->tag.node.prev;
+	int i;
+
+	for (i = 0; i < nr_order; ++i) {
+		struct class_member *member = order[i]->head, *next;
+		uint16_t n = order[i]->nr_members;
+
+		while (n-- != 0) {
+			next = list_entry(member->tag.node.next,
+					  struct class_member, tag.node);
+			member->byte_offset = order[i]->offset;
+			member->bit_offset  = order[i]->offset * 8 +
+					      member->bitfield_offset;
+			list_move(&member->tag.node, prev);
+			prev = &member->tag.node;
+			member = next;
+		}
+	}
+
+	class->type.size = size;
+	class__recalc_holes(class);
+}
+
+static int reorg_unit__hot_cmp(const void *a, const void *b)
+{
+	const struct reorg_unit *ua = *(const struct reorg_unit **)a,
+				*ub = *(const struct reorg_unit **)b;
+
+	if (ua->weight != ub->weight)
+		return ua->weight > ub->weight ? -1 : 1;
+	return ua->idx < ub->idx ? -1 : 1;
+}
+
+/* Biggest alignments first, so that members can be laid out without holes */
+static int reorg_unit__alignment_cmp(const void *a, const void *b)
+{
+	const struct reorg_unit *ua = *(const struct reorg_unit **)a,
+				*ub = *(const struct reorg_unit **)b;
+
+	if (ua->alignment != ub->alignment)
+		return ua->alignment > ub->alignment ? -1 : 1;
+	if (ua->size != ub->size)
+		return ua->size > ub->size ? -1 : 1;
+	return ua->idx < ub->idx ? -1 : 1;
+}
+
+/* Try to use the bytes before 'limit' with cold members */
+static size_t reorg_units__fill_gap(struct reorg_unit **cold, int nr_cold,
+				    size_t offset, size_t limit,
+				    struct reorg_unit **order, int *nr_order)
+{
+	int i;
+
+	for (i = 0; i < nr_cold && offset < limit; ++i) {
+		struct reorg_unit *unit = cold[i];
+		size_t unit_offset;
+
+		if (unit->placed)
+			continue;
+
+		unit_offset = roundup(offset, unit->alignment);
+		if (unit_offset + unit->size > limit)
+			continue;
+
+		unit->offset = unit_offset;
+		unit->placed = true;
+		order[(*nr_order)++] = unit;
+		offset = unit_offset + unit->size;
+	}
+
+	return offset;
+}
+
+/*
+ * Lay out the members with a non zero weight, i.e. the hot ones, in as few
+ * cachelines as possible, the hottest ones first: hot members are assigned,
+ * in decreasing weight order, to the first cacheline where they fit, then
+ * each of these cachelines gets its members laid out with the biggest
+ * alignments first, so that there are no holes, and the gaps before the next
+ * cacheline boundary are filled with cold members. The remaining cold
+ * members follow, again biggest alignments first, zero sized ones, like
+ * flexible arrays, stay at the end.
+ *
+ * This may well make the struct bigger than what class__reorganize()
+ * produces, the goal here is to reduce the cachelines touched in the fast
+ * path, not the struct size.
+ */
+int class__reorganize_by_weight(struct class *class, const struct cu *cu,
+				uint64_t (*member_weight)(const struct class_member *member,
+							  const struct cu *cu,
+							  void *priv),
+				void *priv, const int verbose, FILE *fp)
+{
+	const size_t cacheline_size = dwarves__cacheline_size();
+	struct reorg_unit *units = NULL, **hot, **cold, **order, **line_units;
+	size_t *line_used, offset, max_alignment, bases_end;
+	int *line_of, nr_units, nr_hot = 0, nr_cold = 0, nr_lines = 0,
+	    nr_order = 0, i, line, err = -ENOMEM;
+
+	class__find_holes(class);
+
+	nr_units = class__get_reorg_units(class, cu, member_weight, priv, &units);
+	if (nr_units <= 0)
+		return nr_units;
+
+	hot	  = malloc(nr_units * sizeof(*hot));
+	cold	  = malloc(nr_units * sizeof(*cold));
+	order	   = malloc(nr_units * sizeof(*order));
+	line_units = malloc(nr_units * sizeof(*line_units));
+	line_of	   = malloc(nr_units * sizeof(*line_of));
+	line_used  = malloc(nr_units * sizeof(*line_used));
+	if (hot == NULL || cold == NULL || order == NULL || line_units == NULL ||
+	    line_of == NULL || line_used == NULL)
+		goto out_free;
+
+	offset = class__reorg_start(class, cu);
+	max_alignment = reorg_units__alignment(units, nr_units, class, cu);
+
+	for (i = 0; i < nr_units; ++i) {
+		if (units[i].size == 0)
+			continue;
+		if (units[i].weight != 0)
+			hot[nr_hot++] = &units[i];
+		else
+			cold[nr_cold++] = &units[i];
+	}
+
+	qsort(hot, nr_hot, sizeof(*hot), reorg_unit__hot_cmp);
+	qsort(cold, nr_cold, sizeof(*cold), reorg_unit__alignment_cmp);
+
+	/* First fit decreasing, by weight, hot members into cachelines */
+	for (i = 0; i < nr_hot; ++i) {
+		for (line = 0; line < nr_lines; ++line) {
+			if (line_used[line] + hot[i]->size <= cacheline_size)
+				break;
+		}
+		if (line == nr_lines)
+			line_used[nr_lines++] = 0;
+		line_used[line] += hot[i]->size;
+		line_of[i] = line;
+	}
+
+	for (line = 0; line < nr_lines; ++line) {
+		int nr_line_units = 0;
+		size_t end = offset;
+
+		for (i = 0; i < nr_hot; ++i)
+			if (line_of[i] == line)
+				line_units[nr_line_units++] = hot[i];
+
+		qsort(line_units, nr_line_units, sizeof(*line_units),
+		      reorg_unit__alignment_cmp);
+
+		for (i = 0; i < nr_line_units; ++i)
+			end = roundup(end, line_units[i]->alignment) +
+			      line_units[i]->size;
+		/*
+		 * If the hot members don't fit in what is left of the current
+		 * cacheline, fill it with cold members and start at the next.
+		 */
+		if (offset % cacheline_size != 0 &&
+		    (end - 1) / cacheline_size != offset / cacheline_size) {
+			const size_t next_cacheline = roundup(offset, cacheline_size);
+
+			offset = reorg_units__fill_gap(cold, nr_cold, offset,
+						       next_cacheline,
+						       order, &nr_order);
+			offset = next_cacheline;
+		}
+
+		for (i = 0; i < nr_line_units; ++i) {
+			offset = roundup(offset, line_units[i]->alignment);
+			line_units[i]->offset = offset;
+			line_units[i]->placed = true;
+			order[nr_order++] = line_units[i];
+			offset += line_units[i]->size;
+		}
+
+		if (verbose) {
+			fprintf(fp, "/* Hot cacheline %d:", line);
+			for (i = 0; i < nr_line_units; ++i)
+				fprintf(fp, " '%s'",
+					class_member__name(line_units[i]->head, cu));
+			fputs(" */\n", fp);
+		}
+	}
+
+	for (i = 0; i < nr_cold; ++i) {
+		if (cold[i]->placed)
+			continue;
+		/* Use smaller cold members to fill alignment holes */
+		offset = reorg_units__fill_gap(cold + i + 1, nr_cold - i - 1, offset,
+					       roundup(offset, cold[i]->alignment),
+					       order, &nr_order);
+		offset = roundup(offset, cold[i]->alignment);
+		cold[i]->offset = offset;
+		cold[i]->placed = true;
+		order[nr_order++] = cold[i];
+		offset += cold[i]->size;
+	}
+
+	for (i = 0; i < nr_units; ++i) {
+		if (units[i].size != 0)
+			continue;
+		offset = roundup(offset, units[i].alignment);
+		units[i].offset = offset;
+		order[nr_order++] = &units[i];
+	}
+
+	bases_end = class__bases_end(class);
+	class__relink_reorg_units(class, units, order, nr_order,
+				  roundup(max(offset, bases_end), max_alignment));
+	err = 0;
+out_free:
+	free(line_used);
+	free(line_of);
+	free(line_units);
+	free(order);
+	free(cold);
+	free(hot);
+	free(units);
+	return err;
+}
+
+/*
+ * Number of cachelines touched by the members with a non zero weight.
+ */
+uint32_t class__nr_hot_cachelines(struct class *class, const struct cu *cu,
+				  uint64_t (*member_weight)(const struct class_member *member,
+							    const struct cu *cu,
+							    void *priv),
+				  void *priv)
+{
+	const size_t cacheline_size = dwarves__cacheline_size();
+	struct class_member *pos;
+	uint32_t nr_cachelines = 0;
+	int64_t last_counted = -1;
+
+	type__for_each_data_member(&class->type, pos) {
+		int64_t first, last;
+
+		if (pos->is_static || pos->byte_size == 0 ||
+		    member_weight(pos, cu, priv) == 0)
+			continue;
+
+		first = pos->byte_offset / cacheline_size;
+		last  = (pos->byte_offset + pos->byte_size - 1) / cacheline_size;
+		if (first <= last_counted)
+			first = last_counted + 1;
+		if (last >= first) {
+			nr_cachelines += last - first + 1;
+			last_counted = last;
+		}
+	}
+
+	return nr_cachelines;
+}
+
+static uint64_t member__no_weight(const struct class_member *member __unused,
+				  const struct cu *cu __unused,
+				  void *priv __unused)
+{
+	return 0;
+}
+
+/*
+ * The Itanium C++ ABI lets the members of a derived class go in the tail
+ * padding of a base that isn't a POD, see class__dsize(), so move there the
+ * members that fit, the ones with the biggest alignment first, then lay out
+ * the others after them, in the same order as before.
+ *
+ * Returns 1 if the class got smaller, 0 if not, or -ENOMEM.
+ */
+static int class__reuse_base_tail_padding(struct class *class,
+					  const struct cu *cu,
+					  const int verbose, FILE *fp)
+{
+	struct reorg_unit *units = NULL, **by_alignment = NULL, **order = NULL;
+	size_t start, offset, size, bases_end;
+	int nr_units, nr_by_alignment = 0, nr_order = 0, nr_moved, i, err;
+
+	class__find_holes(class);
+
+	nr_units = class__get_reorg_units(class, cu, member__no_weight, NULL, &units);
+	if (nr_units <= 0)
+		return nr_units;
+
+	err = 0;
+	start = class__reorg_start(class, cu);
+	if (start >= units[0].head->byte_offset)
+		goto out_free;
+
+	err = -ENOMEM;
+	by_alignment = malloc(nr_units * sizeof(*by_alignment));
+	order	     = malloc(nr_units * sizeof(*order));
+	if (by_alignment == NULL || order == NULL)
+		goto out_free;
+
+	for (i = 0; i < nr_units; ++i)
+		if (units[i].size != 0)
+			by_alignment[nr_by_alignment++] = &units[i];
+
+	qsort(by_alignment, nr_by_alignment, sizeof(*by_alignment),
+	      reorg_unit__alignment_cmp);
+
+	offset = reorg_units__fill_gap(by_alignment, nr_by_alignment, start,
+				       units[0].head->byte_offset,
+				       order, &nr_order);
+	nr_moved = nr_order;
+
+	for (i = 0; i < nr_units; ++i) {
+		if (units[i].placed)
+			continue;
+		offset = roundup(offset, units[i].alignment);
+		units[i].offset = offset;
+		order[nr_order++] = &units[i];
+		offset += units[i].size;
+	}
+
+	bases_end = class__bases_end(class);
+	size = roundup(max(offset, bases_end),
+		       reorg_units__alignment(units, nr_units, class, cu));
+	err = 0;
+	if (nr_moved == 0 || size >= class__size(class))
+		goto out_free;
+
+	if (verbose) {
+		for (i = 0; i < nr_moved; ++i)
+			fprintf(fp, "/* Moving '%s' to the tail padding of the base class */\n",
+				class_member__name(order[i]->head, cu));
+	}
+
+	class__relink_reorg_units(class, units, order, nr_order, size);
+	err = 1;
+
+	if (verbose > 1) {
+		class__fprintf(class, cu, fp);
+		fputc('\n', fp);
+	}
+out_free:
+	free(order);
+	free(by_alignment);
+	free(units);
+	return err;
+}
+
+/*
+ * The loaders recode the bitfield types to base types with just the name
+ * and the bitfield size, so go by the name: returns 1 for signed integers,
+ * 0 for unsigned ones and -1 for enums, bools, plain chars, etc, that we
+ * leave with the type they have.
+ */
+static int bitfield__signedness(struct class_member *member,
+				const struct cu *cu)
+{
+	struct tag *type = tag__strip_typedefs_and_modifiers(&member->tag, cu);
+	char bf[64];
+	const char *name;
+
+	if (type == NULL || type->tag != DW_TAG_base_type)
+		return -1;
+
+	name = base_type__name(tag__base_type(type), cu, bf, sizeof(bf));
+	if (name == NULL || strcmp(name, "char") == 0 ||
+	    strstr(name, "bool") != NULL || strstr(name, "Bool") != NULL)
+		return -1;
+
+	if (strstr(name, "unsigned") != NULL)
+		return 0;
+
+	return (strstr(name, "char") != NULL || strstr(name, "short") != NULL ||
+		strstr(name, "int") != NULL || strstr(name, "long") != NULL) ? 1 : -1;
+}
+
+static struct tag *cu__find_signed_base_type_of_size(const struct cu *cu,
+						     const size_t size,
+						     type_id_t *id)
+{
+	const char *type_name, *type_name_alt = NULL;
+
+	switch (size) {
+	case sizeof(signed char):
+		type_name = "signed char"; break;
+	case sizeof(short int):
+		type_name = "short int";
+		type_name_alt = "short"; break;
+	case sizeof(int):
+		type_name = "int"; break;
+	case sizeof(long long):
+		/* See cu__find_base_type_of_size() */
+		if (cu->addr_size == 8) {
+			struct tag *ret = cu__find_base_type_by_name(cu, "long int", id) ?:
+					  cu__find_base_type_by_name(cu, "long", id);
+			if (ret != NULL)
+				return ret;
+		}
+		type_name = "long long int";
+		type_name_alt = "long long";
+		break;
+	default:
+		return NULL;
+	}
+
+	struct tag *ret = cu__find_base_type_by_name(cu, type_name, id);
+	return ret ?: cu__find_base_type_by_name(cu, type_name_alt, id);
+}
+
+/*
+ * A data member or, for bitfields, a bin with the bitfields that will share
+ * storage, that have to be kept together when laying out the class.
+ */
+struct bitfield_reorg_entry {
+	struct class_member *member;
+	type_id_t	    type;
+	size_t		    size;	/* of the type for bitfields */
+	size_t		    alignment;
+	uint32_t	    bit_offset;
+	int		    idx;
+	int		    bin;	/* -1 if not a bitfield */
+};
+
+struct bitfield_reorg_group {
+	size_t alignment;
+	size_t size;
+	int    idx;
+	int    bin;			/* -1 for a single data member */
+};
+
+static int bitfield_reorg_entry__width_cmp(const void *a, const void *b)
+{
+	const struct bitfield_reorg_entry *ea = *(const struct bitfield_reorg_entry **)a,
+					  *eb = *(const struct bitfield_reorg_entry **)b;
+
+	if (ea->member->bitfield_size != eb->member->bitfield_size)
+		return ea->member->bitfield_size > eb->member->bitfield_size ? -1 : 1;
+	return ea->idx < eb->idx ? -1 : 1;
+}
+
+/* Biggest alignments first, zero sized members, like flexible arrays, last */
+static int bitfield_reorg_group__cmp(const void *a, const void *b)
+{
+	const struct bitfield_reorg_group *ga = a, *gb = b;
+
+	if ((ga->size == 0) != (gb->size == 0))
+		return ga->size == 0 ? 1 : -1;
+	if (ga->alignment != gb->alignment)
+		return ga->alignment > gb->alignment ? -1 : 1;
+	if (ga->size != gb->size)
+		return ga->size > gb->size ? -1 : 1;
+	return ga->idx < gb->idx ? -1 : 1;
+}
+
+/*
+ * Lay out the members in 'order' as the SysV ABIs used by GCC and clang on
+ * little endian targets do: a bitfield goes at the next bit unless that
+ * makes it straddle an aligned unit of the size of its type, in which case
+ * it goes to the next one, i.e. in 'char a; int b:4;' 'b' is at bit 8.
+ *
+ * Returns the size of the class.
+ */
+static size_t bitfield_reorg_entries__layout(struct bitfield_reorg_entry **order,
+					     int nr_order, size_t start,
+					     size_t min_size, size_t alignment)
+{
+	size_t bit = start * 8;
+	int i;
+
+	for (i = 0; i < nr_order; ++i) {
+		struct bitfield_reorg_entry *entry = order[i];
+
+		if (entry->bin >= 0) {
+			const size_t unit = entry->size * 8,
+				     width = entry->member->bitfield_size;
+
+			if (bit / unit != (bit + width - 1) / unit)
+				bit = roundup(bit, unit);
+			entry->bit_offset = bit;
+			bit += width;
+		} else {
+			const size_t offset = roundup((bit + 7) / 8, entry->alignment);
+
+			entry->bit_offset = offset * 8;
+			bit = (offset + entry->size) * 8;
+		}
+
+		if (entry->alignment > alignment)
+			alignment = entry->alignment;
+	}
+
+	return roundup(max((bit + 7) / 8, min_size), alignment);
+}
+
+/*
+ * Packs the bitfields, the widest first, in as few 64 bit bins as possible,
+ * each with its integer bitfields retyped to the smallest type that holds
+ * all the bins bits, keeping their signedness, e.g. 'unsigned int a:1' and
+ * 'unsigned long b:3' become 'unsigned char a:1' and 'unsigned char b:3',
+ * then lays out the bins and the other data members, the ones with the
+ * biggest alignment first, computing the offsets as the compiler would, so
+ * that the result can be compiled and checked, see the reorgdiff script.
+ *
+ * The bitfields that are not integers, enums and bools, say, keep their
+ * types and the class is left alone on big endian targets or when it has
+ * virtual bases or bases after data members.
+ *
+ * Returns 1 if the class got smaller, 0 if not, or -ENOMEM.
+ */
+/*
+ * For when the CU has no integer type of the bin size, the widest one used
+ * by the bitfields in the bin with the given signedness, if any.
+ */
+static struct class_member *
+	bitfields__widest_in_bin(struct bitfield_reorg_entry **bitfields,
+				 int nr_bitfields, int bin, int is_signed,
+				 const struct cu *cu)
+{
+	struct class_member *widest = NULL;
+	int i;
+
+	for (i = 0; i < nr_bitfields; ++i) {
+		struct class_member *member = bitfields[i]->member;
+
+		if (bitfields[i]->bin != bin ||
+		    bitfield__signedness(member, cu) != is_signed)
+			continue;
+
+		if (widest == NULL || member->byte_size > widest->byte_size)
+			widest = member;
+	}
+
+	return widest;
+}
+
+int class__reorganize_bitfields(struct class *class, const struct cu *cu,
+				const int verbose, FILE *fp)
+{
+	struct bitfield_reorg_entry *entries = NULL, **bitfields = NULL, **order = NULL;
+	struct bitfield_reorg_group *groups = NULL;
+	uint32_t *bin_bits = NULL;
+	int nr_entries = 0, nr_bitfields = 0, nr_bins = 0, nr_groups = 0,
+	    nr_order = 0, i, k, err;
+	size_t alignment, size;
+	struct class_member *pos;
+	struct list_head *prev;
+	bool seen_data = false;
+
+	if (!cu->little_endian)
+		return 0;
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->tag.tag == DW_TAG_inheritance) {
+			if (seen_data || pos->virtuality == DW_VIRTUALITY_virtual)
+				return 0;
+			continue;
+		}
+		if (pos->is_static)
+			continue;
+		seen_data = true;
+		++nr_entries;
+		if (pos->bitfield_size != 0) {
+			/* See the XXX in class_member__cache_byte_size() */
+			if (pos->byte_size == 0)
+				return 0;
+			++nr_bitfields;
+		}
+	}
+
+	if (nr_bitfields == 0)
+		return 0;
+
+	err = -ENOMEM;
+	entries	  = zalloc(nr_entries * sizeof(*entries));
+	bitfields = malloc(nr_bitfields * sizeof(*bitfields));
+	order	  = malloc(nr_entries * sizeof(*order));
+	groups	  = zalloc(nr_entries * sizeof(*groups));
+	bin_bits  = zalloc(nr_bitfields * sizeof(*bin_bits));
+	if (entries == NULL || bitfields == NULL || order == NULL ||
+	    groups == NULL || bin_bits == NULL)
+		goto out_free;
+
+	i = k = 0;
+	type__for_each_data_member(&class->type, pos) {
+		struct bitfield_reorg_entry *entry;
+
+		if (pos->is_static)
+			continue;
+
+		entry = &entries[i];
+		entry->member = pos;
+		entry->idx    = i++;
+		entry->bin    = -1;
+		entry->type   = pos->tag.type;
+		entry->size   = pos->byte_size;
+		if (pos->bitfield_size != 0) {
+			/* Named bitfields align the class as their types do */
+			entry->alignment = pos->byte_size;
+			if (pos->alignment > entry->alignment)
+				entry->alignment = pos->alignment;
+			bitfields[k++] = entry;
+		} else
+			entry->alignment = class_member__alignment(pos, cu);
+	}
+
+	/* First fit decreasing, the widest bitfields first */
+	qsort(bitfields, nr_bitfields, sizeof(*bitfields),
+	      bitfield_reorg_entry__width_cmp);
+
+	for (i = 0; i < nr_bitfields; ++i) {
+		const uint32_t width = bitfields[i]->member->bitfield_size;
+
+		for (k = 0; k < nr_bins; ++k)
+			if (bin_bits[k] + width <= 64)
+				break;
+		if (k == nr_bins) {
+			groups[nr_groups].bin = nr_bins++;
+			groups[nr_groups].idx = bitfields[i]->idx;
+			++nr_groups;
+		}
+		bin_bits[k] += width;
+		bitfields[i]->bin = k;
+	}
+
+	/* Now the bins become groups, with its integers retyped */
+	for (i = 0; i < nr_groups; ++i) {
+		struct bitfield_reorg_group *group = &groups[i];
+		const size_t bin_size = roundup_pow_of_two((bin_bits[group->bin] + 7) / 8);
+
+		group->size	 = (bin_bits[group->bin] + 7) / 8;
+		group->alignment = 1;
+
+		for (k = 0; k < nr_bitfields; ++k) {
+			struct bitfield_reorg_entry *entry = bitfields[k];
+			const int is_signed = bitfield__signedness(entry->member, cu);
+			type_id_t new_type_id;
+			struct tag *new_type = NULL;
+
+			if (entry->bin != group->bin)
+				continue;
+
+			if (entry->idx < group->idx)
+				group->idx = entry->idx;
+
+			if (is_signed == 1)
+				new_type = cu__find_signed_base_type_of_size(cu, bin_size,
+									     &new_type_id);
+			else if (is_signed == 0)
+				new_type = cu__find_base_type_of_size(cu, bin_size,
+								      &new_type_id);
+			if (new_type != NULL) {
+				entry->type = new_type_id;
+				entry->size = bin_size;
+				entry->alignment = max(bin_size, entry->member->alignment);
+			} else if (is_signed >= 0) {
+				struct class_member *widest =
+					bitfields__widest_in_bin(bitfields, nr_bitfields,
+								 group->bin, is_signed, cu);
+
+				if (widest != NULL && widest->byte_size >= bin_size) {
+					entry->type = widest->tag.type;
+					entry->size = widest->byte_size;
+					entry->alignment = max(widest->byte_size, entry->member->alignment);
+				}
+			}
+
+			if (entry->alignment > group->alignment)
+				group->alignment = entry->alignment;
+		}
+	}
+
+	for (i = 0; i < nr_entries; ++i) {
+		if (entries[i].bin >= 0)
+			continue;
+		groups[nr_groups].bin	    = -1;
+		groups[nr_groups].idx	    = entries[i].idx;
+		groups[nr_groups].size	    = entries[i].size;
+		groups[nr_groups].alignment = entries[i].alignment;
+		++nr_groups;
+	}
+
+	qsort(groups, nr_groups, sizeof(*groups), bitfield_reorg_group__cmp);
+
+	for (i = 0; i < nr_groups; ++i) {
+		if (groups[i].bin < 0) {
+			order[nr_order++] = &entries[groups[i].idx];
+			continue;
+		}
+		for (k = 0; k < nr_bitfields; ++k)
+			if (bitfields[k]->bin == groups[i].bin)
+				order[nr_order++] = bitfields[k];
+	}
+
+	alignment = reorg_units__alignment(NULL, 0, class, cu);
+	size = bitfield_reorg_entries__layout(order, nr_order,
+					      class__reorg_start(class, cu),
+					      class__bases_end(class), alignment);
+	err = 0;
+	if (size >= class__size(class))
+		goto out_free;
+
+	if (verbose) {
+		for (i = 0; i < nr_groups; ++i) {
+			if (groups[i].bin < 0)
+				continue;
+			fputs("/* Packing bitfields", fp);
+			for (k = 0; k < nr_bitfields; ++k)
+				if (bitfields[k]->bin == groups[i].bin)
+					fprintf(fp, " '%s:%u'",
+						class_member__name(bitfields[k]->member, cu),
+						bitfields[k]->member->bitfield_size);
+			fprintf(fp, " in %zd byte%s */\n", groups[i].size,
+				groups[i].size != 1 ? "s" : "");
+		}
+	}
+
+	prev = entries[0].member->tag.node.prev;
+
+	for (i = 0; i < nr_order; ++i) {
+		struct bitfield_reorg_entry *entry = order[i];
+		struct class_member *member = entry->member;
+
+		list_move(&member->tag.node, prev);
+		prev = &member->tag.node;
+
+		member->bit_offset = entry->bit_offset;
+		if (entry->bin < 0) {
+			member->byte_offset = entry->bit_offset / 8;
+			continue;
+		}
+
+		member->tag.type	= entry->type;
+		member->byte_size	= entry->size;
+		member->bit_size	= entry->size * 8;
+		member->byte_offset	= entry->bit_offset / member->bit_size * entry->size;
+		member->bitfield_offset = entry->bit_offset - member->byte_offset * 8;
+	}
+
+	class->type.size = size;
+	class__recalc_holes(class);
+	err = 1;
+
+	if (verbose > 1) {
+		class__fprintf(class, cu, fp);
+		fputc('\n', fp);
+	}
+out_free:
+	free(bin_bits);
+	free(groups);
+	free(order);
+	free(bitfields);
+	free(entries);
+	return err;
+}
+
+/*
+ * Members with the same size and alignment are interchangeable as far as
+ * the struct size goes, so search thru sequences of these kinds, not of
+ * members, to avoid exploring permutations that produce the same layout.
+ */
+struct reorg_kind {
+	size_t size;
+	size_t alignment;
+	int    nr_units;
+	int    nr_left;
+};
+
+struct reorg_search {
+	struct reorg_kind *kinds;
+	int		  nr_kinds;
+	int		  depth;
+	int		  *path;
+	int		  *best_path;
+	size_t		  best_size;
+	size_t		  min_size;
+	size_t		  alignment;
+	size_t		  lower_bound;
+	uint64_t	  nr_nodes;
+	struct timespec	  deadline;
+	bool		  timed_out;
+};
+
+static bool reorg_search__timed_out(struct reorg_search *search)
+{
+	struct timespec now;
+
+	/* Don't call clock_gettime() for every node */
+	if (search->timed_out || (++search->nr_nodes & 1023) != 0)
+		return search->timed_out;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > search->deadline.tv_sec ||
+	    (now.tv_sec == search->deadline.tv_sec &&
+	     now.tv_nsec >= search->deadline.tv_nsec))
+		search->timed_out = true;
+
+	return search->timed_out;
+}
+
+static void reorg_search__dfs(struct reorg_search *search, int level,
+			      size_t offset, size_t size_left)
+{
+	int i;
+
+	if (level == search->depth) {
+		const size_t size = roundup(max(offset, search->min_size),
+					    search->alignment);
+
+		if (size < search->best_size) {
+			search->best_size = size;
+			memcpy(search->best_path, search->path,
+			       search->depth * sizeof(*search->path));
+		}
+		return;
+	}
+
+	/* Can't be better than what we have even if there are no more holes */
+	if (roundup(offset + size_left, search->alignment) >= search->best_size)
+		return;
+
+	if (reorg_search__timed_out(search))
+		return;
+
+	for (i = 0; i < search->nr_kinds; ++i) {
+		struct reorg_kind *kind = &search->kinds[i];
+
+		if (kind->nr_left == 0)
+			continue;
+
+		--kind->nr_left;
+		search->path[level] = i;
+		reorg_search__dfs(search, level + 1,
+				  roundup(offset, kind->alignment) + kind->size,
+				  size_left - kind->size);
+		++kind->nr_left;
+
+		/* Proven optimal, no holes at all */
+		if (search->best_size == search->lower_bound)
+			return;
+	}
+}
+
+/*
+ * Branch and bound search for the layout with the smallest size, within
+ * 'budget_ms' milliseconds, for the struct as laid out by, say,
+ * class__reorganize(), that is used as the initial upper bound, i.e. if
+ * the search can't find something smaller in time, the class is left as
+ * is.
+ *
+ * Returns 1 if a smaller layout was found and applied, 0 if not, or
+ * -ENOMEM.
+ */
+int class__reorganize_exact(struct class *class, const struct cu *cu,
+			    unsigned int budget_ms, const int verbose, FILE *fp)
+{
+	struct reorg_search search = { .nr_kinds = 0, };
+	struct reorg_unit *units = NULL, **order = NULL;
+	size_t start, offset, size_left = 0;
+	int nr_units, nr_order = 0, i, k, err = -ENOMEM;
+
+	class__find_holes(class);
+
+	nr_units = class__get_reorg_units(class, cu, member__no_weight, NULL, &units);
+	if (nr_units <= 0)
+		return nr_units;
+
+	search.kinds	 = zalloc(nr_units * sizeof(*search.kinds));
+	search.path	 = malloc(nr_units * sizeof(*search.path));
+	search.best_path = malloc(nr_units * sizeof(*search.best_path));
+	order		 = malloc(nr_units * sizeof(*order));
+	if (search.kinds == NULL || search.path == NULL ||
+	    search.best_path == NULL || order == NULL)
+		goto out_free;
+
+	for (i = 0; i < nr_units; ++i) {
+		if (units[i].size == 0)
+			continue;
+
+		for (k = 0; k < search.nr_kinds; ++k)
+			if (search.kinds[k].size == units[i].size &&
+			    search.kinds[k].alignment == units[i].alignment)
+				break;
+
+		if (k == search.nr_kinds) {
+			search.kinds[k].size	  = units[i].size;
+			search.kinds[k].alignment = units[i].alignment;
+			++search.nr_kinds;
+		}
+		++search.kinds[k].nr_units;
+		++search.depth;
+		size_left += units[i].size;
+	}
+
+	/* Biggest alignments first, that is what most probably is optimal */
+	for (i = 1; i < search.nr_kinds; ++i) {
+		struct reorg_kind kind = search.kinds[i];
+
+		for (k = i; k > 0 &&
+		     (search.kinds[k - 1].alignment < kind.alignment ||
+		      (search.kinds[k - 1].alignment == kind.alignment &&
+		       search.kinds[k - 1].size < kind.size)); --k)
+			search.kinds[k] = search.kinds[k - 1];
+		search.kinds[k] = kind;
+	}
+
+	for (k = 0; k < search.nr_kinds; ++k)
+		search.kinds[k].nr_left = search.kinds[k].nr_units;
+
+	start		   = class__reorg_start(class, cu);
+	search.min_size	   = class__bases_end(class);
+	search.alignment   = reorg_units__alignment(units, nr_units, class, cu);
+	search.lower_bound = roundup(max(start + size_left, search.min_size),
+				     search.alignment);
+	search.best_size   = class__size(class);
+
+	clock_gettime(CLOCK_MONOTONIC, &search.deadline);
+	search.deadline.tv_sec  += budget_ms / 1000;
+	search.deadline.tv_nsec += (budget_ms % 1000) * 1000000L;
+	if (search.deadline.tv_nsec >= 1000000000L) {
+		++search.deadline.tv_sec;
+		search.deadline.tv_nsec -= 1000000000L;
+	}
+
+	if (search.lower_bound < search.best_size)
+		reorg_search__dfs(&search, 0, start, size_left);
+
+	if (verbose)
+		fprintf(fp, "/* Exact reorganization: %zd bytes, lower bound %zd, "
+			"%" PRIu64 " nodes searched%s */\n",
+			search.best_size, search.lower_bound, search.nr_nodes,
+			search.timed_out ? ", timed out" : "");
+
+	err = 0;
+	if (search.best_size >= class__size(class))
+		goto out_free;
+
+	/* Now assign the members of each kind, in the original order */
+	offset = start;
+	for (i = 0; i < search.depth; ++i) {
+		const struct reorg_kind *kind = &search.kinds[search.best_path[i]];
+
+		for (k = 0; k < nr_units; ++k) {
+			if (!units[k].placed && units[k].size == kind->size &&
+			    units[k].alignment == kind->alignment)
+				break;
+		}
+
+		offset = roundup(offset, kind->alignment);
+		units[k].offset = offset;
+		units[k].placed = true;
+		order[nr_order++] = &units[k];
+		offset += kind->size;
+	}
+
+	/* Zero sized members, like flexible arrays, stay at the end */
+	for (i = 0; i < nr_units; ++i) {
+		if (units[i].size != 0)
+			continue;
+		units[i].offset = roundup(offset, units[i].alignment);
+		order[nr_order++] = &units[i];
+	}
+
+	class__relink_reorg_units(class, units, order, nr_order,
+				  search.best_size);
+	err = 1;
+out_free:
+	free(order);
+	free(search.best_path);
+	free(search.path);
+	free(search.kinds);
+	free(units);
+	return err;
+}
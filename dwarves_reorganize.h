@@ -27,4 +27,25 @@ void class__fixup_alignment(struct class *cls, const struct cu *cu);
 void class__reorganize(struct class *cls, const struct cu *cu,
 		       const int verbose, FILE *fp);
 
+int class__narrow_members(struct class *cls, struct cu *cu,
+			  const int verbose, FILE *fp);
+
+int class__reorganize_bitfields(struct class *cls, const struct cu *cu,
+				const int verbose, FILE *fp);
+
+int class__reorganize_by_weight(struct class *cls, const struct cu *cu,
+				uint64_t (*member_weight)(const struct class_member *member,
+							  const struct cu *cu,
+							  void *priv),
+				void *priv, const int verbose, FILE *fp);
+
+int class__reorganize_exact(struct class *cls, const struct cu *cu,
+			    unsigned int budget_ms, const int verbose, FILE *fp);
+
+uint32_t class__nr_hot_cachelines(struct class *cls, const struct cu *cu,
+				  uint64_t (*member_weight)(const struct class_member *member,
+							    const struct cu *cu,
+							    void *priv),
+				  void *priv);
+
 #endif /* _DWARVES_REORGANIZE_H_ */
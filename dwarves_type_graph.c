@@ -0,0 +1,502 @@
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Reference graph of the named types in a binary, see dwarves_type_graph.h.
+*/
+
+#include <dwarf.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dwarves_type_graph.h"
+#include "dwarves.h"
+#include "dutil.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+struct type_graph *type_graph__new(void)
+{
+	struct type_graph *graph = zalloc(sizeof(*graph));
+
+	if (graph == NULL)
+		return NULL;
+
+	graph->nr_buckets = 1024;
+	graph->buckets = malloc(graph->nr_buckets * sizeof(*graph->buckets));
+	if (graph->buckets == NULL) {
+		free(graph);
+		return NULL;
+	}
+
+	memset(graph->buckets, 0xff, graph->nr_buckets * sizeof(*graph->buckets));
+	obstack_init(&graph->names);
+	return graph;
+}
+
+void type_graph__delete(struct type_graph *graph)
+{
+	if (graph == NULL)
+		return;
+
+	obstack_free(&graph->names, NULL);
+	free(graph->buckets);
+	free(graph->nodes);
+	free(graph->refs);
+	free(graph);
+}
+
+static uint32_t type_graph__hash(const char *name, enum type_graph_node_kind kind)
+{
+	uint32_t hash = 2166136261u ^ kind;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+	return hash;
+}
+
+uint32_t type_graph__find(const struct type_graph *graph, const char *name,
+			  enum type_graph_node_kind kind)
+{
+	const uint32_t mask = graph->nr_buckets - 1;
+	uint32_t bucket = type_graph__hash(name, kind) & mask;
+
+	while (graph->buckets[bucket] != TYPE_GRAPH__NONE) {
+		const struct type_graph_node *node = &graph->nodes[graph->buckets[bucket]];
+
+		if (node->kind == kind && strcmp(node->name, name) == 0)
+			return graph->buckets[bucket];
+
+		bucket = (bucket + 1) & mask;
+	}
+
+	return TYPE_GRAPH__NONE;
+}
+
+static int type_graph__grow_buckets(struct type_graph *graph)
+{
+	const uint32_t nr_buckets = graph->nr_buckets * 2;
+	uint32_t *buckets = malloc(nr_buckets * sizeof(*buckets)), i;
+
+	if (buckets == NULL)
+		return -ENOMEM;
+
+	memset(buckets, 0xff, nr_buckets * sizeof(*buckets));
+
+	for (i = 0; i < graph->nr_nodes; ++i) {
+		const struct type_graph_node *node = &graph->nodes[i];
+		uint32_t bucket = type_graph__hash(node->name, node->kind) & (nr_buckets - 1);
+
+		while (buckets[bucket] != TYPE_GRAPH__NONE)
+			bucket = (bucket + 1) & (nr_buckets - 1);
+
+		buckets[bucket] = i;
+	}
+
+	free(graph->buckets);
+	graph->buckets	  = buckets;
+	graph->nr_buckets = nr_buckets;
+	return 0;
+}
+
+/* Returns the index of the node for name, adding it if needed */
+static uint32_t type_graph__node(struct type_graph *graph, const char *name,
+				 enum type_graph_node_kind kind)
+{
+	uint32_t idx = type_graph__find(graph, name, kind), bucket;
+	struct type_graph_node *node;
+
+	if (idx != TYPE_GRAPH__NONE)
+		return idx;
+
+	if (graph->nr_nodes == graph->allocated_nodes) {
+		uint32_t allocated = graph->allocated_nodes ? graph->allocated_nodes * 2 : 1024;
+		struct type_graph_node *nodes = realloc(graph->nodes, allocated * sizeof(*nodes));
+
+		if (nodes == NULL)
+			return TYPE_GRAPH__NONE;
+
+		graph->nodes	       = nodes;
+		graph->allocated_nodes = allocated;
+	}
+
+	/* Keep the load factor under 1/2 */
+	if ((graph->nr_nodes + 1) * 2 > graph->nr_buckets &&
+	    type_graph__grow_buckets(graph) != 0)
+		return TYPE_GRAPH__NONE;
+
+	idx  = graph->nr_nodes;
+	node = &graph->nodes[idx];
+	memset(node, 0, sizeof(*node));
+	node->name = obstack_copy0(&graph->names, name, strlen(name));
+	if (node->name == NULL)
+		return TYPE_GRAPH__NONE;
+	node->kind	= kind;
+	node->first_ref = node->last_ref = TYPE_GRAPH__NONE;
+
+	bucket = type_graph__hash(name, kind) & (graph->nr_buckets - 1);
+	while (graph->buckets[bucket] != TYPE_GRAPH__NONE)
+		bucket = (bucket + 1) & (graph->nr_buckets - 1);
+	graph->buckets[bucket] = idx;
+
+	++graph->nr_nodes;
+	return idx;
+}
+
+static int type_graph__add_ref(struct type_graph *graph, uint32_t from, uint32_t to,
+			       enum type_ref_kind kind, const char *name,
+			       uint32_t offset, uint32_t nr_elements)
+{
+	struct type_graph_node *node = &graph->nodes[to];
+	struct type_ref *ref;
+
+	if (graph->nr_refs == graph->allocated_refs) {
+		uint32_t allocated = graph->allocated_refs ? graph->allocated_refs * 2 : 4096;
+		struct type_ref *refs = realloc(graph->refs, allocated * sizeof(*refs));
+
+		if (refs == NULL)
+			return -ENOMEM;
+
+		graph->refs	      = refs;
+		graph->allocated_refs = allocated;
+	}
+
+	ref = &graph->refs[graph->nr_refs];
+	ref->from	 = from;
+	ref->next	 = TYPE_GRAPH__NONE;
+	ref->offset	 = offset;
+	ref->nr_elements = nr_elements;
+	ref->kind	 = kind;
+	ref->name	 = NULL;
+	if (name != NULL) {
+		ref->name = obstack_copy0(&graph->names, name, strlen(name));
+		if (ref->name == NULL)
+			return -ENOMEM;
+	}
+
+	if (node->last_ref == TYPE_GRAPH__NONE)
+		node->first_ref = graph->nr_refs;
+	else
+		graph->refs[node->last_ref].next = graph->nr_refs;
+	node->last_ref = graph->nr_refs;
+
+	++graph->nr_refs;
+	return 0;
+}
+
+static bool tag__is_struct_or_union(const struct tag *tag)
+{
+	return tag__is_struct(tag) || tag__is_union(tag);
+}
+
+/*
+ * Follows modifiers, arrays and a pointer to the struct or union, or typedef
+ * of one, that a member or parameter refers to. Returns NULL for anything
+ * else. Anonymous structs and unions are returned as well, so that their
+ * members can be flattened into the type being processed.
+ */
+static struct tag *tag__ref_target(struct tag *type, const struct cu *cu,
+				   uint32_t *nr_elements, bool *pointer)
+{
+	*nr_elements = 1;
+	*pointer = false;
+
+	while (type != NULL) {
+		if (tag__is_modifier(type)) {
+			type = cu__type(cu, type->type);
+		} else if (type->tag == DW_TAG_array_type) {
+			const struct array_type *at = tag__array_type(type);
+			int i;
+
+			for (i = 0; i < at->dimensions; ++i)
+				*nr_elements *= at->nr_entries[i];
+			type = cu__type(cu, type->type);
+		} else if (tag__is_pointer(type)) {
+			if (*pointer)
+				return NULL;
+			*pointer = true;
+			type = cu__type(cu, type->type);
+		} else if (tag__is_typedef(type)) {
+			struct tag *real_type = tag__strip_typedefs_and_modifiers(type, cu);
+
+			if (real_type == NULL || !tag__is_struct_or_union(real_type))
+				return NULL;
+			return type;
+		} else
+			return tag__is_struct_or_union(type) ? type : NULL;
+	}
+
+	return NULL;
+}
+
+static int type_graph__add_member_refs(struct type_graph *graph, uint32_t from,
+				       struct type *type, struct cu *cu,
+				       uint32_t offset)
+{
+	struct class_member *member;
+
+	type__for_each_member(type, member) {
+		uint32_t nr_elements, to;
+		bool pointer;
+		struct tag *target;
+		const char *name;
+
+		if (member->is_static)
+			continue;
+
+		target = tag__ref_target(cu__type(cu, member->tag.type), cu,
+					 &nr_elements, &pointer);
+		if (target == NULL)
+			continue;
+
+		name = type__name(tag__type(target), cu);
+		if (name == NULL) {
+			/* Anonymous struct or union, its members are ours */
+			if (pointer || nr_elements != 1)
+				continue;
+			if (type_graph__add_member_refs(graph, from, tag__type(target), cu,
+							offset + member->byte_offset) != 0)
+				return -ENOMEM;
+			continue;
+		}
+
+		to = type_graph__node(graph, name, tag__is_typedef(target) ?
+				      TYPE_GRAPH__TYPEDEF : TYPE_GRAPH__STRUCT);
+		if (to == TYPE_GRAPH__NONE ||
+		    type_graph__add_ref(graph, from, to,
+					pointer ? TYPE_REF__POINTS_TO : TYPE_REF__EMBEDS,
+					class_member__name(member, cu),
+					offset + member->byte_offset, nr_elements) != 0)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Returns the node to add the references from type to, or TYPE_GRAPH__NONE if it was already added */
+static uint32_t type_graph__define(struct type_graph *graph, const char *name,
+				   enum type_graph_node_kind kind, struct tag *tag,
+				   struct cu *cu, int *err)
+{
+	uint32_t idx = type_graph__node(graph, name, kind);
+	struct type_graph_node *node;
+
+	if (idx == TYPE_GRAPH__NONE) {
+		*err = -ENOMEM;
+		return TYPE_GRAPH__NONE;
+	}
+
+	node = &graph->nodes[idx];
+	if (node->defined)
+		return TYPE_GRAPH__NONE;
+
+	node->defined = true;
+	node->tag     = tag;
+	node->cu      = cu;
+	node->size    = tag__is_function(tag) ? 0 : tag__size(tag, cu);
+	node->packed_size = node->size;
+	if (tag__is_struct(tag))
+		node->packed_size = class__packed_size(tag__class(tag), cu);
+	return idx;
+}
+
+/*
+ * Adds the references from the named structs, unions, typedefs and functions
+ * in cu not yet in the graph, i.e. the first definition of each, by name, is
+ * the one used. If filter returns false for a struct or union its references
+ * aren't added.
+ */
+int type_graph__add_cu(struct type_graph *graph, struct cu *cu,
+		       bool (*filter)(struct class *cls, struct cu *cu,
+				      uint32_t id, void *priv),
+		       void *priv)
+{
+	struct function *function;
+	struct tag *pos;
+	uint32_t id;
+	int err = 0;
+
+	cu__for_each_type(cu, id, pos) {
+		uint32_t from, to, nr_elements;
+		struct tag *target;
+		const char *name;
+		bool pointer;
+
+		if (tag__is_struct_or_union(pos)) {
+			struct class *cls = tag__class(pos);
+
+			name = class__name(cls, cu);
+			if (name == NULL || class__is_declaration(cls) ||
+			    (filter != NULL && !filter(cls, cu, id, priv)))
+				continue;
+
+			from = type_graph__define(graph, name, TYPE_GRAPH__STRUCT, pos, cu, &err);
+			if (from != TYPE_GRAPH__NONE)
+				err = type_graph__add_member_refs(graph, from, &cls->type, cu, 0);
+		} else if (tag__is_typedef(pos)) {
+			name = type__name(tag__type(pos), cu);
+			if (name == NULL)
+				continue;
+
+			target = tag__ref_target(cu__type(cu, pos->type), cu, &nr_elements, &pointer);
+			if (target == NULL || pointer || nr_elements != 1)
+				continue;
+
+			from = type_graph__define(graph, name, TYPE_GRAPH__TYPEDEF, pos, cu, &err);
+			if (from == TYPE_GRAPH__NONE)
+				goto next;
+
+			if (type__name(tag__type(target), cu) == NULL) {
+				/* typedef struct { ... } foo_t; foo_t stands for the struct */
+				if (tag__is_struct_or_union(target) &&
+				    (filter == NULL || filter(tag__class(target), cu, pos->type, priv))) {
+					graph->nodes[from].packed_size = class__packed_size(tag__class(target), cu);
+					err = type_graph__add_member_refs(graph, from,
+									  tag__type(target), cu, 0);
+				}
+				goto next;
+			}
+
+			graph->nodes[from].alias = true;
+			to = type_graph__node(graph, type__name(tag__type(target), cu),
+					      tag__is_typedef(target) ?
+					      TYPE_GRAPH__TYPEDEF : TYPE_GRAPH__STRUCT);
+			if (to == TYPE_GRAPH__NONE)
+				err = -ENOMEM;
+			else
+				err = type_graph__add_ref(graph, from, to, TYPE_REF__TYPEDEF,
+							  NULL, 0, 1);
+		}
+next:
+		if (err != 0)
+			return err;
+	}
+
+	cu__for_each_function(cu, id, function) {
+		struct parameter *parameter;
+		const char *name = function__name(function, cu);
+		uint32_t from;
+
+		if (name == NULL)
+			continue;
+
+		from = type_graph__define(graph, name, TYPE_GRAPH__FUNCTION,
+					  &function->proto.tag, cu, &err);
+		if (from == TYPE_GRAPH__NONE) {
+			if (err != 0)
+				return err;
+			continue;
+		}
+
+		function__for_each_parameter(function, cu, parameter) {
+			uint32_t nr_elements, to;
+			struct tag *target;
+			bool pointer;
+
+			target = tag__ref_target(cu__type(cu, parameter->tag.type), cu,
+						 &nr_elements, &pointer);
+			if (target == NULL || type__name(tag__type(target), cu) == NULL)
+				continue;
+
+			to = type_graph__node(graph, type__name(tag__type(target), cu),
+					      tag__is_typedef(target) ?
+					      TYPE_GRAPH__TYPEDEF : TYPE_GRAPH__STRUCT);
+			if (to == TYPE_GRAPH__NONE ||
+			    type_graph__add_ref(graph, from, to, TYPE_REF__PARAMETER,
+						parameter__name(parameter, cu), 0, 1) != 0)
+				return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+const char *type_ref__kind_name(const struct type_ref *ref)
+{
+	switch (ref->kind) {
+	case TYPE_REF__EMBEDS:	   return "embeds";
+	case TYPE_REF__POINTS_TO:  return "points_to";
+	case TYPE_REF__TYPEDEF:	   return "typedef";
+	case TYPE_REF__PARAMETER:  return "parameter";
+	}
+
+	return "unknown";
+}
+
+static uint64_t weight__add(uint64_t a, uint64_t b)
+{
+	return a + b < a ? UINT64_MAX : a + b;
+}
+
+static uint64_t weight__mul(uint64_t a, uint64_t b)
+{
+	return b != 0 && a > UINT64_MAX / b ? UINT64_MAX : a * b;
+}
+
+enum {
+	WEIGHT__UNVISITED,
+	WEIGHT__VISITING,
+	WEIGHT__DONE,
+};
+
+static uint64_t type_graph__weight(const struct type_graph *graph, uint32_t idx,
+				   uint64_t *weights, uint8_t *state)
+{
+	const struct type_graph_node *node = &graph->nodes[idx];
+	const struct type_ref *ref;
+	uint64_t weight;
+
+	if (state[idx] == WEIGHT__DONE)
+		return weights[idx];
+	/* Same named types with different definitions may form cycles */
+	if (state[idx] == WEIGHT__VISITING)
+		return 0;
+
+	state[idx] = WEIGHT__VISITING;
+
+	weight = node->kind == TYPE_GRAPH__FUNCTION || node->alias ? 0 : 1;
+
+	type_graph__for_each_ref(graph, node, ref) {
+		if (ref->kind == TYPE_REF__EMBEDS)
+			weight = weight__add(weight,
+					     weight__mul(ref->nr_elements,
+							 type_graph__weight(graph, ref->from,
+									    weights, state)));
+		else if (ref->kind == TYPE_REF__TYPEDEF)
+			weight = weight__add(weight, type_graph__weight(graph, ref->from,
+									 weights, state));
+	}
+
+	weights[idx] = weight;
+	state[idx] = WEIGHT__DONE;
+	return weight;
+}
+
+/*
+ * How many instances of each node there are in one instance of each type
+ * in the graph: one for the type itself plus, for each container, the
+ * number of array elements times the container weight. Typedefs of named
+ * types pass the weight of their containers to the type. A struct that is
+ * 8 bytes smaller thus saves 8 bytes times its weight over all types.
+ */
+int type_graph__containment_weights(const struct type_graph *graph, uint64_t **pweights)
+{
+	uint64_t *weights = malloc(graph->nr_nodes * sizeof(*weights));
+	uint8_t *state = zalloc(graph->nr_nodes);
+	uint32_t i;
+
+	if (weights == NULL || state == NULL) {
+		free(weights);
+		free(state);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < graph->nr_nodes; ++i)
+		type_graph__weight(graph, i, weights, state);
+
+	free(state);
+	*pweights = weights;
+	return 0;
+}
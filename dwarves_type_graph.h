@@ -0,0 +1,112 @@
+#ifndef _DWARVES_TYPE_GRAPH_H_
+#define _DWARVES_TYPE_GRAPH_H_ 1
+/*
+  SPDX-License-Identifier: GPL-2.0-only
+
+  Who refers to each type in a binary: the structs and unions that embed it
+  or have pointers to it, its typedefs and the functions that take it as a
+  parameter, built in one pass over all the CUs, so that questions like
+  "what contains struct page" don't need to rescan every CU.
+*/
+
+#include <obstack.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct class;
+struct cu;
+struct tag;
+
+#define TYPE_GRAPH__NONE UINT32_MAX
+
+enum type_graph_node_kind {
+	TYPE_GRAPH__STRUCT,	/* structs, unions and classes */
+	TYPE_GRAPH__TYPEDEF,
+	TYPE_GRAPH__FUNCTION,
+};
+
+enum type_ref_kind {
+	TYPE_REF__EMBEDS,	/* a member of that type or an array of it */
+	TYPE_REF__POINTS_TO,	/* a member that is a pointer to that type */
+	TYPE_REF__TYPEDEF,	/* a typedef of that type */
+	TYPE_REF__PARAMETER,	/* a parameter of that type or a pointer to it */
+};
+
+/** struct type_ref - a reference to a type_graph_node
+ * @from - index of the referring node
+ * @next - index of the next reference to the same node, or TYPE_GRAPH__NONE
+ * @name - member or parameter name, if any
+ * @offset - byte offset of the member, for TYPE_REF__EMBEDS and TYPE_REF__POINTS_TO
+ * @nr_elements - number of array elements, 1 if not an array
+ * @kind - enum type_ref_kind
+ */
+struct type_ref {
+	uint32_t   from;
+	uint32_t   next;
+	const char *name;
+	uint32_t   offset;
+	uint32_t   nr_elements;
+	uint8_t	   kind;
+};
+
+/** struct type_graph_node - a named struct, union, typedef or function
+ * @tag - first definition found, only valid while @cu is loaded
+ * @packed_size - size without holes and padding, see class__packed_size()
+ * @first_ref - references to this node, in the order they were found
+ * @defined - the references from this node to other ones were added
+ * @alias - a typedef of another named type, i.e. not a type on its own
+ */
+struct type_graph_node {
+	const char *name;
+	struct tag *tag;
+	struct cu  *cu;
+	uint32_t   size;
+	uint32_t   packed_size;
+	uint32_t   first_ref;
+	uint32_t   last_ref;
+	uint8_t	   kind;
+	bool	   defined;
+	bool	   alias;
+};
+
+struct type_graph {
+	struct type_graph_node *nodes;
+	struct type_ref	       *refs;
+	uint32_t	       *buckets;
+	uint32_t	       nr_nodes;
+	uint32_t	       allocated_nodes;
+	uint32_t	       nr_refs;
+	uint32_t	       allocated_refs;
+	uint32_t	       nr_buckets;
+	struct obstack	       names;
+};
+
+struct type_graph *type_graph__new(void);
+void type_graph__delete(struct type_graph *graph);
+
+int type_graph__add_cu(struct type_graph *graph, struct cu *cu,
+		       bool (*filter)(struct class *cls, struct cu *cu,
+				      uint32_t id, void *priv),
+		       void *priv);
+
+uint32_t type_graph__find(const struct type_graph *graph, const char *name,
+			  enum type_graph_node_kind kind);
+
+const char *type_ref__kind_name(const struct type_ref *ref);
+
+int type_graph__containment_weights(const struct type_graph *graph, uint64_t **pweights);
+
+/**
+ * type_graph__for_each_ref - iterate thru the references to a node
+ * @graph: struct type_graph instance
+ * @node: struct type_graph_node referred to
+ * @ref: struct type_ref iterator
+ */
+#define type_graph__for_each_ref(graph, node, ref)			     \
+	for (ref = (node)->first_ref == TYPE_GRAPH__NONE ?		     \
+		   NULL : &(graph)->refs[(node)->first_ref];		     \
+	     ref != NULL;						     \
+	     ref = ref->next == TYPE_GRAPH__NONE ?			     \
+		   NULL : &(graph)->refs[ref->next])
+
+#endif /* _DWARVES_TYPE_GRAPH_H_ */
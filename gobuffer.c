@@ -15,6 +15,7 @@
 #include <string.h>
 #include <zlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "dutil.h"
 
@@ -50,20 +51,29 @@ void gobuffer__delete(struct gobuffer *gb)
 	free(gb);
 }
 
-void *gobuffer__ptr(const struct gobuffer *gb, unsigned int s)
+void *gobuffer__ptr(const struct gobuffer *gb, size_t s)
 {
 	return s ? gb->entries + s : NULL;
 }
 
-int gobuffer__allocate(struct gobuffer *gb, unsigned int len)
+ssize_t gobuffer__allocate(struct gobuffer *gb, size_t len)
 {
-	const unsigned int rc = gb->index;
-	const unsigned int index = gb->index + len;
+	const size_t rc = gb->index;
+	const size_t index = gb->index + len;
+
+	if (index < gb->index || index > SSIZE_MAX)
+		return -ENOMEM;
 
 	if (index >= gb->allocated_size) {
-		unsigned int allocated_size = (gb->allocated_size +
-					       GOBUFFER__BCHUNK);
-		if (allocated_size < index)
+		/*
+		 * Grow geometrically, so that building multi megabyte type and
+		 * string tables doesn't end up copying them over and over.
+		 */
+		size_t allocated_size = gb->allocated_size * 2;
+
+		if (allocated_size < GOBUFFER__BCHUNK)
+			allocated_size = GOBUFFER__BCHUNK;
+		if (allocated_size <= index)
 			allocated_size = index + GOBUFFER__BCHUNK;
 		char *entries = realloc(gb->entries, allocated_size);
 
@@ -78,9 +88,9 @@ int gobuffer__allocate(struct gobuffer *gb, unsigned int len)
 	return rc;
 }
 
-int gobuffer__add(struct gobuffer *gb, const void *s, unsigned int len)
+ssize_t gobuffer__add(struct gobuffer *gb, const void *s, size_t len)
 {
-	const int rc = gobuffer__allocate(gb, len);
+	const ssize_t rc = gobuffer__allocate(gb, len);
 
 	if (rc >= 0) {
 		++gb->nr_entries;
@@ -6,11 +6,19 @@
   Copyright (C) 2008 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Offsets and sizes are size_t, so that the in memory buffers, such as the
+ * global strings table, can go past 4 GiB, output formats with 32-bit
+ * offsets, such as BTF and CTF, must check gobuffer__size() themselves.
+ */
 struct gobuffer {
 	char		*entries;
 	unsigned int	nr_entries;
-	unsigned int	index;
-	unsigned int	allocated_size;
+	size_t		index;
+	size_t		allocated_size;
 };
 
 struct gobuffer *gobuffer__new(void);
@@ -21,8 +29,8 @@ void __gobuffer__delete(struct gobuffer *gb);
 
 void gobuffer__copy(const struct gobuffer *gb, void *dest);
 
-int gobuffer__add(struct gobuffer *gb, const void *s, unsigned int len);
-int gobuffer__allocate(struct gobuffer *gb, unsigned int len);
+ssize_t gobuffer__add(struct gobuffer *gb, const void *s, size_t len);
+ssize_t gobuffer__allocate(struct gobuffer *gb, size_t len);
 
 static inline const void *gobuffer__entries(const struct gobuffer *gb)
 {
@@ -34,12 +42,12 @@ static inline unsigned int gobuffer__nr_entries(const struct gobuffer *gb)
 	return gb->nr_entries;
 }
 
-static inline unsigned int gobuffer__size(const struct gobuffer *gb)
+static inline size_t gobuffer__size(const struct gobuffer *gb)
 {
 	return gb->index;
 }
 
-void *gobuffer__ptr(const struct gobuffer *gb, unsigned int s);
+void *gobuffer__ptr(const struct gobuffer *gb, size_t s);
 
 const void *gobuffer__compress(struct gobuffer *gb, unsigned int *size);
 
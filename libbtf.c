@@ -22,6 +22,7 @@
 #include "lib/bpf/include/linux/err.h"
 #include "lib/bpf/src/btf.h"
 #include "lib/bpf/src/libbpf.h"
+#include "decompress.h"
 #include "dutil.h"
 #include "gobuffer.h"
 #include "dwarves.h"
@@ -142,6 +143,13 @@ struct btf_elf *btf_elf__new(const char *filename, Elf *elf)
 		return NULL;
 
 	btfe->in_fd = -1;
+
+	/*
+	 * Reserve room for the header at the start of the types buffer, so
+	 * that btf_elf__encode() can build the raw BTF in place.
+	 */
+	if (gobuffer__allocate(&btfe->types, sizeof(struct btf_header)) < 0)
+		goto errout;
 	btfe->filename = strdup(filename);
 	if (btfe->filename == NULL)
 		goto errout;
@@ -166,7 +174,7 @@ struct btf_elf *btf_elf__new(const char *filename, Elf *elf)
 			goto errout;
 		}
 
-		btfe->elf = elf_begin(btfe->in_fd, ELF_C_READ_MMAP, NULL);
+		btfe->elf = decompress__elf_begin(btfe->in_fd, &btfe->decompressed);
 		if (!btfe->elf) {
 			fprintf(stderr, "%s: cannot read %s ELF file.\n",
 				__func__, filename);
@@ -209,6 +217,7 @@ void btf_elf__delete(struct btf_elf *btfe)
 		close(btfe->in_fd);
 		if (btfe->elf)
 			elf_end(btfe->elf);
+		free(btfe->decompressed);
 	}
 
 	__gobuffer__delete(&btfe->types);
@@ -234,11 +243,6 @@ char *btf_elf__string(struct btf_elf *btfe, uint32_t ref)
 	return name[0] == '\0' ? NULL : name;
 }
 
-static void *btf_elf__nohdr_data(struct btf_elf *btfe)
-{
-	return btfe->hdr + 1;
-}
-
 void btf_elf__set_strings(struct btf_elf *btfe, struct gobuffer *strings)
 {
 	btfe->strings = strings;
@@ -720,48 +724,71 @@ static int libbpf_log(enum libbpf_print_level level, const char *format, va_list
 
 int btf_elf__encode(struct btf_elf *btfe, uint8_t flags)
 {
+	const size_t str_len = gobuffer__size(btfe->strings);
 	struct btf_header *hdr;
+	size_t type_len;
+	ssize_t str_off;
 	struct btf *btf;
+	int err = -1;
 
 	/* Empty file, nothing to do, so... done! */
-	if (gobuffer__size(&btfe->types) == 0)
+	if (gobuffer__size(&btfe->types) <= sizeof(*hdr))
 		return 0;
 
-	btfe->size = sizeof(*hdr) + (gobuffer__size(&btfe->types) + gobuffer__size(btfe->strings));
-	btfe->data = zalloc(btfe->size);
+	type_len = gobuffer__size(&btfe->types) - sizeof(*hdr);
+
+	/* BTF type and string offsets are 32-bit */
+	if (type_len + str_len > UINT32_MAX) {
+		fprintf(stderr, "%s: types + strings too big for BTF (%zu + %zu bytes)\n",
+			__func__, type_len, str_len);
+		return -1;
+	}
 
-	if (btfe->data == NULL) {
+	/*
+	 * The types buffer starts with room for the header, so just append
+	 * the strings to it instead of copying both to yet another buffer
+	 * only for btf__new() to copy it all again.
+	 */
+	str_off = gobuffer__allocate(&btfe->types, str_len);
+	if (str_off < 0) {
 		fprintf(stderr, "%s: malloc failed!\n", __func__);
 		return -1;
 	}
 
-	hdr = btfe->hdr;
+	gobuffer__copy(btfe->strings, btfe->types.entries + str_off);
+	btfe->types.entries[str_off] = '\0';
+
+	hdr = (struct btf_header *)btfe->types.entries;
+	memset(hdr, 0, sizeof(*hdr));
 	hdr->magic = BTF_MAGIC;
 	hdr->version = 1;
 	hdr->flags = flags;
 	hdr->hdr_len = sizeof(*hdr);
 
 	hdr->type_off = 0;
-	hdr->type_len = gobuffer__size(&btfe->types);
+	hdr->type_len = type_len;
 	hdr->str_off  = hdr->type_len;
-	hdr->str_len  = gobuffer__size(btfe->strings);
+	hdr->str_len  = str_len;
 
-	gobuffer__copy(&btfe->types, btf_elf__nohdr_data(btfe) + hdr->type_off);
-	gobuffer__copy(btfe->strings, btf_elf__nohdr_data(btfe) + hdr->str_off);
+	libbpf_set_print(libbpf_log);
 
-	*(char *)(btf_elf__nohdr_data(btfe) + hdr->str_off) = '\0';
+	btf = btf__new((__u8 *)btfe->types.entries, gobuffer__size(&btfe->types));
 
-	libbpf_set_print(libbpf_log);
+	/* btf__new() has its own copy, drop ours before deduplicating */
+	__gobuffer__delete(&btfe->types);
+	memset(&btfe->types, 0, sizeof(btfe->types));
 
-	btf = btf__new(btfe->data, btfe->size);
 	if (IS_ERR(btf)) {
 		fprintf(stderr, "%s: btf__new failed!\n", __func__);
 		return -1;
 	}
 	if (btf__dedup(btf, NULL, NULL)) {
 		fprintf(stderr, "%s: btf__dedup failed!", __func__);
-		return -1;
+		goto out_free;
 	}
 
-	return btf_elf__write(btfe->filename, btf);
+	err = btf_elf__write(btfe->filename, btf);
+out_free:
+	btf__free(btf);
+	return err;
 }
@@ -26,6 +26,7 @@ struct btf_elf {
 	size_t		  size;
 	int		  swapped;
 	int		  in_fd;
+	void		  *decompressed;
 	uint8_t		  wordsize;
 	bool		  is_big_endian;
 	bool		  raw_btf; // "/sys/kernel/btf/vmlinux"
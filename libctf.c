@@ -17,6 +17,7 @@
 
 #include "libctf.h"
 #include "ctf.h"
+#include "decompress.h"
 #include "dutil.h"
 #include "gobuffer.h"
 
@@ -197,7 +198,7 @@ struct ctf *ctf__new(const char *filename, Elf *elf)
 				goto out_close;
 			}
 
-			ctf->elf = elf_begin(ctf->in_fd, ELF_C_READ_MMAP, NULL);
+			ctf->elf = decompress__elf_begin(ctf->in_fd, &ctf->decompressed);
 			if (!ctf->elf) {
 				fprintf(stderr, "%s: cannot read %s ELF file.\n",
 					__func__, filename);
@@ -222,8 +223,10 @@ out_elf_end:
 	if (elf == NULL)
 		elf_end(ctf->elf);
 out_close:
-	if (elf == NULL)
+	if (elf == NULL) {
 		close(ctf->in_fd);
+		free(ctf->decompressed);
+	}
 out_delete_filename:
 	free(ctf->filename);
 out_delete:
@@ -237,6 +240,7 @@ void ctf__delete(struct ctf *ctf)
 		if (ctf->in_fd != -1) {
 			elf_end(ctf->elf);
 			close(ctf->in_fd);
+			free(ctf->decompressed);
 		}
 		__gobuffer__delete(&ctf->objects);
 		__gobuffer__delete(&ctf->types);
@@ -557,6 +561,7 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 {
 	struct ctf_header *hdr;
 	unsigned int size;
+	size_t total_size;
 	void *bf = NULL;
 	int err = -1;
 
@@ -564,10 +569,19 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 	if (gobuffer__size(&ctf->types) == 0)
 		return 0;
 
-	size = (gobuffer__size(&ctf->types) +
-		gobuffer__size(&ctf->objects) +
-		gobuffer__size(&ctf->funcs) +
-		gobuffer__size(ctf->strings));
+	total_size = (gobuffer__size(&ctf->types) +
+		      gobuffer__size(&ctf->objects) +
+		      gobuffer__size(&ctf->funcs) +
+		      gobuffer__size(ctf->strings));
+
+	/* CTF offsets are 32-bit */
+	if (total_size > UINT32_MAX) {
+		fprintf(stderr, "%s: %zu bytes of types + strings is too big for CTF\n",
+			__func__, total_size);
+		return -E2BIG;
+	}
+
+	size = total_size;
 
 	ctf->size = sizeof(*hdr) + size;
 	ctf->buf = malloc(ctf->size);
@@ -619,8 +633,8 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 		size = ctf->size;
 	}
 #if 0
-	printf("\n\ntypes:\n entries: %d\n size: %u"
-		 "\nstrings:\n entries: %u\n size: %u\ncompressed size: %d\n",
+	printf("\n\ntypes:\n entries: %d\n size: %zu"
+		 "\nstrings:\n entries: %u\n size: %zu\ncompressed size: %d\n",
 	       ctf->type_index,
 	       gobuffer__size(&ctf->types),
 	       gobuffer__nr_entries(ctf->strings),
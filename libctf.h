@@ -29,6 +29,7 @@ struct ctf {
 	size_t		  size;
 	int		  swapped;
 	int		  in_fd;
+	void		  *decompressed;
 	uint8_t		  wordsize;
 	uint32_t	  type_index;
 };
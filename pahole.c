@@ -8,19 +8,34 @@
 
 #include <argp.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <dwarf.h>
 #include <search.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
+#include "dwarves_layouts.h"
 #include "dwarves_reorganize.h"
+#include "dwarves_type_graph.h"
 #include "dwarves.h"
 #include "dutil.h"
 #include "ctf_encoder.h"
 #include "btf_encoder.h"
 
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
 static bool btf_encode;
 static bool ctf_encode;
 static bool first_obj_only;
@@ -56,6 +71,27 @@ static bool defined_in;
 static bool just_unions;
 static bool just_structs;
 static int show_reorg_steps;
+static const char *member_weights_filename;
+static unsigned int exact_reorg_budget_ms;
+static bool narrow_members;
+static bool reorganize_bitfields;
+static bool serve;
+static const char *serve_socket;
+static const char *false_sharing_filename;
+static const char *slabinfo_filename;
+static const char *slab_caches_filename;
+static bool size_impact;
+static bool packable_sweep;
+static long nr_jobs;
+static bool parallel_format;
+static struct fprintf_queue *format_queue;
+static const char *export_layouts_filename;
+static struct layouts_writer *layouts_writer;
+static int layouts_err;
+static char *hw_profile_names;
+static uint32_t *size_classes;
+static int nr_size_classes;
+static struct hw_profile hw_profiles[8];
 static char *class_name;
 static struct strlist *class_names;
 static char separator = '\t';
@@ -178,6 +214,99 @@ static void size_formatter(struct class *class,
 	       class__size(class), separator, tag__is_union(class__tag(class)) ? 0 : class->nr_holes);
 }
 
+/* The kmalloc caches, including the non power of two kmalloc-96 and kmalloc-192 */
+static uint32_t kmalloc_size_classes[] = {
+	8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 8192,
+};
+
+/*
+ * Objects bigger than the biggest size class are assumed to come straight
+ * from the page allocator, in power of two sizes, like with kmalloc_large().
+ */
+static uint32_t size_class(uint32_t size, uint32_t *prev_class)
+{
+	int i;
+
+	*prev_class = 0;
+
+	for (i = 0; i < nr_size_classes; ++i) {
+		if (size <= size_classes[i])
+			return size_classes[i];
+		*prev_class = size_classes[i];
+	}
+
+	uint32_t class = size_classes[nr_size_classes - 1];
+
+	while (class < size && class < UINT32_MAX / 2)
+		class *= 2;
+
+	*prev_class = class / 2;
+	return class;
+}
+
+/*
+ * name, size, size class, bytes lost to the size class, bytes in holes,
+ * tail padding, bytes to trim to fit in the previous size class and the
+ * size class it would be in if packed, i.e. without its holes and padding.
+ */
+static void size_class_formatter(struct class *class,
+				 struct cu *cu, uint32_t id __unused)
+{
+	struct tag *tag = class__tag(class);
+	const uint32_t size = class__size(class);
+	uint32_t prev_class, sum_holes = 0, padding = 0, packed_class, unused;
+	const uint32_t class_size = size_class(size, &prev_class);
+
+	if (tag__is_struct(tag)) {
+		struct class_member *pos;
+
+		sum_holes = class->pre_hole;
+		type__for_each_data_member(&class->type, pos)
+			sum_holes += pos->hole;
+		padding = class->padding;
+	}
+
+	packed_class = size_class(class__packed_size(class, cu), &unused);
+
+	printf("%s%c%u%c%u%c%u%c%u%c%u%c%u%c%u\n", class__name(class, cu),
+	       separator, size, separator, class_size, separator, class_size - size,
+	       separator, sum_holes, separator, padding,
+	       separator, prev_class != 0 ? size - prev_class : 0,
+	       separator, packed_class);
+}
+
+static int size_classes__parse(char *sizes)
+{
+	char *sep, *size = sizes;
+
+	nr_size_classes = 0;
+	size_classes = NULL;
+
+	while (size != NULL) {
+		uint32_t *classes = realloc(size_classes, (nr_size_classes + 1) * sizeof(*size_classes));
+		unsigned long value;
+		char *end;
+
+		if (classes == NULL)
+			return -ENOMEM;
+		size_classes = classes;
+
+		sep = strchr(size, ',');
+		if (sep != NULL)
+			*sep++ = '\0';
+
+		value = strtoul(size, &end, 0);
+		if (*end != '\0' || value == 0 || value > UINT32_MAX ||
+		    (nr_size_classes != 0 && value <= size_classes[nr_size_classes - 1]))
+			return -EINVAL;
+
+		size_classes[nr_size_classes++] = value;
+		size = sep;
+	}
+
+	return 0;
+}
+
 static void class_name_len_formatter(struct class *class, struct cu *cu,
 				     uint32_t id __unused)
 {
@@ -191,6 +320,16 @@ static void class_name_formatter(struct class *class,
 	puts(class__name(class, cu));
 }
 
+static size_t class__fprintf_line(struct tag *tag, const struct cu *cu,
+				  uint32_t id __unused,
+				  const struct conf_fprintf *conf, FILE *fp)
+{
+	size_t printed = tag__fprintf(tag, cu, conf, fp);
+
+	fputc('\n', fp);
+	return printed + 1;
+}
+
 static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
 {
 	struct tag *typedef_alias = NULL;
@@ -223,20 +362,23 @@ static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
 	} else
 		conf.prefix = conf.suffix = NULL;
 
-	tag__fprintf(tag, cu, &conf, stdout);
+	/* Formatted by the --parallel_format threads at the end of the CU */
+	if (format_queue != NULL) {
+		if (fprintf_queue__add(format_queue, class__fprintf_line,
+				       tag, cu, id, &conf) == 0)
+			return;
+		/* No memory to queue it, print it after the ones queued */
+		fprintf_queue__flush(format_queue, stdout);
+	}
 
-	putchar('\n');
+	class__fprintf_line(tag, cu, id, &conf, stdout);
 }
 
-static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
+/* Anonymous struct? Try finding a typedef */
+static const char *class__packable_name(struct class *c, struct cu *cu, uint32_t id)
 {
-	const struct tag *t = class__tag(c);
-	const size_t orig_size = class__size(c);
-	const size_t new_size = class__size(c->priv);
-	const size_t savings = orig_size - new_size;
 	const char *name = class__name(c, cu);
 
-	/* Anonymous struct? Try finding a typedef */
 	if (name == NULL) {
 		const struct tag *tdef =
 		      cu__find_first_typedef_of_type(cu, id);
@@ -244,241 +386,885 @@ static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
 		if (tdef != NULL)
 			name = class__name(tag__class(tdef), cu);
 	}
-	if (name != NULL)
-		printf("%s%c%zd%c%zd%c%zd\n",
-		       name, separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
-	else
-		printf("%s(%d)%c%zd%c%zd%c%zd\n",
-		       tag__decl_file(t, cu),
-		       tag__decl_line(t, cu),
-		       separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
+
+	return name;
 }
 
-static void (*stats_formatter)(struct structure *st);
+enum layout_hazard_kind {
+	HAZARD__SPLIT_ATOMIC,
+	HAZARD__MISALIGNED_ATOMIC,
+	HAZARD__SPLIT_MEMBER,
+	HAZARD__MISALIGNED_MEMBER,
+	HAZARD__BITFIELD_CROSSES_WORD,
+	HAZARD__OVERALIGNED_MEMBER,
+	HAZARD__NR_KINDS,
+};
 
-static void print_stats(void)
+static const char *layout_hazard_kind_names[] = {
+	[HAZARD__SPLIT_ATOMIC]		= "split_atomic",
+	[HAZARD__MISALIGNED_ATOMIC]	= "misaligned_atomic",
+	[HAZARD__SPLIT_MEMBER]		= "split_member",
+	[HAZARD__MISALIGNED_MEMBER]	= "misaligned_member",
+	[HAZARD__BITFIELD_CROSSES_WORD] = "bitfield_crosses_word",
+	[HAZARD__OVERALIGNED_MEMBER]	= "overaligned_member",
+};
+
+/*
+ * @detail: the cacheline for the split ones, the natural alignment for the
+ * misaligned ones, the word for bitfields, the alignment attribute for the
+ * overaligned ones.
+ */
+struct layout_hazard {
+	char			*class_name;
+	char			*member_name;
+	uint32_t		offset;
+	uint32_t		size;
+	uint32_t		detail;
+	enum layout_hazard_kind kind;
+};
+
+static struct layout_hazards {
+	struct layout_hazard *entries;
+	uint32_t	     nr_entries;
+	uint32_t	     allocated;
+	uint32_t	     nr_structs;
+} layout_hazards;
+
+static int layout_hazards__add(struct layout_hazards *hazards, const char *class_name,
+			       const char *member_name, enum layout_hazard_kind kind,
+			       uint32_t offset, uint32_t size, uint32_t detail)
 {
-	struct structure *pos;
+	struct layout_hazard *hazard;
 
-	list_for_each_entry(pos, &structures__list, node)
-		stats_formatter(pos);
-}
+	if (hazards->nr_entries == hazards->allocated) {
+		uint32_t allocated = hazards->allocated ? hazards->allocated * 2 : 256;
+		struct layout_hazard *entries = realloc(hazards->entries,
+							allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
 
-static struct class *class__filter(struct class *class, struct cu *cu,
-				   uint32_t tag_id);
+		hazards->entries   = entries;
+		hazards->allocated = allocated;
+	}
 
-static void (*formatter)(struct class *class,
-			 struct cu *cu, uint32_t id) = class_formatter;
+	hazard = &hazards->entries[hazards->nr_entries];
+	hazard->class_name  = strdup(class_name);
+	hazard->member_name = strdup(member_name);
+	if (hazard->class_name == NULL || hazard->member_name == NULL) {
+		free(hazard->class_name);
+		free(hazard->member_name);
+		return -ENOMEM;
+	}
 
-static void print_classes(struct cu *cu)
+	hazard->kind   = kind;
+	hazard->offset = offset;
+	hazard->size   = size;
+	hazard->detail = detail;
+	++hazards->nr_entries;
+	return 0;
+}
+
+/* Types used with atomic instructions, by the names of their typedefs or structs */
+static bool tag__is_atomic(const struct tag *type, const struct cu *cu)
 {
-	uint32_t id;
-	struct class *pos;
+	static const char *prefixes[] = {
+		"atomic", "refcount", "spinlock", "raw_spinlock", "arch_spinlock",
+		"qspinlock", "rwlock", "arch_rwlock", "seqcount", "pthread_spinlock",
+		"std::atomic",
+	};
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		bool existing_entry;
-		struct structure *str;
+	while (type != NULL) {
+		const char *name = NULL;
+		size_t i;
 
-		if (pos->type.namespace.name == 0 &&
-		    !(class__include_anonymous ||
-		      class__include_nested_anonymous))
-			continue;
+		if (tag__is_typedef(type) || tag__is_struct(type) || tag__is_union(type))
+			name = type__name(tag__type(type), cu);
 
-		if (!class__filter(pos, cu, id))
-			continue;
-		/*
-		 * FIXME: No sense in adding an anonymous struct to the list of
-		 * structs already printed, as we look for the name... The
-		 * right fix probably will be to call class__fprintf on a
-		 * in-memory FILE, do a hash, and look it by full contents, not
-		 * by name. And this is needed for CTF as well, but its late now
-		 * and I'm sleepy, will leave for later...
-		 */
-		if (pos->type.namespace.name != 0) {
-			str = structures__add(pos, cu, &existing_entry);
-			if (str == NULL) {
-				fprintf(stderr, "pahole: insufficient memory for "
-					"processing %s, skipping it...\n", cu->name);
-				return;
-			}
+		for (i = 0; name != NULL && i < sizeof(prefixes) / sizeof(prefixes[0]); ++i)
+			if (strncmp(name, prefixes[i], strlen(prefixes[i])) == 0)
+				return true;
 
-			/* Already printed... */
-			if (existing_entry) {
-				str->nr_files++;
-				continue;
-			}
-		}
+		if (!tag__is_typedef(type) && !tag__is_modifier(type))
+			break;
 
-		if (show_packable && !global_verbose)
-			print_packable_info(pos, cu, id);
-		else if (formatter != NULL)
-			formatter(pos, cu, id);
+		type = cu__type(cu, type->type);
 	}
+
+	return false;
 }
 
-static struct cu *cu__filter(struct cu *cu)
+static int class__find_hazards(struct type *type, struct cu *cu, const char *class_name,
+			       char *member_name, size_t member_name_len,
+			       uint32_t base_offset, int depth)
 {
-	if (cu__exclude_prefix != NULL &&
-	    (cu->name == NULL ||
-	     strncmp(cu__exclude_prefix, cu->name,
-		     cu__exclude_prefix_len) == 0))
-		return NULL;
+	const uint32_t cacheline_size = dwarves__cacheline_size();
+	const uint32_t word_bits = cu->addr_size * 8;
+	struct class_member *pos;
+	size_t len = strlen(member_name);
+
+	type__for_each_data_member(type, pos) {
+		struct tag *member_type = cu__type(cu, pos->tag.type);
+		struct tag *real_type = tag__strip_typedefs_and_modifiers(&pos->tag, cu);
+		const uint32_t offset = base_offset + pos->byte_offset;
+		const char *name = class_member__name(pos, cu);
+		bool atomic, scalar;
+		uint32_t size, natural_alignment;
+		int err = 0;
+
+		if (pos->is_static || member_type == NULL || real_type == NULL)
+			continue;
 
-	return cu;
-}
+		snprintf(member_name + len, member_name_len - len, "%s%s",
+			 len ? "." : "", name ?: "(anon)");
 
-static int class__packable(struct class *class, struct cu *cu)
-{
-	struct class *clone;
+		if (pos->bitfield_size != 0) {
+			const uint32_t first_bit = base_offset * 8 + pos->bit_offset;
+			const uint32_t last_bit = first_bit + pos->bitfield_size - 1;
 
-	if (class->nr_holes == 0 && class->nr_bit_holes == 0)
-		return 0;
+			if (first_bit / word_bits != last_bit / word_bits)
+				err = layout_hazards__add(&layout_hazards, class_name, member_name,
+							  HAZARD__BITFIELD_CROSSES_WORD, offset,
+							  pos->byte_size, last_bit / word_bits);
+			goto next;
+		}
 
-	clone = class__clone(class, NULL, cu);
-	if (clone == NULL)
-		return 0;
-	class__reorganize(clone, cu, 0, stdout);
-	if (class__size(class) > class__size(clone)) {
-		class->priv = clone;
-		return 1;
+		atomic = tag__is_atomic(member_type, cu);
+		scalar = real_type->tag == DW_TAG_base_type || tag__is_pointer(real_type) ||
+			 tag__is_enumeration(real_type);
+		natural_alignment = tag__natural_alignment(real_type, cu);
+
+		if (pos->alignment >= 16 && pos->alignment >= 4 * pos->byte_size &&
+		    pos->alignment > natural_alignment) {
+			err = layout_hazards__add(&layout_hazards, class_name, member_name,
+						  HAZARD__OVERALIGNED_MEMBER, offset,
+						  pos->byte_size, pos->alignment);
+			if (err != 0)
+				goto next;
+		}
+
+		if ((tag__is_struct(real_type) || tag__is_union(real_type)) && !atomic) {
+			if (depth < 8)
+				err = class__find_hazards(tag__type(real_type), cu, class_name,
+							  member_name, member_name_len,
+							  offset, depth + 1);
+			goto next;
+		}
+
+		if (!atomic && !scalar)
+			goto next;
+
+		size = pos->byte_size;
+		/* The lock or counter word, not any debugging fields after it */
+		if (atomic && size > natural_alignment)
+			size = natural_alignment;
+
+		if (size != 0 && size <= cacheline_size &&
+		    offset / cacheline_size != (offset + size - 1) / cacheline_size)
+			err = layout_hazards__add(&layout_hazards, class_name, member_name,
+						  atomic ? HAZARD__SPLIT_ATOMIC : HAZARD__SPLIT_MEMBER,
+						  offset, size, (offset + size - 1) / cacheline_size);
+		else if (offset % natural_alignment != 0)
+			err = layout_hazards__add(&layout_hazards, class_name, member_name,
+						  atomic ? HAZARD__MISALIGNED_ATOMIC : HAZARD__MISALIGNED_MEMBER,
+						  offset, size, natural_alignment);
+next:
+		member_name[len] = '\0';
+		if (err != 0)
+			return err;
 	}
-	/* FIXME: we need to free in the right order,
-	 *	  cu->obstack is being corrupted...
-	class__delete(clone, cu);
-	*/
+
 	return 0;
 }
 
-static struct class *class__filter(struct class *class, struct cu *cu,
-				   uint32_t tag_id)
+/*
+ * Members whose bytes straddle a cacheline, assuming the struct starts at
+ * one, or are not naturally aligned, atomics and locks first, bitfields
+ * crossing a word and small members with large alignment attributes, ranked
+ * at the end by layout_hazards__print().
+ */
+static void hazards_formatter(struct class *class, struct cu *cu, uint32_t id)
 {
-	struct tag *tag = class__tag(class);
-	const char *name;
+	const char *name = class__packable_name(class, cu, id);
+	char member_name[1024] = "";
 
-	if (just_unions && !tag__is_union(tag))
-		return NULL;
+	if (name == NULL || !tag__is_struct(class__tag(class)))
+		return;
 
-	if (just_structs && !tag__is_struct(tag))
-		return NULL;
+	++layout_hazards.nr_structs;
 
-	if (!tag->top_level) {
-		class__find_holes(class);
+	if (class__find_hazards(&class->type, cu, name, member_name,
+				sizeof(member_name), 0, 0) != 0)
+		fprintf(stderr, "pahole: insufficient memory for processing %s\n", name);
+}
 
-		if (!show_private_classes)
-			return NULL;
-	}
+static int layout_hazard__cmp(const void *a, const void *b)
+{
+	const struct layout_hazard *ha = a, *hb = b;
+	int ret;
 
-	name = class__name(class, cu);
+	if (ha->kind != hb->kind)
+		return ha->kind < hb->kind ? -1 : 1;
 
-	if (class__is_declaration(class))
-		return NULL;
+	ret = strcmp(ha->class_name, hb->class_name);
+	if (ret != 0)
+		return ret;
 
-	if (!class__include_anonymous && name == NULL)
-		return NULL;
+	return ha->offset < hb->offset ? -1 : ha->offset > hb->offset;
+}
 
-	if (class__exclude_prefix != NULL) {
-		if (name == NULL) {
-			const struct tag *tdef =
-				cu__find_first_typedef_of_type(cu, tag_id);
-			if (tdef != NULL) {
-				struct class *c = tag__class(tdef);
+static void layout_hazards__print(struct layout_hazards *hazards)
+{
+	uint32_t i, nr_kinds[HAZARD__NR_KINDS] = { 0, };
+
+	qsort(hazards->entries, hazards->nr_entries, sizeof(*hazards->entries),
+	      layout_hazard__cmp);
+
+	for (i = 0; i < hazards->nr_entries; ++i) {
+		const struct layout_hazard *hazard = &hazards->entries[i];
+
+		printf("%s%c%s%c%u%c%u%c%s%c%u\n",
+		       hazard->class_name, separator,
+		       hazard->member_name, separator,
+		       hazard->offset, separator,
+		       hazard->size, separator,
+		       layout_hazard_kind_names[hazard->kind], separator,
+		       hazard->detail);
+		++nr_kinds[hazard->kind];
+	}
 
-				name = class__name(c, cu);
-			}
-		}
-		if (name != NULL && strncmp(class__exclude_prefix, name,
-					    class__exclude_prefix_len) == 0)
-			return NULL;
+	printf("/* structs: %u, hazards: %u", hazards->nr_structs, hazards->nr_entries);
+	for (i = 0; i < HAZARD__NR_KINDS; ++i)
+		printf(", %s: %u", layout_hazard_kind_names[i], nr_kinds[i]);
+	puts(" */");
+}
+
+static uint32_t gcd32(uint32_t a, uint32_t b)
+{
+	while (b != 0) {
+		uint32_t t = a % b;
+
+		a = b;
+		b = t;
 	}
 
-	if (class__include_prefix != NULL) {
-		if (name == NULL) {
-			const struct tag *tdef =
-				cu__find_first_typedef_of_type(cu, tag_id);
-			if (tdef != NULL) {
-				struct class *c = tag__class(tdef);
+	return a;
+}
 
-				name = class__name(c, cu);
-			}
+/*
+ * How many of nr_elements elements of size bytes, starting at offset from a
+ * cacheline boundary, touch one more cacheline than they would if aligned.
+ * The pattern repeats every cacheline_size / gcd(size, cacheline_size)
+ * elements, so just one period is looked at.
+ */
+static uint64_t array__nr_straddling(uint32_t offset, uint32_t size, uint64_t nr_elements,
+				     uint32_t cacheline_size)
+{
+	const uint32_t period = cacheline_size / gcd32(size, cacheline_size);
+	const uint32_t min_lines = (size + cacheline_size - 1) / cacheline_size;
+	uint64_t nr_straddling = 0, nr_in_remainder = 0;
+	uint32_t i;
+
+	for (i = 0; i < period && i < nr_elements; ++i) {
+		const uint32_t start = (offset + (uint64_t)i * size) % cacheline_size;
+
+		if ((start + size - 1) / cacheline_size + 1 > min_lines) {
+			++nr_straddling;
+			if (i < nr_elements % period)
+				++nr_in_remainder;
 		}
-		if (name != NULL && strncmp(class__include_prefix, name,
-					    class__include_prefix_len) != 0)
-			return NULL;
 	}
 
-	if (decl_exclude_prefix != NULL &&
-	    (!tag__decl_file(tag, cu) ||
-	     strncmp(decl_exclude_prefix, tag__decl_file(tag, cu),
-		     decl_exclude_prefix_len) == 0))
-		return NULL;
-	/*
-	 * if --unions was used and we got here, its a union and we satisfy the other
-	 * filters/options, so don't filter it.
-	 */
-	if (just_unions)
-		return class;
-	/*
-	 * The following only make sense for structs, i.e. 'struct class',
-	 * and as we can get here with a union, that is represented by a 'struct type',
-	 * bail out if we get here with an union and we are not looking for things
-	 * that need finding holes, like --packable, --nr_holes, etc
-	 */
-	if (!tag__is_struct(tag))
-		return (just_structs || show_packable || nr_holes || nr_bit_holes || hole_size_ge) ? NULL : class;
-
-	if (tag->top_level)
-		class__find_holes(class);
+	if (nr_elements <= period)
+		return nr_straddling;
 
-	if (class->nr_holes < nr_holes ||
-	    class->nr_bit_holes < nr_bit_holes ||
-	    (hole_size_ge != 0 && !class__has_hole_ge(class, hole_size_ge)))
-		return NULL;
+	return nr_straddling * (nr_elements / period) + nr_in_remainder;
+}
 
-	if (show_packable && !class__packable(class, cu))
-		return NULL;
+/* Power of two divisors or multiples of the cacheline size never straddle */
+static bool array__stride_is_friendly(uint32_t size, uint32_t cacheline_size)
+{
+	if (size >= cacheline_size)
+		return size % cacheline_size == 0;
 
-	return class;
+	return is_power_of_2(size);
 }
 
-static void union__find_new_size(struct tag *tag, struct cu *cu);
-
-static void class__resize_LP(struct tag *tag, struct cu *cu)
+/*
+ * Arrays of structs or unions whose element size isn't a power of two
+ * divisor or a multiple of the cacheline size: where, name, element type,
+ * element size, number of elements, footprint, elements touching one more
+ * cacheline than needed, assuming the struct or variable starts at a
+ * cacheline boundary, and the stride to pad or trim the elements to.
+ */
+static void print_array_stride(const char *where, const char *name, struct tag *type,
+			       struct cu *cu, uint32_t offset)
 {
-	struct tag *tag_pos;
-	struct class *class = tag__class(tag);
-	size_t word_size_diff;
-	size_t orig_size = class->type.size;
+	const uint32_t cacheline_size = dwarves__cacheline_size();
+	struct tag *element_type;
+	uint32_t size, pad_to, trim_to;
+	uint64_t nr_elements;
+	const char *type_name;
+	char bf[128];
+
+	if (type == NULL || type->tag != DW_TAG_array_type)
+		return;
 
-	if (tag__type(tag)->resized)
+	nr_elements = array_type__nr_entries(tag__array_type(type));
+	element_type = tag__strip_typedefs_and_modifiers(type, cu);
+	if (element_type == NULL || nr_elements < 2 ||
+	    !(tag__is_struct(element_type) || tag__is_union(element_type)))
 		return;
 
-	tag__type(tag)->resized = 1;
+	size = tag__size(element_type, cu);
+	if (size == 0 || array__stride_is_friendly(size, cacheline_size))
+		return;
 
-	if (original_word_size > word_size)
-		word_size_diff = original_word_size - word_size;
-	else
-		word_size_diff = word_size - original_word_size;
+	if (size > cacheline_size) {
+		pad_to	= roundup(size, cacheline_size);
+		trim_to = pad_to - cacheline_size;
+	} else {
+		pad_to	= roundup_pow_of_two(size);
+		trim_to = pad_to / 2;
+	}
 
-	type__for_each_tag(tag__type(tag), tag_pos) {
-		struct tag *type;
-		size_t diff = 0;
-		size_t array_multiplier = 1;
+	type_name = tag__name(cu__type(cu, type->type), cu, bf, sizeof(bf), NULL);
 
-		/* we want only data members, i.e. with byte_offset attr */
-		if (tag_pos->tag != DW_TAG_member &&
-		    tag_pos->tag != DW_TAG_inheritance)
-		    	continue;
+	printf("%s%c%s%c%s%c%u%c%" PRIu64 "%c%" PRIu64 "%c%" PRIu64 "%c%u%c%u\n",
+	       where, separator, name, separator, type_name, separator,
+	       size, separator, nr_elements, separator, nr_elements * size, separator,
+	       array__nr_straddling(offset % cacheline_size, size, nr_elements, cacheline_size),
+	       separator, pad_to, separator, trim_to);
+}
 
-		type = cu__type(cu, tag_pos->type);
-		tag__assert_search_result(type);
-		if (type->tag == DW_TAG_array_type) {
-			int i;
+static void array_strides_formatter(struct class *class, struct cu *cu, uint32_t id)
+{
+	const char *name = class__packable_name(class, cu, id);
+	struct class_member *pos;
+
+	if (name == NULL)
+		return;
+
+	type__for_each_data_member(&class->type, pos) {
+		const char *member_name = class_member__name(pos, cu);
+
+		if (!pos->is_static && member_name != NULL)
+			print_array_stride(name, member_name, cu__type(cu, pos->tag.type),
+					   cu, pos->byte_offset);
+	}
+}
+
+static void cu__print_variable_array_strides(struct cu *cu)
+{
+	struct tag *pos;
+	uint32_t id;
+
+	cu__for_each_variable(cu, id, pos) {
+		struct variable *var = tag__variable(pos);
+		const char *name = variable__name(var, cu);
+
+		if (!var->declaration && name != NULL)
+			print_array_stride("variable", name, cu__type(cu, pos->type), cu, 0);
+	}
+}
+
+static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
+{
+	const struct tag *t = class__tag(c);
+	const size_t orig_size = class__size(c);
+	const size_t new_size = class__size(c->priv);
+	const size_t savings = orig_size - new_size;
+	const char *name = class__packable_name(c, cu, id);
+
+	if (name != NULL)
+		printf("%s%c%zd%c%zd%c%zd\n",
+		       name, separator,
+		       orig_size, separator,
+		       new_size, separator,
+		       savings);
+	else
+		printf("%s(%d)%c%zd%c%zd%c%zd\n",
+		       tag__decl_file(t, cu),
+		       tag__decl_line(t, cu),
+		       separator,
+		       orig_size, separator,
+		       new_size, separator,
+		       savings);
+}
+
+/*
+ * --export_layouts: the structs and unions are collected as print_classes()
+ * finds them, i.e. once, and written when all the CUs are processed.
+ */
+static void layouts_formatter(struct class *class, struct cu *cu, uint32_t id)
+{
+	int err;
+
+	/* Printed as part of the type they are in, see class_formatter() */
+	if (class__name(class, cu) == NULL &&
+	    cu__find_first_typedef_of_type(cu, id) == NULL &&
+	    !class__include_nested_anonymous)
+		return;
+
+	err = layouts_writer__add(layouts_writer, class, cu, id);
+	if (err != 0 && layouts_err == 0)
+		layouts_err = err;
+}
+
+static void (*stats_formatter)(struct structure *st);
+
+static void print_stats(void)
+{
+	struct structure *pos;
+
+	list_for_each_entry(pos, &structures__list, node)
+		stats_formatter(pos);
+}
+
+static struct class *class__filter(struct class *class, struct cu *cu,
+				   uint32_t tag_id);
+
+static void (*formatter)(struct class *class,
+			 struct cu *cu, uint32_t id) = class_formatter;
+
+/* Types already printed, by contents, not by name */
+static struct type_dedup *printed_types;
+
+/*
+ * --packable_sweep: the structs in each CU are collected by print_classes()
+ * and then reorganized by nr_jobs threads, each cloning into its own scratch
+ * obstack, that is released after each struct, the results are kept till
+ * all CUs are processed, to print them ranked.
+ */
+struct packable_result {
+	char	    *name;
+	struct class *class;
+	size_t	    size;
+	size_t	    new_size;
+	uint32_t    nr_cachelines;
+	uint32_t    new_nr_cachelines;
+};
+
+static struct packable_results {
+	struct packable_result *entries;
+	uint32_t	       nr_entries;
+	uint32_t	       allocated;
+	uint32_t	       nr_structs;
+	/* first entry not yet evaluated, i.e. from the current CU */
+	uint32_t	       first_pending;
+	uint32_t	       next_pending;
+	struct cu	       *cu;
+} packable_results;
+
+static int packable_sweep__add(struct class *class, struct cu *cu, uint32_t id)
+{
+	struct packable_results *results = &packable_results;
+	struct packable_result *result;
+	const char *name;
+	char bf[PATH_MAX];
+
+	if (!tag__is_struct(class__tag(class)))
+		return 0;
+
+	++results->nr_structs;
+	class__find_holes(class);
+	if (class->nr_holes == 0 && class->nr_bit_holes == 0)
+		return 0;
+
+	if (results->nr_entries == results->allocated) {
+		uint32_t allocated = results->allocated ? results->allocated * 2 : 256;
+		struct packable_result *entries = realloc(results->entries,
+							  allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		results->entries   = entries;
+		results->allocated = allocated;
+	}
+
+	name = class__packable_name(class, cu, id);
+	if (name == NULL) {
+		const struct tag *t = class__tag(class);
+
+		snprintf(bf, sizeof(bf), "%s(%d)",
+			 tag__decl_file(t, cu), tag__decl_line(t, cu));
+		name = bf;
+	}
+
+	result = &results->entries[results->nr_entries];
+	result->name = strdup(name);
+	if (result->name == NULL)
+		return -ENOMEM;
+
+	result->class	      = class;
+	result->size	      = class__size(class);
+	result->nr_cachelines = tag__nr_cachelines(class__tag(class), cu);
+	++results->nr_entries;
+	return 0;
+}
+
+static void *packable_sweep__worker(void *arg __unused)
+{
+	struct packable_results *results = &packable_results;
+	struct obstack scratch;
+	uint32_t i;
+
+	obstack_init(&scratch);
+
+	while ((i = __atomic_fetch_add(&results->next_pending, 1,
+				       __ATOMIC_RELAXED)) < results->nr_entries) {
+		struct packable_result *result = &results->entries[i];
+		struct class *clone = class__clone_obstack(result->class, NULL,
+							   &scratch);
+
+		result->new_size = result->size;
+		result->new_nr_cachelines = result->nr_cachelines;
+		if (clone == NULL)
+			continue;
+
+		class__reorganize(clone, results->cu, 0, stdout);
+		if (exact_reorg_budget_ms != 0)
+			class__reorganize_exact(clone, results->cu,
+						exact_reorg_budget_ms, 0, stdout);
+
+		if (class__size(clone) < result->size) {
+			result->new_size = class__size(clone);
+			result->new_nr_cachelines = tag__nr_cachelines(class__tag(clone),
+								       results->cu);
+		}
+		obstack_free(&scratch, clone);
+	}
+
+	obstack_free(&scratch, NULL);
+	return NULL;
+}
+
+static int packable_sweep__run(struct cu *cu)
+{
+	struct packable_results *results = &packable_results;
+	const uint32_t nr_pending = results->nr_entries - results->first_pending;
+	long nr_threads = nr_jobs, i;
+	pthread_t *threads;
+
+	if (nr_pending == 0)
+		return 0;
+
+	results->cu	      = cu;
+	results->next_pending = results->first_pending;
+
+	/*
+	 * class__reorganize() and the exact solver look up the holes and cache
+	 * the alignments in the types, that the workers share, do it serially.
+	 */
+	cu__prepare_for_sharing(cu);
+
+	if (nr_threads > (long)nr_pending)
+		nr_threads = nr_pending;
+
+	threads = malloc(nr_threads * sizeof(*threads));
+	if (threads == NULL)
+		return -ENOMEM;
+
+	/* The main thread is one of the workers */
+	for (i = 1; i < nr_threads; ++i)
+		if (pthread_create(&threads[i], NULL, packable_sweep__worker, NULL) != 0)
+			break;
+
+	nr_threads = i;
+	packable_sweep__worker(NULL);
+
+	for (i = 1; i < nr_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	results->first_pending = results->nr_entries;
+	return 0;
+}
+
+static int packable_result__cmp(const void *a, const void *b)
+{
+	const struct packable_result *ra = a, *rb = b;
+	const size_t savings_a = ra->size - ra->new_size,
+		     savings_b = rb->size - rb->new_size;
+
+	if (savings_a != savings_b)
+		return savings_a > savings_b ? -1 : 1;
+
+	return strcmp(ra->name, rb->name);
+}
+
+static void packable_sweep__print(void)
+{
+	struct packable_results *results = &packable_results;
+	const size_t cacheline_size = dwarves__cacheline_size();
+	size_t bytes_saved = 0, cachelines_saved = 0;
+	uint32_t i, nr_packable = 0, nr_now_fit = 0;
+
+	qsort(results->entries, results->nr_entries, sizeof(*results->entries),
+	      packable_result__cmp);
+
+	for (i = 0; i < results->nr_entries; ++i) {
+		const struct packable_result *result = &results->entries[i];
+
+		if (result->new_size == result->size)
+			break;
+
+		printf("%s%c%zd%c%zd%c%zd%c%u%c%u\n",
+		       result->name, separator,
+		       result->size, separator,
+		       result->new_size, separator,
+		       result->size - result->new_size, separator,
+		       result->nr_cachelines, separator,
+		       result->new_nr_cachelines);
+
+		++nr_packable;
+		bytes_saved	 += result->size - result->new_size;
+		cachelines_saved += result->nr_cachelines - result->new_nr_cachelines;
+		if (result->size > cacheline_size && result->new_size <= cacheline_size)
+			++nr_now_fit;
+	}
+
+	printf("/* structs: %u, packable: %u, bytes saved: %zd, "
+	       "cachelines saved: %zd, now fitting in a cacheline: %u */\n",
+	       results->nr_structs, nr_packable, bytes_saved,
+	       cachelines_saved, nr_now_fit);
+}
+
+static void print_classes(struct cu *cu)
+{
+	uint32_t id;
+	struct class *pos;
+
+	cu__for_each_struct_or_union(cu, id, pos) {
+		bool existing_entry;
+		struct structure *str;
+		struct tag *key = class__tag(pos);
+		int nr_seen;
+
+		if (pos->type.namespace.name == 0 &&
+		    !(class__include_anonymous ||
+		      class__include_nested_anonymous))
+			continue;
+
+		if (!class__filter(pos, cu, id))
+			continue;
+
+		if (pos->type.namespace.name != 0) {
+			str = structures__add(pos, cu, &existing_entry);
+			if (str == NULL)
+				goto out_enomem;
+
+			if (existing_entry)
+				str->nr_files++;
+		} else {
+			/*
+			 * Anonymous structs are printed with the name of
+			 * its first typedef, so that is part of what has to
+			 * be the same for it to be considered already
+			 * printed.
+			 */
+			struct tag *typedef_alias = cu__find_first_typedef_of_type(cu, id);
+
+			if (typedef_alias != NULL)
+				key = typedef_alias;
+		}
+
+		nr_seen = type_dedup__add(printed_types, tag__hash(key, cu));
+		if (nr_seen < 0)
+			goto out_enomem;
+
+		/* Already printed... */
+		if (nr_seen > 0)
+			continue;
+
+		if (packable_sweep) {
+			if (packable_sweep__add(pos, cu, id) != 0)
+				goto out_enomem;
+		} else if (show_packable && !global_verbose)
+			print_packable_info(pos, cu, id);
+		else if (formatter != NULL)
+			formatter(pos, cu, id);
+	}
+
+	if (packable_sweep && packable_sweep__run(cu) != 0)
+		goto out_enomem;
+
+	if (format_queue != NULL && fprintf_queue__flush(format_queue, stdout) != 0)
+		goto out_enomem;
+
+	return;
+out_enomem:
+	fprintf(stderr, "pahole: insufficient memory for "
+		"processing %s, skipping it...\n", cu->name);
+}
+
+/* CUs without a DW_AT_name are loaded as "", filter them the same way */
+static bool cu__name_excluded(const char *name)
+{
+	return cu__exclude_prefix != NULL &&
+	       strncmp(cu__exclude_prefix, name ?: "", cu__exclude_prefix_len) == 0;
+}
+
+static struct cu *cu__filter(struct cu *cu)
+{
+	return cu__name_excluded(cu->name) ? NULL : cu;
+}
+
+static bool pahole__early_cu_filter(const char *name,
+				    const char *producer __unused,
+				    uint16_t language __unused,
+				    struct conf_load *conf __unused)
+{
+	return !cu__name_excluded(name);
+}
+
+static int class__packable(struct class *class, struct cu *cu)
+{
+	struct class *clone;
+
+	if (class->nr_holes == 0 && class->nr_bit_holes == 0)
+		return 0;
+
+	clone = class__clone(class, NULL, cu);
+	if (clone == NULL)
+		return 0;
+	class__reorganize(clone, cu, 0, stdout);
+	if (exact_reorg_budget_ms != 0)
+		class__reorganize_exact(clone, cu, exact_reorg_budget_ms, 0, stdout);
+	if (class__size(class) > class__size(clone)) {
+		class->priv = clone;
+		return 1;
+	}
+	/* FIXME: we need to free in the right order,
+	 *	  cu->obstack is being corrupted...
+	class__delete(clone, cu);
+	*/
+	return 0;
+}
+
+static struct class *class__filter(struct class *class, struct cu *cu,
+				   uint32_t tag_id)
+{
+	struct tag *tag = class__tag(class);
+	const char *name;
+
+	if (just_unions && !tag__is_union(tag))
+		return NULL;
+
+	if (just_structs && !tag__is_struct(tag))
+		return NULL;
+
+	if (!tag->top_level) {
+		class__find_holes(class);
+
+		if (!show_private_classes)
+			return NULL;
+	}
+
+	name = class__name(class, cu);
+
+	if (class__is_declaration(class))
+		return NULL;
+
+	if (!class__include_anonymous && name == NULL)
+		return NULL;
+
+	if (class__exclude_prefix != NULL) {
+		if (name == NULL) {
+			const struct tag *tdef =
+				cu__find_first_typedef_of_type(cu, tag_id);
+			if (tdef != NULL) {
+				struct class *c = tag__class(tdef);
+
+				name = class__name(c, cu);
+			}
+		}
+		if (name != NULL && strncmp(class__exclude_prefix, name,
+					    class__exclude_prefix_len) == 0)
+			return NULL;
+	}
+
+	if (class__include_prefix != NULL) {
+		if (name == NULL) {
+			const struct tag *tdef =
+				cu__find_first_typedef_of_type(cu, tag_id);
+			if (tdef != NULL) {
+				struct class *c = tag__class(tdef);
+
+				name = class__name(c, cu);
+			}
+		}
+		if (name != NULL && strncmp(class__include_prefix, name,
+					    class__include_prefix_len) != 0)
+			return NULL;
+	}
+
+	if (decl_exclude_prefix != NULL &&
+	    (!tag__decl_file(tag, cu) ||
+	     strncmp(decl_exclude_prefix, tag__decl_file(tag, cu),
+		     decl_exclude_prefix_len) == 0))
+		return NULL;
+	/*
+	 * if --unions was used and we got here, its a union and we satisfy the other
+	 * filters/options, so don't filter it.
+	 */
+	if (just_unions)
+		return class;
+	/*
+	 * The following only make sense for structs, i.e. 'struct class',
+	 * and as we can get here with a union, that is represented by a 'struct type',
+	 * bail out if we get here with an union and we are not looking for things
+	 * that need finding holes, like --packable, --nr_holes, etc
+	 */
+	if (!tag__is_struct(tag))
+		return (just_structs || show_packable || nr_holes || nr_bit_holes || hole_size_ge) ? NULL : class;
+
+	if (tag->top_level)
+		class__find_holes(class);
+
+	if (class->nr_holes < nr_holes ||
+	    class->nr_bit_holes < nr_bit_holes ||
+	    (hole_size_ge != 0 && !class__has_hole_ge(class, hole_size_ge)))
+		return NULL;
+
+	if (show_packable && !class__packable(class, cu))
+		return NULL;
+
+	return class;
+}
+
+static void union__find_new_size(struct tag *tag, struct cu *cu);
+
+static void class__resize_LP(struct tag *tag, struct cu *cu)
+{
+	struct tag *tag_pos;
+	struct class *class = tag__class(tag);
+	size_t word_size_diff;
+	size_t orig_size = class->type.size;
+
+	if (tag__type(tag)->resized)
+		return;
+
+	tag__type(tag)->resized = 1;
+
+	if (original_word_size > word_size)
+		word_size_diff = original_word_size - word_size;
+	else
+		word_size_diff = word_size - original_word_size;
+
+	type__for_each_tag(tag__type(tag), tag_pos) {
+		struct tag *type;
+		size_t diff = 0;
+		size_t array_multiplier = 1;
+
+		/* we want only data members, i.e. with byte_offset attr */
+		if (tag_pos->tag != DW_TAG_member &&
+		    tag_pos->tag != DW_TAG_inheritance)
+		    	continue;
+
+		type = cu__type(cu, tag_pos->type);
+		tag__assert_search_result(type);
+		if (type->tag == DW_TAG_array_type) {
+			int i;
 			for (i = 0; i < tag__array_type(type)->dimensions; ++i)
 				array_multiplier *= tag__array_type(type)->nr_entries[i];
 
@@ -677,113 +1463,245 @@ static void cu__account_nr_methods(struct cu *cu)
 
 static char tab[128];
 
-static void print_structs_with_pointer_to(struct cu *cu, uint32_t type)
+/*
+ * --contains and --find_pointers_to are answered from a graph of who refers
+ * to each type in all the CUs, built while they are loaded.
+ */
+static struct type_graph *type_graph;
+
+static bool pahole__type_graph_filter(struct class *class, struct cu *cu,
+				      uint32_t id, void *priv __unused)
 {
-	struct class *pos;
-	struct class_member *pos_member;
-	uint32_t id;
+	return class__filter(class, cu, id) != NULL;
+}
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		bool looked = false;
-		/*
-		 * Set it to NULL just to silence the compiler, as the printf
-		 * at the end of the type__for_each_member() loop is only reached
-		 * after str _is_ set, as looked starts as false, str is used with
-		 * structures_add and if it is NULL, we return.
-		 */
-		struct structure *str = NULL;
+struct type_graph_containers {
+	struct {
+		uint32_t node;
+		uint32_t nr_members;
+	}	 *entries;
+	uint32_t nr_entries;
+	uint32_t allocated;
+};
 
-		if (pos->type.namespace.name == 0)
-			continue;
+/*
+ * Count the members of the type in each container, in the order the
+ * containers are first found, the ones thru typedefs of the type included.
+ */
+static int type_graph__collect_containers(struct type_graph *graph, uint32_t idx,
+					  struct type_graph_containers *containers,
+					  uint8_t *visiting)
+{
+	const struct type_ref *ref;
+	int err = 0;
 
-		if (!class__filter(pos, cu, id))
+	visiting[idx] = 1;
+
+	type_graph__for_each_ref(graph, &graph->nodes[idx], ref) {
+		uint32_t i;
+
+		if (visiting[ref->from])
 			continue;
 
-		type__for_each_member(&pos->type, pos_member) {
-			struct tag *ctype = cu__type(cu, pos_member->tag.type);
+		if (ref->kind == TYPE_REF__TYPEDEF) {
+			err = type_graph__collect_containers(graph, ref->from,
+							     containers, visiting);
+			if (err != 0)
+				break;
+			continue;
+		}
 
-			tag__assert_search_result(ctype);
-			if (!tag__is_pointer_to(ctype, type))
-				continue;
+		if (ref->kind != TYPE_REF__EMBEDS)
+			continue;
 
-			if (!looked) {
-				bool existing_entry;
+		for (i = 0; i < containers->nr_entries; ++i)
+			if (containers->entries[i].node == ref->from)
+				break;
 
-				str = structures__add(pos, cu, &existing_entry);
-				if (str == NULL) {
-					fprintf(stderr, "pahole: insufficient memory for "
-						"processing %s, skipping it...\n",
-						cu->name);
-					return;
-				}
-				/*
-				 * We already printed this struct in another CU
-				 */
-				if (existing_entry)
+		if (i == containers->nr_entries) {
+			if (i == containers->allocated) {
+				uint32_t allocated = containers->allocated ? containers->allocated * 2 : 16;
+				void *entries = realloc(containers->entries,
+							allocated * sizeof(*containers->entries));
+				if (entries == NULL) {
+					err = -ENOMEM;
 					break;
-				looked = true;
+				}
+
+				containers->entries   = entries;
+				containers->allocated = allocated;
 			}
-			printf("%s: %s\n", str->name,
-			       class_member__name(pos_member, cu));
+
+			containers->entries[i].node	  = ref->from;
+			containers->entries[i].nr_members = 0;
+			++containers->nr_entries;
 		}
+
+		++containers->entries[i].nr_members;
 	}
+
+	visiting[idx] = 0;
+	return err;
 }
 
-static int type__print_containers(struct type *type, struct cu *cu, uint32_t contained_type_id, int ident)
+static int type_graph__print_containers(struct type_graph *graph, uint32_t idx,
+					int ident, uint8_t *visiting)
 {
-	const uint32_t n = type__nr_members_of_type(type, contained_type_id);
-	if (n == 0)
-		return 0;
+	struct type_graph_containers containers = { .entries = NULL, };
+	uint32_t i;
+	int err = type_graph__collect_containers(graph, idx, &containers, visiting);
 
-	if (ident == 0) {
-		bool existing_entry;
-		struct structure *str = structures__add(type__class(type), cu, &existing_entry);
-		if (str == NULL) {
-			fprintf(stderr, "pahole: insufficient memory for "
-				"processing %s, skipping it...\n",
-				cu->name);
-			return -1;
+	if (err != 0)
+		goto out_free;
+
+	visiting[idx] = 1;
+
+	for (i = 0; i < containers.nr_entries; ++i) {
+		const uint32_t from = containers.entries[i].node;
+
+		printf("%.*s%s", ident * 2, tab, graph->nodes[from].name);
+		if (global_verbose)
+			printf(": %u", containers.entries[i].nr_members);
+		putchar('\n');
+
+		if (recursive) {
+			err = type_graph__print_containers(graph, from, ident + 1, visiting);
+			if (err != 0)
+				break;
 		}
-		/*
-		 * We already printed this struct in another CU
-		 */
-		if (existing_entry)
-			return 0;
 	}
 
-	printf("%.*s%s", ident * 2, tab, type__name(type, cu));
-	if (global_verbose)
-		printf(": %u", n);
-	putchar('\n');
-	if (recursive) {
-		struct class_member *member;
+	visiting[idx] = 0;
+out_free:
+	free(containers.entries);
+	return err;
+}
+
+static void type_graph__print_pointers_to(struct type_graph *graph, uint32_t idx,
+					  uint8_t *visiting)
+{
+	const struct type_ref *ref;
+
+	visiting[idx] = 1;
+
+	type_graph__for_each_ref(graph, &graph->nodes[idx], ref) {
+		if (ref->kind == TYPE_REF__TYPEDEF && !visiting[ref->from])
+			type_graph__print_pointers_to(graph, ref->from, visiting);
+		else if (ref->kind == TYPE_REF__POINTS_TO &&
+			 graph->nodes[ref->from].kind == TYPE_GRAPH__STRUCT)
+			printf("%s: %s\n", graph->nodes[ref->from].name, ref->name);
+	}
+
+	visiting[idx] = 0;
+}
+
+struct size_impact {
+	uint32_t node;
+	uint64_t weight;
+	uint64_t bytes_saved;
+};
+
+static int size_impact__cmp(const void *a, const void *b)
+{
+	const struct size_impact *ia = a, *ib = b;
+
+	if (ia->bytes_saved != ib->bytes_saved)
+		return ia->bytes_saved < ib->bytes_saved ? 1 : -1;
+
+	return ia->node < ib->node ? -1 : ia->node > ib->node;
+}
+
+/*
+ * What packing a struct saves in itself and, multiplied by array lengths,
+ * in all the types embedding it, directly or not, leaf structs embedded
+ * everywhere going first.
+ */
+static int type_graph__print_size_impact(struct type_graph *graph)
+{
+	uint64_t *weights, bytes_saved = 0;
+	struct size_impact *impacts;
+	uint32_t i, nr_impacts = 0, nr_structs = 0;
+
+	if (type_graph__containment_weights(graph, &weights) != 0)
+		return -ENOMEM;
+
+	impacts = malloc(graph->nr_nodes * sizeof(*impacts));
+	if (impacts == NULL) {
+		free(weights);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < graph->nr_nodes; ++i) {
+		const struct type_graph_node *node = &graph->nodes[i];
+		struct size_impact *impact = &impacts[nr_impacts];
+		const uint32_t savings = node->size - node->packed_size;
+
+		if (!node->defined || node->alias || node->kind == TYPE_GRAPH__FUNCTION)
+			continue;
+
+		++nr_structs;
+		if (savings == 0)
+			continue;
+
+		impact->node	    = i;
+		impact->weight	    = weights[i];
+		impact->bytes_saved = savings * weights[i];
+		if (impact->bytes_saved / weights[i] != savings)
+			impact->bytes_saved = UINT64_MAX;
+		++nr_impacts;
+	}
+
+	qsort(impacts, nr_impacts, sizeof(*impacts), size_impact__cmp);
 
-		type__for_each_member(type, member) {
-			struct tag *member_type = cu__type(cu, member->tag.type);
+	for (i = 0; i < nr_impacts; ++i) {
+		const struct size_impact *impact = &impacts[i];
+		const struct type_graph_node *node = &graph->nodes[impact->node];
 
-			if (tag__is_struct(member_type) || tag__is_union(member_type))
-				type__print_containers(tag__type(member_type), cu, contained_type_id, ident + 1);
-		}
+		printf("%s%c%u%c%u%c%" PRIu64 "%c%" PRIu64 "\n",
+		       node->name, separator,
+		       node->size, separator,
+		       node->packed_size, separator,
+		       impact->weight - 1, separator,
+		       impact->bytes_saved);
+		bytes_saved += impact->bytes_saved;
 	}
 
+	printf("/* structs: %u, packable: %u, bytes saved in all types: %" PRIu64 " */\n",
+	       nr_structs, nr_impacts, bytes_saved);
+
+	free(impacts);
+	free(weights);
 	return 0;
 }
 
-static void print_containers(struct cu *cu, uint32_t type, int ident)
+static int type_graph__print_queries(struct type_graph *graph)
 {
-	struct class *pos;
-	uint32_t id;
+	uint8_t *visiting = zalloc(graph->nr_nodes);
+	struct rb_node *next;
+	int err = 0;
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		if (pos->type.namespace.name == 0)
-			continue;
+	if (visiting == NULL)
+		return -ENOMEM;
 
-		if (!class__filter(pos, cu, id))
+	for (next = rb_first(&class_names->entries); next; next = rb_next(next)) {
+		struct str_node *pos = rb_entry(next, struct str_node, rb_node);
+		uint32_t idx = type_graph__find(graph, pos->s, TYPE_GRAPH__STRUCT);
+
+		if (idx == TYPE_GRAPH__NONE)
+			idx = type_graph__find(graph, pos->s, TYPE_GRAPH__TYPEDEF);
+		if (idx == TYPE_GRAPH__NONE)
 			continue;
 
-		if (type__print_containers(&pos->type, cu, type, ident))
-			break;
+		if (find_containers) {
+			err = type_graph__print_containers(graph, idx, 0, visiting);
+			if (err != 0)
+				break;
+		} else
+			type_graph__print_pointers_to(graph, idx, visiting);
 	}
+
+	free(visiting);
+	return err;
 }
 
 /* Name and version of program.  */
@@ -800,6 +1718,22 @@ ARGP_PROGRAM_VERSION_HOOK_DEF = dwarves_print_version;
 #define ARGP_suppress_packed	   308
 #define ARGP_just_unions	   309
 #define ARGP_just_structs	   310
+#define ARGP_member_weights	   311
+#define ARGP_exact_reorg	   312
+#define ARGP_false_sharing	   313
+#define ARGP_packable_sweep	   314
+#define ARGP_hw_profile		   315
+#define ARGP_size_classes	   316
+#define ARGP_slabinfo		   317
+#define ARGP_slab_caches	   318
+#define ARGP_size_impact	   319
+#define ARGP_hazards		   320
+#define ARGP_array_strides	   321
+#define ARGP_narrow_members	   322
+#define ARGP_reorganize_bitfields  323
+#define ARGP_serve		   324
+#define ARGP_parallel_format	   325
+#define ARGP_export_layouts	   326
 
 static const struct argp_option pahole__options[] = {
 	{
@@ -1052,11 +1986,121 @@ static const struct argp_option pahole__options[] = {
 		.key  = ARGP_just_unions,
 		.doc  = "Show just unions",
 	},
+	{
+		.name = "member_weights",
+		.key  = ARGP_member_weights,
+		.arg  = "FILE",
+		.doc  = "with --reorganize, pack the members with access counts in FILE into as few cachelines as possible",
+	},
+	{
+		.name = "exact_reorg",
+		.key  = ARGP_exact_reorg,
+		.arg  = "MSECS",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc  = "with --reorganize and --packable, search for the smallest layout for up to MSECS (default 100) per struct",
+	},
+	{
+		.name = "packable_sweep",
+		.key  = ARGP_packable_sweep,
+		.doc  = "evaluate the reorganization of all structs in parallel, print them ranked by savings and the totals",
+	},
+	{
+		.name = "jobs",
+		.key  = 'j',
+		.arg  = "NR_JOBS",
+		.doc  = "use up to NR_JOBS threads, default: number of online CPUs",
+	},
+	{
+		.name = "false_sharing",
+		.key  = ARGP_false_sharing,
+		.arg  = "FILE",
+		.doc  = "flag cachelines mixing members written by different CPUs or written and read mostly, as annotated in FILE",
+	},
+	{
+		.name = "size_classes",
+		.key  = ARGP_size_classes,
+		.arg  = "SIZE[,SIZE...]",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc  = "show the allocator size class, default: kmalloc's, of classes, the bytes lost to it, holes, padding, bytes to trim to drop a size class and the size class if packed",
+	},
+	{
+		.name = "slabinfo",
+		.key  = ARGP_slabinfo,
+		.arg  = "FILE",
+		.doc  = "rank structs by the bytes in holes and padding times their active objects in a /proc/slabinfo snapshot",
+	},
+	{
+		.name = "slab_caches",
+		.key  = ARGP_slab_caches,
+		.arg  = "FILE",
+		.doc  = "map slab cache names to struct names for --slabinfo, one \"cache_name struct_name\" per line",
+	},
+	{
+		.name = "size_impact",
+		.key  = ARGP_size_impact,
+		.doc  = "rank structs by the bytes packing them would save in them and in all the types embedding them",
+	},
+	{
+		.name = "hazards",
+		.key  = ARGP_hazards,
+		.doc  = "rank the members straddling cachelines, misaligned, atomics and locks first, bitfields crossing words and small members with large alignments",
+	},
+	{
+		.name = "array_strides",
+		.key  = ARGP_array_strides,
+		.doc  = "show arrays of structs in structs and global variables with element sizes that make elements straddle cachelines",
+	},
+	{
+		.name = "narrow_members",
+		.key  = ARGP_narrow_members,
+		.doc  = "with --reorganize, shrink enum members to fit their enumerators and bool like ints to a byte before reorganizing",
+	},
+	{
+		.name = "reorganize_bitfields",
+		.key  = ARGP_reorganize_bitfields,
+		.doc  = "with --reorganize, also pack the bitfields together in the smallest types that hold them",
+	},
+	{
+		.name = "serve",
+		.key  = ARGP_serve,
+		.arg  = "SOCKET",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc  = "keep the types loaded and answer queries read from stdin or, with SOCKET, from the clients of that UNIX socket",
+	},
+	{
+		.name = "parallel_format",
+		.key  = ARGP_parallel_format,
+		.doc  = "format the types in each CU with --jobs threads, the output is the same",
+	},
+	{
+		.name = "export_layouts",
+		.key  = ARGP_export_layouts,
+		.arg  = "FILE",
+		.doc  = "write the layouts of all the structs and unions to FILE, in the columnar format described in dwarves_layouts.h",
+	},
+	{
+		.name = "hw_profile",
+		.key  = ARGP_hw_profile,
+		.arg  = "NAME|FILE[,NAME|FILE...]",
+		.doc  = "show prefetch unit and page boundaries for the first hardware profile and per profile stats, builtin: x86_64, arm64, arm64_64k, ppc64, s390x",
+	},
 	{
 		.name = NULL,
 	}
 };
 
+static int exact_reorg_budget__parse(const char *msecs)
+{
+	char *end;
+	unsigned long value = strtoul(msecs, &end, 0);
+
+	if (end == msecs || *end != '\0' || value == 0 || value > UINT_MAX)
+		return -EINVAL;
+
+	exact_reorg_budget_ms = value;
+	return 0;
+}
+
 static error_t pahole__options_parser(int key, char *arg,
 				      struct argp_state *state)
 {
@@ -1143,31 +2187,810 @@ static error_t pahole__options_parser(int key, char *arg,
 		just_unions = true;			break;
 	case ARGP_just_structs:
 		just_structs = true;			break;
+	case ARGP_member_weights:
+		member_weights_filename = arg;		break;
+	case ARGP_packable_sweep:
+		packable_sweep = true;			break;
+	case 'j': nr_jobs = atol(arg);			break;
+	case ARGP_false_sharing:
+		false_sharing_filename = arg;		break;
+	case ARGP_hw_profile:
+		hw_profile_names = arg;			break;
+	case ARGP_slabinfo:
+		slabinfo_filename = arg;		break;
+	case ARGP_slab_caches:
+		slab_caches_filename = arg;		break;
+	case ARGP_size_impact:
+		size_impact = true;			break;
+	case ARGP_hazards:
+		formatter = hazards_formatter;		break;
+	case ARGP_array_strides:
+		formatter = array_strides_formatter;	break;
+	case ARGP_narrow_members:
+		narrow_members = true;			break;
+	case ARGP_reorganize_bitfields:
+		reorganize_bitfields = true;		break;
+	case ARGP_serve:
+		serve = true;
+		serve_socket = arg;			break;
+	case ARGP_parallel_format:
+		parallel_format = true;			break;
+	case ARGP_export_layouts:
+		export_layouts_filename = arg;
+		class__include_anonymous = 1;
+		conf_load.extra_dbg_info = 1;
+		formatter = layouts_formatter;		break;
+	case ARGP_size_classes:
+		formatter = size_class_formatter;
+		if (arg == NULL)
+			break;
+		if (size_classes__parse(arg) != 0)
+			argp_error(state, "invalid size classes, they must be increasing");
+		break;
+	case ARGP_exact_reorg:
+		exact_reorg_budget_ms = 100;
+		if (arg != NULL && exact_reorg_budget__parse(arg) != 0)
+			argp_error(state, "invalid --exact_reorg budget, it must be a positive number of milliseconds");
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
-	return 0;
+	return 0;
+}
+
+static const char pahole__args_doc[] = "FILE";
+
+static struct argp pahole__argp = {
+	.options  = pahole__options,
+	.parser	  = pahole__options_parser,
+	.args_doc = pahole__args_doc,
+};
+
+#define FIELDS_FILE__MAX_FIELDS 3
+
+/*
+ * Files with one entry per line, @nr_fields whitespace separated fields,
+ * '#' starts a comment. @fn gets the fields of each line and returns
+ * -EINVAL if they are not as described by @expected or -ENOMEM.
+ */
+static int fields_file__load(const char *filename, int nr_fields,
+			     const char *expected,
+			     int (*fn)(char **fields, void *priv), void *priv)
+{
+	char line[1024], *fields[FIELDS_FILE__MAX_FIELDS];
+	FILE *fp = fopen(filename, "r");
+	int err = -1, lineno = 0;
+
+	if (fp == NULL) {
+		fprintf(stderr, "pahole: couldn't open %s: %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *comment = strchr(line, '#'), *field, *saveptr;
+		int n = 0, rc;
+
+		++lineno;
+		if (comment != NULL)
+			*comment = '\0';
+
+		for (field = strtok_r(line, " \t\n", &saveptr);
+		     field != NULL && n < nr_fields;
+		     field = strtok_r(NULL, " \t\n", &saveptr))
+			fields[n++] = field;
+
+		if (n == 0)
+			continue;
+
+		rc = n == nr_fields ? fn(fields, priv) : -EINVAL;
+		if (rc == -EINVAL) {
+			fprintf(stderr, "pahole: %s:%d: expected \"%s\"\n",
+				filename, lineno, expected);
+			goto out;
+		}
+		if (rc != 0) {
+			fputs("pahole: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
+	err = 0;
+out:
+	fclose(fp);
+	return err;
+}
+
+/*
+ * A comma separated list of the distinct class names of @nr_entries
+ * entries, to use as --class_name when one wasn't specified, @entry__name
+ * returns NULL for the entries to skip.
+ */
+static char *class_names__join(const void *entries, uint32_t nr_entries,
+			       const char *(*entry__name)(const void *entries, uint32_t i))
+{
+	size_t len = 0;
+	char *names;
+	uint32_t i, j;
+
+	for (i = 0; i < nr_entries; ++i) {
+		const char *name = entry__name(entries, i);
+
+		if (name != NULL)
+			len += strlen(name) + 1;
+	}
+
+	names = zalloc(len + 1);
+	if (names == NULL)
+		return NULL;
+
+	for (i = 0; i < nr_entries; ++i) {
+		const char *name = entry__name(entries, i);
+
+		if (name == NULL)
+			continue;
+
+		for (j = 0; j < i; ++j) {
+			const char *previous = entry__name(entries, j);
+
+			if (previous != NULL && strcmp(previous, name) == 0)
+				break;
+		}
+		if (j != i)
+			continue;
+
+		if (names[0] != '\0')
+			strcat(names, ",");
+		strcat(names, name);
+	}
+
+	return names;
+}
+
+/*
+ * Per member annotations, one per line, as "struct_name member_name value",
+ * '#' starts a comment.
+ */
+struct member_annotation {
+	char	 *class_name;
+	char	 *member_name;
+	char	 *value;
+};
+
+/*
+ * @expected - the line format, for the error messages
+ * @value__valid - checks the values when loading, if set
+ */
+struct member_annotations {
+	struct member_annotation *entries;
+	int			 nr_entries;
+	int			 allocated;
+	const char		 *expected;
+	bool			 (*value__valid)(const char *value);
+};
+
+static int member_annotations__add(struct member_annotations *annotations,
+				   const char *class_name,
+				   const char *member_name, const char *value)
+{
+	struct member_annotation *ma;
+
+	if (annotations->nr_entries == annotations->allocated) {
+		int allocated = annotations->allocated ? annotations->allocated * 2 : 64;
+		struct member_annotation *entries = realloc(annotations->entries,
+							    allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		annotations->entries   = entries;
+		annotations->allocated = allocated;
+	}
+
+	ma = &annotations->entries[annotations->nr_entries];
+	ma->class_name	= strdup(class_name);
+	ma->member_name = strdup(member_name);
+	ma->value	= strdup(value);
+	if (ma->class_name == NULL || ma->member_name == NULL || ma->value == NULL) {
+		free(ma->class_name);
+		free(ma->member_name);
+		free(ma->value);
+		return -ENOMEM;
+	}
+
+	++annotations->nr_entries;
+	return 0;
+}
+
+static int member_annotations__add_fields(char **fields, void *annotations)
+{
+	const struct member_annotations *ma = annotations;
+
+	if (ma->value__valid != NULL && !ma->value__valid(fields[2]))
+		return -EINVAL;
+
+	return member_annotations__add(annotations, fields[0], fields[1], fields[2]);
+}
+
+static int member_annotations__load(struct member_annotations *annotations,
+				    const char *filename)
+{
+	return fields_file__load(filename, 3, annotations->expected,
+				 member_annotations__add_fields, annotations);
+}
+
+static const char *member_annotations__find(const struct member_annotations *annotations,
+					    const char *class_name,
+					    const struct class_member *member,
+					    const struct cu *cu)
+{
+	const char *member_name = class_member__name(member, cu);
+	int i;
+
+	if (member_name == NULL)
+		return NULL;
+
+	for (i = 0; i < annotations->nr_entries; ++i) {
+		const struct member_annotation *ma = &annotations->entries[i];
+
+		if (strcmp(ma->member_name, member_name) == 0 &&
+		    strcmp(ma->class_name, class_name) == 0)
+			return ma->value;
+	}
+
+	return NULL;
+}
+
+static const char *member_annotation__class_name(const void *entries, uint32_t i)
+{
+	return ((const struct member_annotation *)entries)[i].class_name;
+}
+
+/* All the structs annotated */
+static char *member_annotations__class_names(const struct member_annotations *annotations)
+{
+	return class_names__join(annotations->entries, annotations->nr_entries,
+				 member_annotation__class_name);
+}
+
+static bool member_weight__valid(const char *weight)
+{
+	char *end;
+
+	/* strtoull() takes "-1" as ULLONG_MAX */
+	if (weight[0] == '-')
+		return false;
+
+	errno = 0;
+	strtoull(weight, &end, 0);
+	return errno == 0 && end != weight && *end == '\0';
+}
+
+/* Access counts, e.g. from 'perf c2c' or 'perf mem' */
+static struct member_annotations member_weights = {
+	.expected     = "struct_name member_name count",
+	.value__valid = member_weight__valid,
+};
+
+static uint64_t pahole__member_weight(const struct class_member *member,
+				      const struct cu *cu, void *class_name)
+{
+	const char *weight = member_annotations__find(&member_weights,
+						      class_name, member, cu);
+
+	/* Checked by member_weight__valid() when loading */
+	return weight ? strtoull(weight, NULL, 0) : 0;
+}
+
+/*
+ * Who writes each member: "read_mostly", "write_hot", i.e. written from any
+ * CPU, or "writer=DOMAIN[,DOMAIN...]", e.g. "writer=rx" or "writer=cpu0,cpu1".
+ */
+static struct member_annotations member_access = {
+	.expected = "struct_name member_name access",
+};
+
+struct member_access_info {
+	struct class_member *member;
+	const char	    *writers; /* NULL for read mostly */
+	uint32_t	    first_cacheline;
+	uint32_t	    last_cacheline;
+};
+
+static bool writer_set__contains(const char *set, const char *domain, size_t len)
+{
+	while (*set != '\0') {
+		size_t set_len = strcspn(set, ",");
+
+		if (set_len == len && strncmp(set, domain, len) == 0)
+			return true;
+		set += set_len;
+		if (*set == ',')
+			++set;
+	}
+
+	return false;
+}
+
+static bool writer_set__includes(const char *a, const char *b)
+{
+	while (*b != '\0') {
+		size_t len = strcspn(b, ",");
+
+		if (!writer_set__contains(a, b, len))
+			return false;
+		b += len;
+		if (*b == ',')
+			++b;
+	}
+
+	return true;
+}
+
+static bool writer_sets__equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+
+	return writer_set__includes(a, b) && writer_set__includes(b, a);
+}
+
+static const char *member_access_info__describe(const struct member_access_info *info,
+						char *bf, size_t len)
+{
+	if (info->writers == NULL)
+		return "read mostly";
+	if (strcmp(info->writers, "*") == 0)
+		return "write hot";
+	snprintf(bf, len, "written by %s", info->writers);
+	return bf;
+}
+
+static int class__member_access_infos(struct class *class, struct cu *cu,
+				      const char *name,
+				      struct member_access_info **pinfos)
+{
+	const size_t cacheline_size = dwarves__cacheline_size();
+	struct member_access_info *infos;
+	struct class_member *pos;
+	int nr_infos = 0, nr_members = 0;
+
+	type__for_each_data_member(&class->type, pos)
+		++nr_members;
+
+	infos = malloc((nr_members + 1) * sizeof(*infos));
+	if (infos == NULL)
+		return -ENOMEM;
+
+	type__for_each_data_member(&class->type, pos) {
+		const char *access = member_annotations__find(&member_access, name, pos, cu);
+		struct member_access_info *info = &infos[nr_infos];
+
+		if (access == NULL || pos->is_static || pos->byte_size == 0)
+			continue;
+
+		if (strcmp(access, "read_mostly") == 0)
+			info->writers = NULL;
+		else if (strcmp(access, "write_hot") == 0)
+			info->writers = "*";
+		else if (strncmp(access, "writer=", sizeof("writer=") - 1) == 0)
+			info->writers = access + sizeof("writer=") - 1;
+		else {
+			fprintf(stderr, "pahole: %s.%s: unknown access \"%s\", "
+				"expected read_mostly, write_hot or writer=DOMAIN\n",
+				name, class_member__name(pos, cu), access);
+			continue;
+		}
+
+		info->member	      = pos;
+		info->first_cacheline = pos->byte_offset / cacheline_size;
+		info->last_cacheline  = (pos->byte_offset + pos->byte_size - 1) / cacheline_size;
+		++nr_infos;
+	}
+
+	*pinfos = infos;
+	return nr_infos;
+}
+
+/*
+ * Flag cachelines where members written from some CPUs share the line with
+ * read mostly members or with members written from other CPUs, assuming
+ * the struct starts at a cacheline boundary.
+ */
+static void print_false_sharing(struct tag *class, struct cu *cu)
+{
+	const size_t cacheline_size = dwarves__cacheline_size();
+	const char *name = class__name(tag__class(class), cu);
+	struct member_access_info *infos, **line;
+	uint32_t cacheline, nr_cachelines = tag__nr_cachelines(class, cu),
+		 nr_risky = 0;
+	int nr_infos, i, j;
+
+	nr_infos = class__member_access_infos(tag__class(class), cu, name, &infos);
+	if (nr_infos < 0)
+		goto out_enomem;
+
+	line = malloc((nr_infos + 1) * sizeof(*line));
+	if (line == NULL) {
+		free(infos);
+		goto out_enomem;
+	}
+
+	for (cacheline = 0; cacheline < nr_cachelines; ++cacheline) {
+		struct member_access_info *split = NULL;
+		bool header_printed = false;
+		int nr_line = 0;
+
+		for (i = 0; i < nr_infos; ++i)
+			if (infos[i].first_cacheline <= cacheline &&
+			    infos[i].last_cacheline >= cacheline)
+				line[nr_line++] = &infos[i];
+
+		for (i = 0; i < nr_line; ++i) {
+			char bf[256], other_bf[256];
+			bool conflicts = false;
+
+			if (line[i]->writers == NULL)
+				continue;
+
+			for (j = 0; j < nr_line; ++j) {
+				if (j == i || writer_sets__equal(line[i]->writers,
+								 line[j]->writers))
+					continue;
+				/* Report pairs of writers just once */
+				if (line[j]->writers != NULL && j < i)
+					continue;
+
+				if (!header_printed) {
+					printf("%s: cacheline %u (bytes %zu-%zu) "
+					       "at risk of false sharing:\n",
+					       name, cacheline,
+					       cacheline * cacheline_size,
+					       (cacheline + 1) * cacheline_size - 1);
+					header_printed = true;
+				}
+
+				if (conflicts)
+					fputs(", ", stdout);
+				else
+					printf("\t'%s' (%s) with ",
+					       class_member__name(line[i]->member, cu),
+					       member_access_info__describe(line[i], bf,
+									    sizeof(bf)));
+				printf("'%s' (%s)",
+				       class_member__name(line[j]->member, cu),
+				       member_access_info__describe(line[j], other_bf,
+								    sizeof(other_bf)));
+				conflicts = true;
+			}
+
+			if (conflicts)
+				putchar('\n');
+		}
+
+		if (!header_printed)
+			continue;
+
+		++nr_risky;
+		/*
+		 * Suggest starting a new cacheline at the first member
+		 * accessed differently from the first one in this cacheline.
+		 */
+		for (i = 1; i < nr_line && split == NULL; ++i)
+			if (!writer_sets__equal(line[0]->writers, line[i]->writers))
+				split = line[i];
+
+		if (split != NULL)
+			printf("\tsplit: start a new cacheline at '%s' "
+			       "(e.g. ____cacheline_aligned_in_smp)\n",
+			       class_member__name(split->member, cu));
+	}
+
+	printf("/* %s: %u of %u cacheline%s at risk of false sharing */\n\n",
+	       name, nr_risky, nr_cachelines, nr_cachelines != 1 ? "s" : "");
+	free(line);
+	free(infos);
+	return;
+out_enomem:
+	fprintf(stderr, "pahole: insufficient memory for processing %s\n", name);
+}
+
+/*
+ * Active object counts from a /proc/slabinfo snapshot, to weigh the holes
+ * and padding in the structs allocated from each slab cache.
+ */
+struct slab_usage {
+	char	 *cache_name;
+	char	 *class_name;
+	uint64_t nr_active_objs;
+	uint32_t objsize;
+	uint32_t size;
+	uint32_t holes;
+	uint32_t padding;
+	bool	 found;
+};
+
+static struct slab_usages {
+	struct slab_usage *entries;
+	uint32_t	  nr_entries;
+	uint32_t	  allocated;
+} slab_usages;
+
+static int slab_usages__add(struct slab_usages *usages, const char *cache_name,
+			    const char *class_name, uint64_t nr_active_objs,
+			    uint32_t objsize)
+{
+	struct slab_usage *usage;
+
+	if (usages->nr_entries == usages->allocated) {
+		uint32_t allocated = usages->allocated ? usages->allocated * 2 : 64;
+		struct slab_usage *entries = realloc(usages->entries,
+						     allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		usages->entries	  = entries;
+		usages->allocated = allocated;
+	}
+
+	usage = &usages->entries[usages->nr_entries];
+	memset(usage, 0, sizeof(*usage));
+
+	usage->cache_name = strdup(cache_name);
+	usage->class_name = strdup(class_name);
+	if (usage->cache_name == NULL || usage->class_name == NULL) {
+		free(usage->cache_name);
+		free(usage->class_name);
+		return -ENOMEM;
+	}
+
+	usage->nr_active_objs = nr_active_objs;
+	usage->objsize	      = objsize;
+	++usages->nr_entries;
+	return 0;
+}
+
+static struct slab_usage *slab_usages__find(struct slab_usages *usages,
+					    const char *cache_name)
+{
+	uint32_t i;
+
+	for (i = 0; i < usages->nr_entries; ++i)
+		if (strcmp(usages->entries[i].cache_name, cache_name) == 0)
+			return &usages->entries[i];
+
+	return NULL;
+}
+
+/*
+ * The slab cache to struct mapping has "cache_name struct_name" lines, e.g.
+ * "inode_cache inode", '#' starts a comment. Without it caches are looked up
+ * as structs with the same name, e.g. "dentry".
+ */
+static int slab_usages__add_mapping(char **fields, void *usages)
+{
+	return slab_usages__add(usages, fields[0], fields[1], 0, 0);
+}
+
+static int slab_usages__load_mapping(struct slab_usages *usages, const char *filename)
+{
+	return fields_file__load(filename, 2, "cache_name struct_name",
+				 slab_usages__add_mapping, usages);
+}
+
+static int slab_usages__load(struct slab_usages *usages, const char *slabinfo,
+			     const char *mapping)
+{
+	char line[1024], cache_name[256];
+	uint32_t i, nr_entries = 0;
+	int err = -1, lineno = 0;
+	FILE *fp;
+
+	if (mapping != NULL && slab_usages__load_mapping(usages, mapping) != 0)
+		return -1;
+
+	fp = fopen(slabinfo, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "pahole: couldn't open %s: %s\n",
+			slabinfo, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		struct slab_usage *usage;
+		uint64_t nr_active_objs;
+		uint32_t objsize;
+		int n;
+
+		++lineno;
+		/* Skip the "slabinfo - version: 2.1" and "# name ..." headers */
+		if (strncmp(line, "slabinfo", 8) == 0 || line[0] == '#')
+			continue;
+
+		n = sscanf(line, "%255s %" SCNu64 " %*u %" SCNu32, cache_name,
+			   &nr_active_objs, &objsize);
+		if (n <= 0)
+			continue;
+		if (n != 3 || objsize == 0) {
+			fprintf(stderr, "pahole: %s:%d: expected \"name active_objs num_objs objsize ...\"\n",
+				slabinfo, lineno);
+			goto out;
+		}
+
+		if (mapping == NULL) {
+			if (slab_usages__add(usages, cache_name, cache_name,
+					     nr_active_objs, objsize) != 0) {
+				fputs("pahole: insufficient memory\n", stderr);
+				goto out;
+			}
+			continue;
+		}
+
+		usage = slab_usages__find(usages, cache_name);
+		if (usage != NULL) {
+			usage->nr_active_objs = nr_active_objs;
+			usage->objsize	      = objsize;
+		}
+	}
+
+	/* Drop the mapped caches that are not in this snapshot */
+	for (i = 0; i < usages->nr_entries; ++i) {
+		struct slab_usage *usage = &usages->entries[i];
+
+		if (usage->objsize == 0) {
+			free(usage->cache_name);
+			free(usage->class_name);
+			continue;
+		}
+		usages->entries[nr_entries++] = *usage;
+	}
+	usages->nr_entries = nr_entries;
+
+	err = 0;
+out:
+	fclose(fp);
+	return err;
 }
 
-static const char pahole__args_doc[] = "FILE";
+/* Without a mapping caches like "kmalloc-64" can't be struct names */
+static bool identifier__valid(const char *name)
+{
+	if (!isalpha(*name) && *name != '_')
+		return false;
 
-static struct argp pahole__argp = {
-	.options  = pahole__options,
-	.parser	  = pahole__options_parser,
-	.args_doc = pahole__args_doc,
-};
+	while (*++name != '\0')
+		if (!isalnum(*name) && *name != '_')
+			return false;
+
+	return true;
+}
+
+static const char *slab_usage__class_name(const void *entries, uint32_t i)
+{
+	const char *name = ((const struct slab_usage *)entries)[i].class_name;
+
+	return identifier__valid(name) ? name : NULL;
+}
+
+/* The structs in the slab caches */
+static char *slab_usages__class_names(const struct slab_usages *usages)
+{
+	return class_names__join(usages->entries, usages->nr_entries,
+				 slab_usage__class_name);
+}
+
+/* Several caches may hold the same struct, e.g. per size or per namespace ones */
+static void slab_usages__account(struct slab_usages *usages, struct class *class,
+				 const char *name)
+{
+	struct class_member *pos;
+	uint32_t holes = class->pre_hole, i;
+
+	type__for_each_data_member(&class->type, pos)
+		holes += pos->hole;
+
+	for (i = 0; i < usages->nr_entries; ++i) {
+		struct slab_usage *usage = &usages->entries[i];
+
+		if (strcmp(usage->class_name, name) != 0)
+			continue;
+
+		usage->size    = class__size(class);
+		usage->holes   = holes;
+		usage->padding = class->padding;
+		usage->found   = true;
+	}
+}
+
+static uint64_t slab_usage__wasted(const struct slab_usage *usage)
+{
+	return usage->nr_active_objs * (usage->holes + usage->padding);
+}
+
+static int slab_usage__cmp(const void *a, const void *b)
+{
+	const struct slab_usage *ua = a, *ub = b;
+	const uint64_t wa = slab_usage__wasted(ua), wb = slab_usage__wasted(ub);
+
+	if (wa != wb)
+		return wa < wb ? 1 : -1;
+
+	return strcmp(ua->cache_name, ub->cache_name);
+}
+
+static void slab_usages__print(struct slab_usages *usages)
+{
+	uint64_t nr_active_objs = 0, wasted = 0;
+	uint32_t i, nr_found = 0;
+
+	qsort(usages->entries, usages->nr_entries, sizeof(*usages->entries),
+	      slab_usage__cmp);
+
+	for (i = 0; i < usages->nr_entries; ++i) {
+		const struct slab_usage *usage = &usages->entries[i];
+
+		if (!usage->found)
+			continue;
+
+		printf("%s%c%s%c%" PRIu64 "%c%u%c%u%c%u%c%u%c%" PRIu64 "\n",
+		       usage->class_name, separator,
+		       usage->cache_name, separator,
+		       usage->nr_active_objs, separator,
+		       usage->size, separator,
+		       usage->objsize, separator,
+		       usage->holes, separator,
+		       usage->padding, separator,
+		       slab_usage__wasted(usage));
+
+		++nr_found;
+		nr_active_objs += usage->nr_active_objs;
+		wasted	       += slab_usage__wasted(usage);
+	}
+
+	printf("/* caches: %u, with structs found: %u, active objects: %" PRIu64
+	       ", bytes in holes and padding: %" PRIu64 " */\n",
+	       usages->nr_entries, nr_found, nr_active_objs, wasted);
+}
 
 static void do_reorg(struct tag *class, struct cu *cu)
 {
 	int savings;
 	const uint8_t reorg_verbose =
 			show_reorg_steps ? 2 : global_verbose;
+	const char *name = class__name(tag__class(class), cu);
 	struct class *clone = class__clone(tag__class(class), NULL, cu);
 	if (clone == NULL) {
 		fprintf(stderr, "pahole: out of memory!\n");
 		exit(EXIT_FAILURE);
 	}
-	class__reorganize(clone, cu, reorg_verbose, stdout);
+
+	if (narrow_members &&
+	    class__narrow_members(clone, cu, reorg_verbose, stdout) < 0) {
+		fprintf(stderr, "pahole: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (reorganize_bitfields &&
+	    class__reorganize_bitfields(clone, cu, reorg_verbose, stdout) < 0) {
+		fprintf(stderr, "pahole: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (member_weights_filename != NULL) {
+		if (class__reorganize_by_weight(clone, cu, pahole__member_weight,
+						(void *)name, reorg_verbose,
+						stdout) < 0) {
+			fprintf(stderr, "pahole: out of memory!\n");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		class__reorganize(clone, cu, reorg_verbose, stdout);
+		if (exact_reorg_budget_ms != 0 &&
+		    class__reorganize_exact(clone, cu, exact_reorg_budget_ms,
+					    reorg_verbose, stdout) < 0) {
+			fprintf(stderr, "pahole: out of memory!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 	savings = class__size(tag__class(class)) - class__size(clone);
 	if (savings != 0 && reorg_verbose) {
 		putchar('\n');
@@ -1175,7 +2998,7 @@ static void do_reorg(struct tag *class, struct cu *cu)
 			puts("/* Final reorganized struct: */");
 	}
 	tag__fprintf(class__tag(clone), cu, &conf, stdout);
-	if (savings != 0) {
+	if (savings > 0) {
 		const size_t cacheline_savings =
 		      (tag__nr_cachelines(class, cu) -
 		       tag__nr_cachelines(class__tag(clone), cu));
@@ -1188,13 +3011,87 @@ static void do_reorg(struct tag *class, struct cu *cu)
 			       cacheline_savings != 1 ?
 					"s" : "");
 		puts("! */");
-	} else
+	} else if (savings < 0)
+		printf("   /* grew %d byte%s */\n", -savings,
+		       savings != -1 ? "s" : "");
+	else
 		putchar('\n');
 
+	if (member_weights_filename != NULL) {
+		const uint32_t before = class__nr_hot_cachelines(tag__class(class), cu,
+								 pahole__member_weight,
+								 (void *)name),
+			       after  = class__nr_hot_cachelines(clone, cu,
+								 pahole__member_weight,
+								 (void *)name);
+
+		printf("   /* hot members span %u cacheline%s, was %u */\n",
+		       after, after != 1 ? "s" : "", before);
+	}
+
 	/* FIXME: we need to free in the right order,
 	 *	  cu->obstack is being corrupted...
 	 class__delete(clone, cu);
 	*/
+
+	/*
+	 * A server would grow with each query otherwise, the members were
+	 * cloned after the class, so go with them, but the narrowed enums
+	 * are in the CU tables.
+	 */
+	if (serve && !narrow_members)
+		obstack_free(&cu->obstack, clone);
+}
+
+/*
+ * Builtin profile names or files as described in hw_profile__load(), the
+ * first one sets the cacheline size if -c wasn't used.
+ */
+static int pahole__load_hw_profiles(char *names)
+{
+	const size_t max_profiles = sizeof(hw_profiles) / sizeof(hw_profiles[0]);
+	char *sep, *name = names;
+	uint8_t nr_profiles = 0;
+
+	while (name != NULL) {
+		sep = strchr(name, ',');
+		if (sep != NULL)
+			*sep++ = '\0';
+
+		if (nr_profiles == max_profiles) {
+			fprintf(stderr, "pahole: at most %zd hardware profiles\n", max_profiles);
+			return -1;
+		}
+
+		const struct hw_profile *builtin = hw_profile__find(name);
+
+		if (builtin != NULL) {
+			hw_profiles[nr_profiles] = *builtin;
+		} else {
+			int err = hw_profile__load(&hw_profiles[nr_profiles], name);
+
+			if (err == -EINVAL) {
+				fprintf(stderr, "pahole: %s: invalid hardware profile\n", name);
+				return -1;
+			} else if (err != 0) {
+				fprintf(stderr, "pahole: %s: %s, builtin profiles: ", name, strerror(-err));
+				hw_profile__fprintf_names(stderr);
+				fputc('\n', stderr);
+				return -1;
+			}
+		}
+
+		++nr_profiles;
+		name = sep;
+	}
+
+	conf.hw_profiles = hw_profiles;
+	conf.nr_hw_profiles = nr_profiles;
+
+	if (cacheline_size == 0)
+		cacheline_size = hw_profiles[0].cacheline_size;
+
+	return 0;
 }
 
 static enum load_steal_kind pahole_stealer(struct cu *cu,
@@ -1220,6 +3117,18 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 		goto dump_and_stop;
 	}
 
+	/* The queries are answered after all the CUs are loaded */
+	if (serve)
+		return LSK__KEEPIT;
+
+	if (type_graph != NULL) {
+		if (type_graph__add_cu(type_graph, cu, pahole__type_graph_filter, NULL) != 0) {
+			fprintf(stderr, "pahole: insufficient memory for "
+				"processing %s, skipping it...\n", cu->name);
+		}
+		goto dump_it;
+	}
+
 	if (class_name == NULL) {
 		if (stats_formatter == nr_methods_formatter) {
 			cu__account_nr_methods(cu);
@@ -1230,6 +3139,8 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 			cu_fixup_word_size_iterator(cu);
 
 		print_classes(cu);
+		if (formatter == array_strides_formatter)
+			cu__print_variable_array_strides(cu);
 		goto dump_it;
 	}
 
@@ -1241,8 +3152,7 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 		next = rb_next(&pos->rb_node);
 
 		static type_id_t class_id;
-		bool include_decls = find_pointers_in_structs != 0 ||
-				     stats_formatter == nr_methods_formatter;
+		bool include_decls = stats_formatter == nr_methods_formatter;
 		struct tag *class = cu__find_type_by_name(cu, pos->s, include_decls, &class_id);
 		if (class == NULL) {
 			class = cu__find_base_type_by_name(cu, pos->s, &class_id);
@@ -1268,11 +3178,14 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 		if (reorganize) {
 			if (class && tag__is_struct(class))
 				do_reorg(class, cu);
-		} else if (find_containers)
-			print_containers(cu, class_id, 0);
-		else if (find_pointers_in_structs)
-			print_structs_with_pointer_to(cu, class_id);
-		else if (class) {
+		} else if (false_sharing_filename != NULL) {
+			if (class && tag__is_struct(class))
+				print_false_sharing(class, cu);
+		} else if (slabinfo_filename != NULL) {
+			if (class && tag__is_struct(class))
+				slab_usages__account(&slab_usages, tag__class(class),
+						     class__name(tag__class(class), cu));
+		} else if (class) {
 			/*
 			 * We don't need to print it for every compile unit
 			 * but the previous options need
@@ -1328,6 +3241,331 @@ static int populate_class_names(void)
 	return *s ? add_class_name_entry(s) : 0;
 }
 
+/*
+ * --serve keeps all the CUs loaded and answers queries, one per line, read
+ * from stdin or from the clients of a UNIX socket, each answer ending with
+ * a line with just a '.':
+ *
+ *   class NAME...	 print the types, as with -C
+ *   expand NAME...	 the same, expanding the member types, as with -E
+ *   reorg NAME...	 reorganize the structs, as with -R
+ *   contains NAME...	 the structs embedding the types, as with -i
+ *   pointers NAME...	 the structs with pointers to the types, as with -f
+ *   sizes [NAME...]	 size and number of holes, of all structs if no NAME, as with -s
+ *   quit		 end the session
+ *   shutdown		 end the session and stop the server
+ *
+ * The other command line options, -R modifiers, --separator, etc, apply.
+ */
+enum serve_session_end {
+	SERVE__EOF,
+	SERVE__QUIT,
+	SERVE__SHUTDOWN,
+};
+
+static struct tag *cus__serve_find_type(struct cus *cus, const char *name,
+					struct cu **pcu, type_id_t *id)
+{
+	struct cu *cu;
+
+	list_for_each_entry(cu, &cus->cus, node) {
+		struct tag *type;
+
+		if (!cu__filter(cu))
+			continue;
+
+		type = cu__find_type_by_name(cu, name, false, id);
+		if (type == NULL)
+			type = cu__find_base_type_by_name(cu, name, id);
+		if (type != NULL) {
+			*pcu = cu;
+			return type;
+		}
+	}
+
+	return NULL;
+}
+
+/* Built on the first --contains or --find_pointers_to like query */
+static int cus__serve_type_graph(struct cus *cus)
+{
+	struct cu *cu;
+
+	if (type_graph != NULL)
+		return 0;
+
+	type_graph = type_graph__new();
+	if (type_graph == NULL)
+		return -ENOMEM;
+
+	list_for_each_entry(cu, &cus->cus, node) {
+		if (cu__filter(cu) &&
+		    type_graph__add_cu(type_graph, cu, pahole__type_graph_filter, NULL) != 0) {
+			type_graph__delete(type_graph);
+			type_graph = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static int cus__serve_sizes(struct cus *cus)
+{
+	void (*saved_formatter)(struct class *class, struct cu *cu, uint32_t id) = formatter;
+	struct cu *cu;
+
+	/* Each query prints all the structs again */
+	type_dedup__delete(printed_types);
+	printed_types = type_dedup__new();
+	if (printed_types == NULL)
+		return -ENOMEM;
+
+	formatter = size_formatter;
+	list_for_each_entry(cu, &cus->cus, node)
+		if (cu__filter(cu))
+			print_classes(cu);
+	formatter = saved_formatter;
+	return 0;
+}
+
+static int cus__serve_query(struct cus *cus, const char *cmd, char *args)
+{
+	const bool expand_types = conf.expand_types;
+	uint8_t *visiting = NULL;
+	char *name, *saveptr;
+
+	if (strcmp(cmd, "sizes") == 0 && args == NULL)
+		return cus__serve_sizes(cus);
+
+	if (strcmp(cmd, "contains") == 0 || strcmp(cmd, "pointers") == 0) {
+		if (cus__serve_type_graph(cus) != 0)
+			return -ENOMEM;
+		visiting = zalloc(type_graph->nr_nodes ?: 1);
+		if (visiting == NULL)
+			return -ENOMEM;
+	} else if (strcmp(cmd, "class") != 0 && strcmp(cmd, "expand") != 0 &&
+		   strcmp(cmd, "reorg") != 0 && strcmp(cmd, "sizes") != 0) {
+		printf("error: unknown query '%s'\n", cmd);
+		return 0;
+	}
+
+	if (args == NULL) {
+		printf("error: '%s' needs at least a type name\n", cmd);
+		free(visiting);
+		return 0;
+	}
+
+	for (name = strtok_r(args, " \t", &saveptr); name != NULL;
+	     name = strtok_r(NULL, " \t", &saveptr)) {
+		struct tag *type;
+		type_id_t id;
+		struct cu *cu;
+
+		if (visiting != NULL) {
+			uint32_t idx = type_graph__find(type_graph, name, TYPE_GRAPH__STRUCT);
+
+			if (idx == TYPE_GRAPH__NONE)
+				idx = type_graph__find(type_graph, name, TYPE_GRAPH__TYPEDEF);
+			if (idx == TYPE_GRAPH__NONE)
+				printf("error: '%s' not found\n", name);
+			else if (cmd[0] == 'c') {
+				if (type_graph__print_containers(type_graph, idx, 0, visiting) != 0)
+					printf("error: insufficient memory\n");
+			} else
+				type_graph__print_pointers_to(type_graph, idx, visiting);
+			continue;
+		}
+
+		type = cus__serve_find_type(cus, name, &cu, &id);
+		if (type == NULL) {
+			printf("error: '%s' not found\n", name);
+			continue;
+		}
+
+		if (tag__is_struct(type) || tag__is_union(type))
+			class__find_holes(tag__class(type));
+
+		if (strcmp(cmd, "reorg") == 0) {
+			if (tag__is_struct(type))
+				do_reorg(type, cu);
+			else
+				printf("error: '%s' isn't a struct\n", name);
+		} else if (strcmp(cmd, "sizes") == 0) {
+			if (tag__is_struct(type) || tag__is_union(type))
+				size_formatter(tag__class(type), cu, id);
+			else
+				printf("error: '%s' isn't a struct or union\n", name);
+		} else {
+			conf.expand_types = cmd[0] == 'e' ? 1 : expand_types;
+			tag__fprintf(type, cu, &conf, stdout);
+			putchar('\n');
+			conf.expand_types = expand_types;
+		}
+	}
+
+	free(visiting);
+	return 0;
+}
+
+static enum serve_session_end cus__serve_session(struct cus *cus, FILE *in)
+{
+	enum serve_session_end end = SERVE__EOF;
+	size_t line_size = 0;
+	char *line = NULL;
+
+	while (getline(&line, &line_size, in) > 0) {
+		char *saveptr, *cmd = strtok_r(line, " \t\r\n", &saveptr),
+		     *args = strtok_r(NULL, "\r\n", &saveptr);
+
+		if (cmd == NULL)
+			continue;
+
+		if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "shutdown") == 0) {
+			end = cmd[0] == 'q' ? SERVE__QUIT : SERVE__SHUTDOWN;
+			break;
+		}
+
+		if (cus__serve_query(cus, cmd, args) != 0)
+			puts("error: insufficient memory");
+		puts(".");
+		fflush(stdout);
+	}
+
+	free(line);
+	return end;
+}
+
+/*
+ * Replace a socket left by a server that is gone, i.e. one that refuses
+ * connections, but not the one of a running server, nor anything else.
+ */
+static int serve_socket__remove_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, err;
+
+	if (lstat(addr->sun_path, &st) != 0)
+		return errno == ENOENT ? 0 : -errno;
+
+	if (!S_ISSOCK(st.st_mode))
+		return -EEXIST;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0)
+		err = -EADDRINUSE;
+	else if (errno == ECONNREFUSED)
+		err = unlink(addr->sun_path) == 0 ? 0 : -errno;
+	else
+		err = -errno;
+
+	close(fd);
+	return err;
+}
+
+/*
+ * One client at a time, with stdout redirected to it, so that the code used
+ * in one shot runs can be used as is.
+ */
+static int cus__serve_socket(struct cus *cus, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+	struct stat st = { .st_ino = 0, }, now;
+	int fd, stdout_fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "pahole: %s: socket path too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		err = -errno;
+		goto out_err;
+	}
+
+	err = serve_socket__remove_stale(&addr);
+	if (err != 0)
+		goto out_close;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, 16) != 0) {
+		err = -errno;
+		goto out_close;
+	}
+
+	/* To remove it at exit only if it is still ours */
+	if (lstat(path, &st) != 0) {
+		err = -errno;
+		goto out_unlink;
+	}
+
+	stdout_fd = dup(STDOUT_FILENO);
+	if (stdout_fd < 0) {
+		err = -errno;
+		goto out_unlink;
+	}
+
+	/* Clients going away mid answer shouldn't take the server with them */
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1) {
+		enum serve_session_end end;
+		int client = accept(fd, NULL, NULL);
+		FILE *in;
+
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			goto out_restore;
+		}
+
+		in = fdopen(client, "r");
+		if (in == NULL) {
+			close(client);
+			continue;
+		}
+
+		fflush(stdout);
+		dup2(client, STDOUT_FILENO);
+		end = cus__serve_session(cus, in);
+		fflush(stdout);
+		dup2(stdout_fd, STDOUT_FILENO);
+		fclose(in);
+
+		if (end == SERVE__SHUTDOWN)
+			break;
+	}
+
+	err = 0;
+out_restore:
+	close(stdout_fd);
+out_unlink:
+	if (lstat(path, &now) == 0 &&
+	    now.st_dev == st.st_dev && now.st_ino == st.st_ino)
+		unlink(path);
+out_close:
+	close(fd);
+out_err:
+	if (err)
+		fprintf(stderr, "pahole: %s: %s\n", path, strerror(-err));
+	return err;
+}
+
+static int cus__serve(struct cus *cus)
+{
+	if (serve_socket != NULL)
+		return cus__serve_socket(cus, serve_socket);
+
+	cus__serve_session(cus, stdin);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int err, remaining, rc = EXIT_FAILURE;
@@ -1337,9 +3575,82 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (nr_jobs <= 0) {
+		nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr_jobs <= 0)
+			nr_jobs = 1;
+	}
+
+	fp__set_big_unlocked_buffer(stdout);
+
+	if (formatter == size_class_formatter && size_classes == NULL) {
+		size_classes = kmalloc_size_classes;
+		nr_size_classes = sizeof(kmalloc_size_classes) / sizeof(kmalloc_size_classes[0]);
+	}
+
+	if (hw_profile_names != NULL && pahole__load_hw_profiles(hw_profile_names) != 0)
+		goto out;
+
+	if (member_weights_filename != NULL &&
+	    member_annotations__load(&member_weights, member_weights_filename) != 0)
+		goto out;
+
+	if (false_sharing_filename != NULL) {
+		if (member_annotations__load(&member_access, false_sharing_filename) != 0)
+			goto out;
+		/* Look just at the annotated structs if none was asked for */
+		if (class_name == NULL) {
+			class_name = member_annotations__class_names(&member_access);
+			if (class_name == NULL) {
+				fputs("pahole: insufficient memory\n", stderr);
+				goto out;
+			}
+		}
+	}
+
+	if (slabinfo_filename != NULL) {
+		if (slab_usages__load(&slab_usages, slabinfo_filename,
+				      slab_caches_filename) != 0)
+			goto out;
+		if (class_name == NULL) {
+			class_name = slab_usages__class_names(&slab_usages);
+			if (class_name == NULL) {
+				fputs("pahole: insufficient memory\n", stderr);
+				goto out;
+			}
+		}
+	}
+
 	class_names = strlist__new(true);
 
-	if (class_names == NULL || dwarves__init(cacheline_size)) {
+	printed_types = type_dedup__new();
+
+	if (!serve && (find_containers || find_pointers_in_structs || size_impact)) {
+		type_graph = type_graph__new();
+		if (type_graph == NULL) {
+			fputs("pahole: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
+	if (parallel_format && !serve && formatter == class_formatter) {
+		format_queue = fprintf_queue__new(nr_jobs);
+		if (format_queue == NULL) {
+			fputs("pahole: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
+	if (export_layouts_filename != NULL) {
+		layouts_writer = layouts_writer__new();
+		if (layouts_writer == NULL) {
+			fputs("pahole: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
+	if (class_names == NULL || printed_types == NULL ||
+	    dwarves__init(cacheline_size)) {
 		fputs("pahole: insufficient memory\n", stderr);
 		goto out;
 	}
@@ -1353,6 +3664,8 @@ int main(int argc, char *argv[])
 	memset(tab, ' ', sizeof(tab) - 1);
 
 	conf_load.steal = pahole_stealer;
+	if (cu__exclude_prefix != NULL)
+		conf_load.early_cu_filter = pahole__early_cu_filter;
 
 try_sole_arg_as_class_names:
 	if (class_name && populate_class_names())
@@ -1360,7 +3673,7 @@ try_sole_arg_as_class_names:
 
 	err = cus__load_files(cus, &conf_load, argv + remaining);
 	if (err != 0) {
-		if (class_name == NULL) {
+		if (class_name == NULL && !serve) {
 			class_name = argv[remaining];
 			remaining = argc;
 			goto try_sole_arg_as_class_names;
@@ -1377,8 +3690,37 @@ try_sole_arg_as_class_names:
 		}
 	}
 
+	if (serve) {
+		if (cus__serve(cus) == 0)
+			rc = EXIT_SUCCESS;
+		goto out_cus_delete;
+	}
+
+	if (size_impact && type_graph__print_size_impact(type_graph) != 0) {
+		fputs("pahole: insufficient memory\n", stderr);
+		goto out_cus_delete;
+	}
+	if (type_graph != NULL && !size_impact && type_graph__print_queries(type_graph) != 0) {
+		fputs("pahole: insufficient memory\n", stderr);
+		goto out_cus_delete;
+	}
 	if (stats_formatter != NULL)
 		print_stats();
+	if (packable_sweep)
+		packable_sweep__print();
+	if (slabinfo_filename != NULL)
+		slab_usages__print(&slab_usages);
+	if (formatter == hazards_formatter)
+		layout_hazards__print(&layout_hazards);
+	if (layouts_writer != NULL) {
+		err = layouts_err ?: layouts_writer__write(layouts_writer,
+							   export_layouts_filename);
+		if (err != 0) {
+			fprintf(stderr, "pahole: couldn't export the layouts to %s: %s\n",
+				export_layouts_filename, strerror(-err));
+			goto out_cus_delete;
+		}
+	}
 	rc = EXIT_SUCCESS;
 out_cus_delete:
 #ifdef DEBUG_CHECK_LEAKS
@@ -1391,6 +3733,10 @@ out_dwarves_exit:
 #endif
 out:
 #ifdef DEBUG_CHECK_LEAKS
+	type_dedup__delete(printed_types);
+	type_graph__delete(type_graph);
+	fprintf_queue__delete(format_queue);
+	layouts_writer__delete(layouts_writer);
 	strlist__delete(class_names);
 #endif
 	return rc;
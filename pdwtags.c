@@ -16,9 +16,13 @@ static struct conf_fprintf conf = {
 	.emit_stats	= 1,
 };
 
-static void emit_tag(struct tag *tag, uint32_t tag_id, struct cu *cu)
+static int nr_jobs = 1;
+static struct fprintf_queue *queue;
+
+static size_t emit_tag(struct tag *tag, const struct cu *cu, uint32_t tag_id,
+		       const struct conf_fprintf *conf, FILE *fp)
 {
-	printf("/* %d */\n", tag_id);
+	size_t printed = fprintf(fp, "/* %d */\n", tag_id);
 
 	if (tag__is_struct(tag))
 		class__find_holes(tag__class(tag));
@@ -29,15 +33,58 @@ static void emit_tag(struct tag *tag, uint32_t tag_id, struct cu *cu)
 						   bf, sizeof(bf));
 
 		if (name == NULL)
-			printf("anonymous base_type\n");
+			printed += fprintf(fp, "anonymous base_type\n");
 		else
-			puts(name);
+			printed += fprintf(fp, "%s\n", name);
 	} else if (tag__is_pointer(tag))
-		printf(" /* pointer to %lld */\n", (unsigned long long)tag->type);
+		printed += fprintf(fp, " /* pointer to %lld */\n",
+				   (unsigned long long)tag->type);
 	else
-		tag__fprintf(tag, cu, &conf, stdout);
+		printed += tag__fprintf(tag, cu, conf, fp);
+
+	return printed + fprintf(fp, " /* size: %zd */\n\n", tag__size(tag, cu));
+}
+
+static size_t emit_function(struct tag *tag, const struct cu *cu,
+			    uint32_t id __unused,
+			    const struct conf_fprintf *conf, FILE *fp)
+{
+	struct function *function = tag__function(tag);
+	size_t printed = tag__fprintf(tag, cu, conf, fp);
+
+	fputc('\n', fp);
+	printed += 1 + lexblock__fprintf(&function->lexblock, cu, function, 0,
+					 conf, fp);
+	return printed + fprintf(fp, " /* size: %zd */\n\n", tag__size(tag, cu));
+}
+
+static size_t emit_variable(struct tag *tag, const struct cu *cu,
+			    uint32_t id __unused,
+			    const struct conf_fprintf *conf, FILE *fp)
+{
+	size_t printed = tag__fprintf(tag, cu, conf, fp);
+
+	return printed + fprintf(fp, " /* size: %zd */\n\n", tag__size(tag, cu));
+}
+
+/* With --jobs the tags are formatted in parallel when the queue is flushed */
+static void emit(fprintf_queue__fprintf_t fn, struct tag *tag, struct cu *cu,
+		 uint32_t id, const struct conf_fprintf *conf)
+{
+	if (queue != NULL) {
+		if (fprintf_queue__add(queue, fn, tag, cu, id, conf) == 0)
+			return;
+		/* No memory to queue it, print it after the ones queued */
+		fprintf_queue__flush(queue, stdout);
+	}
+
+	fn(tag, cu, id, conf, stdout);
+}
 
-	printf(" /* size: %zd */\n\n", tag__size(tag, cu));
+static void emit_queued(void)
+{
+	if (queue != NULL)
+		fprintf_queue__flush(queue, stdout);
 }
 
 static int cu__emit_tags(struct cu *cu)
@@ -47,26 +94,21 @@ static int cu__emit_tags(struct cu *cu)
 
 	puts("/* Types: */\n");
 	cu__for_each_type(cu, i, tag)
-		emit_tag(tag, i, cu);
+		emit(emit_tag, tag, cu, i, &conf);
+	emit_queued();
 
 	puts("/* Functions: */\n");
 	conf.no_semicolon = true;
 	struct function *function;
-	cu__for_each_function(cu, i, function) {
-		tag__fprintf(function__tag(function), cu, &conf, stdout);
-		putchar('\n');
-		lexblock__fprintf(&function->lexblock, cu, function, 0,
-				  &conf, stdout);
-		printf(" /* size: %zd */\n\n",
-		       tag__size(function__tag(function), cu));
-	}
+	cu__for_each_function(cu, i, function)
+		emit(emit_function, function__tag(function), cu, i, &conf);
+	emit_queued();
 	conf.no_semicolon = false;
 
 	puts("\n\n/* Variables: */\n");
-	cu__for_each_variable(cu, i, tag) {
-		tag__fprintf(tag, cu, NULL, stdout);
-		printf(" /* size: %zd */\n\n", tag__size(tag, cu));
-	}
+	cu__for_each_variable(cu, i, tag)
+		emit(emit_variable, tag, cu, i, NULL);
+	emit_queued();
 
 
 	return 0;
@@ -99,12 +141,18 @@ static const struct argp_option pdwtags__options[] = {
 		.name = "verbose",
 		.doc  = "show details",
 	},
+	{
+		.key  = 'j',
+		.name = "jobs",
+		.arg  = "NR_JOBS",
+		.doc  = "format the tags with up to NR_JOBS threads, the output is the same",
+	},
 	{
 		.name = NULL,
 	}
 };
 
-static error_t pdwtags__options_parser(int key, char *arg __unused,
+static error_t pdwtags__options_parser(int key, char *arg,
 				      struct argp_state *state)
 {
 	switch (key) {
@@ -114,6 +162,7 @@ static error_t pdwtags__options_parser(int key, char *arg __unused,
 		break;
 	case 'F': pdwtags_conf_load.format_path = arg;	break;
 	case 'V': conf.show_decl_info = 1;		break;
+	case 'j': nr_jobs = atoi(arg);			break;
 	default:  return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
@@ -143,6 +192,16 @@ int main(int argc, char *argv[])
                 goto out;
 	}
 
+	fp__set_big_unlocked_buffer(stdout);
+
+	if (nr_jobs > 1) {
+		queue = fprintf_queue__new(nr_jobs);
+		if (queue == NULL) {
+			fputs("pdwtags: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
 	err = cus__load_files(cus, &pdwtags_conf_load, argv + remaining);
 	if (err == 0) {
 		rc = EXIT_SUCCESS;
@@ -152,6 +211,7 @@ int main(int argc, char *argv[])
 	cus__fprintf_load_files_err(cus, "pdwtags", argv + remaining, err, stderr);
 out:
 	cus__delete(cus);
+	fprintf_queue__delete(queue);
 	dwarves__exit();
 	return rc;
 }
@@ -33,6 +33,8 @@ static bool expand_types;
 static bool compilable_output;
 static struct type_emissions emissions;
 static uint64_t addr;
+static int nr_jobs = 1;
+static struct fprintf_queue *queue;
 
 static struct conf_fprintf conf;
 
@@ -43,13 +45,13 @@ static struct conf_load conf_load = {
 struct fn_stats {
 	struct list_head node;
 	struct tag	 *tag;
-	const struct cu	 *cu;
+	struct cu	 *cu;
 	uint32_t	 nr_expansions;
 	uint32_t	 size_expansions;
 	uint32_t	 nr_files;
 };
 
-static struct fn_stats *fn_stats__new(struct tag *tag, const struct cu *cu)
+static struct fn_stats *fn_stats__new(struct tag *tag, struct cu *cu)
 {
 	struct fn_stats *stats = malloc(sizeof(*stats));
 
@@ -94,7 +96,7 @@ static void fn_stats__delete_list(void)
 	}
 }
 
-static void fn_stats__add(struct tag *tag, const struct cu *cu)
+static void fn_stats__add(struct tag *tag, struct cu *cu)
 {
 	struct fn_stats *fns = fn_stats__new(tag, cu);
 	if (fns != NULL)
@@ -149,17 +151,36 @@ static void fn_stats_size_fmtr(const struct fn_stats *stats)
 		printf("%s: %zd\n", function__name(fn, stats->cu), size);
 }
 
+static size_t function__fprintf_verbose(struct tag *tag, const struct cu *cu,
+					uint32_t nr_files,
+					const struct conf_fprintf *conf,
+					FILE *fp)
+{
+	size_t printed = tag__fprintf(tag, cu, conf, fp);
+
+	fputc('\n', fp);
+	++printed;
+	if (show_prototypes)
+		return printed;
+	if (show_variables || show_inline_expansions)
+		printed += function__fprintf_stats(tag, cu, conf, fp);
+	return printed + fprintf(fp, "/* definitions: %u */\n\n", nr_files);
+}
+
 static void fn_stats_fmtr(const struct fn_stats *stats)
 {
 	if (verbose || show_prototypes) {
-		tag__fprintf(stats->tag, stats->cu, &conf, stdout);
-		putchar('\n');
-		if (show_prototypes)
-			return;
-		if (show_variables || show_inline_expansions)
-			function__fprintf_stats(stats->tag, stats->cu, &conf, stdout);
-		printf("/* definitions: %u */\n", stats->nr_files);
-		putchar('\n');
+		/* With --jobs they are formatted in parallel by print_fn_stats() */
+		if (queue != NULL) {
+			if (fprintf_queue__add(queue, function__fprintf_verbose,
+					       stats->tag, stats->cu,
+					       stats->nr_files, &conf) == 0)
+				return;
+			/* No memory to queue it, print it after the ones queued */
+			fprintf_queue__flush(queue, stdout);
+		}
+		function__fprintf_verbose(stats->tag, stats->cu,
+					  stats->nr_files, &conf, stdout);
 	} else {
 		struct function *fn = tag__function(stats->tag);
 		puts(function__name(fn, stats->cu));
@@ -172,6 +193,9 @@ static void print_fn_stats(void (*formatter)(const struct fn_stats *f))
 
 	list_for_each_entry(pos, &fn_stats__list, node)
 		formatter(pos);
+
+	if (queue != NULL)
+		fprintf_queue__flush(queue, stdout);
 }
 
 static void fn_stats_inline_stats_fmtr(const struct fn_stats *stats)
@@ -606,6 +630,12 @@ static const struct argp_option pfunct__options[] = {
 		.name = "verbose",
 		.doc  = "be verbose",
 	},
+	{
+		.key  = 'j',
+		.name = "jobs",
+		.arg  = "NR_JOBS",
+		.doc  = "format the functions with up to NR_JOBS threads, the output is the same",
+	},
 	{
 		.name  = "symtab",
 		.key   = ARGP_symtab,
@@ -673,6 +703,7 @@ static error_t pfunct__options_parser(int key, char *arg,
 	case 'V': verbose = 1;
 		  conf_load.extra_dbg_info = true;
 		  conf_load.get_addr_info = true;	 break;
+	case 'j': nr_jobs = atoi(arg);			 break;
 	case ARGP_symtab: symtab_name = arg ?: ".symtab";  break;
 	case ARGP_no_parm_names: conf.no_parm_names = 1; break;
 	case ARGP_compile:
@@ -708,6 +739,16 @@ int main(int argc, char *argv[])
                 goto out;
 	}
 
+	fp__set_big_unlocked_buffer(stdout);
+
+	if (nr_jobs > 1) {
+		queue = fprintf_queue__new(nr_jobs);
+		if (queue == NULL) {
+			fputs("pfunct: insufficient memory\n", stderr);
+			goto out;
+		}
+	}
+
 	if (symtab_name != NULL)
 		return elf_symtabs__show(argv + remaining);
 
@@ -757,5 +798,6 @@ out_cus_delete:
 out_dwarves_exit:
 	dwarves__exit();
 out:
+	fprintf_queue__delete(queue);
 	return rc;
 }
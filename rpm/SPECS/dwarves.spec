@@ -85,6 +85,7 @@ make install DESTDIR=%{buildroot}
 %{_bindir}/pfunct
 %{_bindir}/pglobal
 %{_bindir}/prefcnt
+%{_bindir}/reorgdiff
 %{_bindir}/scncopy
 %{_bindir}/syscse
 %{_bindir}/ostra-cg
@@ -113,6 +114,7 @@ make install DESTDIR=%{buildroot}
 %{_includedir}/dwarves/dutil.h
 %{_includedir}/dwarves/dwarves.h
 %{_includedir}/dwarves/dwarves_emit.h
+%{_includedir}/dwarves/dwarves_layouts.h
 %{_includedir}/dwarves/dwarves_reorganize.h
 %{_includedir}/dwarves/elfcreator.h
 %{_includedir}/dwarves/elf_symtab.h
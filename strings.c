@@ -44,7 +44,9 @@ void strings__delete(struct strings *strs)
 
 static strings_t strings__insert(struct strings *strs, const char *s)
 {
-	return gobuffer__add(&strs->gb, s, strlen(s) + 1);
+	const ssize_t index = gobuffer__add(&strs->gb, s, strlen(s) + 1);
+
+	return index < 0 ? 0 : index;
 }
 
 struct search_key {
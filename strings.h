@@ -8,7 +8,11 @@
 
 #include "gobuffer.h"
 
-typedef unsigned int strings_t;
+/*
+ * Offset into the strings table, 64-bit on 64-bit hosts, BTF and CTF use the
+ * table as their string section and thus require it to be under 4 GiB.
+ */
+typedef size_t strings_t;
 
 struct strings {
 	void		*tree;
@@ -39,7 +43,7 @@ static inline unsigned int strings__nr_entries(const struct strings *strings)
 	return gobuffer__nr_entries(&strings->gb);
 }
 
-static inline strings_t strings__size(const struct strings *strings)
+static inline size_t strings__size(const struct strings *strings)
 {
 	return gobuffer__size(&strings->gb);
 }